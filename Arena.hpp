@@ -0,0 +1,442 @@
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+/**
+ * \brief A monotonic (bump pointer) allocator for objects that all die together
+ *
+ * Allocating from an arena just bumps a pointer along a block of memory,
+ * and individual allocations are never freed. Instead, everything allocated
+ * after a Marker is thrown away at once by rewinding to it,
+ * or everything at all by resetting the arena.
+ * This suits temporaries that share a lifetime, like everything made while handling
+ * a request or during a frame, far better than constructing and destroying each one.
+ *
+ * Memory comes in blocks, which are chained together as the arena grows.
+ * Rewinding keeps the blocks around, so an arena that is reset every frame stops
+ * calling malloc at all once it has grown to fit its busiest frame.
+ *
+ * Objects made with construct() that have non-trivial destructors are tracked,
+ * and destroyed (newest first) when the arena is rewound past them.
+ * Tracking costs a few words of arena space per object, and nothing
+ * for trivially destructible types. constructUntracked() skips it.
+ *
+ * \warning Like Pool, an arena is not thread-safe.
+ */
+class Arena {
+
+	struct Block;
+
+	struct Finalizer;
+
+public:
+
+	/// The default size of each block, in bytes
+	static const size_t defaultBlockSize = 64 * 1024;
+
+	/// A point in the arena's history which it can be rewound to (see mark() and rewind())
+	struct Marker {
+		Block* block; ///< The block that was being allocated from
+		char* top; ///< The next free byte in that block
+		Finalizer* finalizers; ///< The newest tracked object
+	};
+
+	/**
+	 * \brief Creates an arena and allocates its first block
+	 * \param blockSize The size of each block. Bigger allocations get a block of their own.
+	 * \throws std::invalid_argument if the block size is zero
+	 * \throws std::bad_alloc if the first block cannot be allocated
+	 */
+	explicit Arena(size_t blockSize = defaultBlockSize) :
+		first(nullptr),
+		current(nullptr),
+		top(nullptr),
+		finalizers(nullptr),
+		blockSize(blockSize)
+	{
+		if (blockSize == 0)
+			throw std::invalid_argument("Arena blocks must be able to hold something");
+
+		first = current = newBlock(blockSize, nullptr);
+		top = current->data();
+	}
+
+	/// Destructor. Destroys every tracked object, then frees every block.
+	~Arena()
+	{
+		runFinalizers(nullptr);
+
+		while (first != nullptr) {
+			Block* next = first->next;
+			free(first);
+			first = next;
+		}
+	}
+
+	/**
+	 * \brief Allocates uninitialized memory from the arena
+	 * \param bytes The number of bytes to allocate
+	 * \param alignment The alignment of the memory, which must be a power of two
+	 * \throws std::invalid_argument if the alignment is not a power of two
+	 * \throws std::bad_alloc if a new block is needed and cannot be allocated
+	 *
+	 * Complexity is O(1)
+	 */
+	void* allocate(size_t bytes, size_t alignment = alignof(std::max_align_t))
+	{
+		if (alignment == 0 || (alignment & (alignment - 1)) != 0)
+			throw std::invalid_argument("Alignments must be powers of two");
+
+		char* start = alignUp(top, alignment);
+		if (start > current->end() || bytes > size_t(current->end() - start)) {
+			advance(bytes, alignment);
+			start = alignUp(top, alignment);
+		}
+
+		top = start + bytes;
+		return start;
+	}
+
+	/**
+	 * \brief Allocates and constructs an object in the arena
+	 * \param args Arguments forwarded to a constructor of T
+	 * \throws std::bad_alloc if a new block is needed and cannot be allocated
+	 * \throws Whatever T's constructor throws, in which case the arena is left as it was
+	 *
+	 * If T has a non-trivial destructor, it is run when the arena is rewound past the object.
+	 */
+	template <typename T, typename... Args>
+	T* construct(Args&&... args)
+	{
+		if (std::is_trivially_destructible<T>::value)
+			return constructUntracked<T>(std::forward<Args>(args)...);
+
+		const Marker before = mark();
+		Finalizer* f = static_cast<Finalizer*>(allocate(sizeof(Finalizer), alignof(Finalizer)));
+		T* t;
+		try {
+			t = constructUntracked<T>(std::forward<Args>(args)...);
+		}
+		catch (...) {
+			rewind(before);
+			throw;
+		}
+
+		f->destroy = &destroyObject<T>;
+		f->object = t;
+		f->previous = finalizers;
+		finalizers = f;
+		return t;
+	}
+
+	/**
+	 * \brief Allocates and constructs an object whose destructor the arena will never run
+	 *
+	 * Use this for objects that are destroyed by hand, or whose destructors
+	 * don't need to run (say, because they only free memory in this same arena).
+	 */
+	template <typename T, typename... Args>
+	T* constructUntracked(Args&&... args)
+	{
+		const Marker before = mark();
+		void* where = allocate(sizeof(T), alignof(T));
+		try {
+			return ::new (where) T(std::forward<Args>(args)...);
+		}
+		catch (...) {
+			rewind(before);
+			throw;
+		}
+	}
+
+	/**
+	 * \brief Allocates an uninitialized array of _count_ T
+	 * \throws std::bad_alloc if the array is too big, or if a new block is needed
+	 *         and cannot be allocated
+	 */
+	template <typename T>
+	T* allocateArray(size_t count)
+	{
+		if (count > size_t(-1) / sizeof(T))
+			throw std::bad_alloc();
+
+		return static_cast<T*>(allocate(count * sizeof(T), alignof(T)));
+	}
+
+	/// Returns the current point in the arena's history, to be rewound to later
+	Marker mark() const
+	{
+		Marker m = {current, top, finalizers};
+		return m;
+	}
+
+	/**
+	 * \brief Throws away everything allocated since a marker was taken
+	 * \param m A marker from this arena, taken since the last time it was rewound
+	 *          to an earlier point
+	 *
+	 * Tracked objects made since the marker are destroyed, newest first.
+	 * Their memory, and any blocks added since, are kept for reuse.
+	 *
+	 * Complexity is O(number of tracked objects destroyed)
+	 */
+	void rewind(const Marker& m)
+	{
+		runFinalizers(m.finalizers);
+		current = m.block;
+		top = m.top;
+	}
+
+	/// Throws away everything in the arena, keeping its blocks for reuse
+	void reset()
+	{
+		runFinalizers(nullptr);
+		current = first;
+		top = first->data();
+	}
+
+	/**
+	 * \brief Frees every block past the one currently being allocated from
+	 *
+	 * Call this after rewinding or resetting to give back memory that
+	 * an unusually busy stretch needed.
+	 */
+	void shrink()
+	{
+		Block* b = current->next;
+		current->next = nullptr;
+		while (b != nullptr) {
+			Block* next = b->next;
+			free(b);
+			b = next;
+		}
+	}
+
+	/// Returns the number of bytes allocated since the arena was last reset, including padding
+	size_t used() const
+	{
+		size_t total = 0;
+		for (const Block* b = first; b != current; b = b->next)
+			total += b->size;
+
+		return total + (top - current->data());
+	}
+
+	/// Returns the number of bytes the arena's blocks can hold
+	size_t capacity() const
+	{
+		size_t total = 0;
+		for (const Block* b = first; b != nullptr; b = b->next)
+			total += b->size;
+
+		return total;
+	}
+
+	/// The copy constructor is deleted (see Pool)
+	Arena(const Arena&) = delete;
+
+	/// The assignment operator is deleted (see Pool)
+	const Arena& operator=(const Arena&) = delete;
+
+private:
+
+	/// A block of memory, followed directly by its contents
+	struct Block {
+		Block* next; ///< The next block in the chain, or null
+		size_t size; ///< The number of bytes after this header
+
+		char* data() { return reinterpret_cast<char*>(this) + headerSize; }
+
+		char* end() { return data() + size; }
+	};
+
+	/// The record of a tracked object, kept in the arena just before the object
+	struct Finalizer {
+		void (*destroy)(void*); ///< Destroys the object
+		void* object; ///< The object
+		Finalizer* previous; ///< The tracked object before this one
+	};
+
+	/// The size of a block's header, rounded up so that its contents are suitably aligned
+	static const size_t headerSize =
+		(sizeof(Block) + alignof(std::max_align_t) - 1) / alignof(std::max_align_t) * alignof(std::max_align_t);
+
+	template <typename T>
+	static void destroyObject(void* t) { static_cast<T*>(t)->~T(); }
+
+	static char* alignUp(char* p, size_t alignment)
+	{
+		return reinterpret_cast<char*>((reinterpret_cast<uintptr_t>(p) + alignment - 1) & ~(alignment - 1));
+	}
+
+	/// Allocates a block with room for _size_ bytes, to go before _next_ in the chain
+	static Block* newBlock(size_t size, Block* next)
+	{
+		Block* b = static_cast<Block*>(malloc(headerSize + size));
+		if (b == nullptr)
+			throw std::bad_alloc();
+
+		b->next = next;
+		b->size = size;
+		return b;
+	}
+
+	/**
+	 * \brief Moves on to a block that can fit an allocation
+	 *
+	 * The next block in the chain (left over from before a rewind) is used if it is big enough.
+	 * Otherwise a new one is put in front of it.
+	 */
+	void advance(size_t bytes, size_t alignment)
+	{
+		// Leave room to align the allocation in the worst case.
+		const size_t needed = bytes + alignment - 1;
+		if (needed < bytes)
+			throw std::bad_alloc();
+
+		Block* next = current->next;
+		if (next == nullptr || next->size < needed)
+			next = current->next = newBlock(needed > blockSize ? needed : blockSize, next);
+
+		current = next;
+		top = current->data();
+	}
+
+	/// Destroys tracked objects, newest first, until we get back to _until_
+	void runFinalizers(Finalizer* until)
+	{
+		while (finalizers != until) {
+			assert(finalizers != nullptr);
+			Finalizer* f = finalizers;
+			finalizers = f->previous;
+			f->destroy(f->object);
+		}
+	}
+
+	Block* first; ///< The first block in the chain
+	Block* current; ///< The block we are allocating from
+	char* top; ///< The next free byte in the current block
+	Finalizer* finalizers; ///< The newest tracked object, which links to the rest
+	size_t blockSize; ///< The size of new blocks (unless an allocation needs a bigger one)
+};
+
+/**
+ * \brief An allocator that gets its memory from an Arena, for use by the standard library containers
+ *
+ * Deallocation does nothing. Memory is reclaimed when the arena is rewound or reset,
+ * so the container must be gone (or at least never touched again) by then.
+ * Unlike PoolAllocator, this can be rebound to any type,
+ * so it works for node-based containers as well as vectors.
+ */
+template <typename T>
+class ArenaAllocator {
+
+public:
+
+	typedef T value_type;
+	typedef T* pointer;
+	typedef const T* const_pointer;
+	typedef T& reference;
+	typedef const T& const_reference;
+	typedef size_t size_type;
+	typedef ptrdiff_t difference_type;
+
+	typedef std::true_type propagate_on_container_copy_assignment;
+	typedef std::true_type propagate_on_container_move_assignment;
+	typedef std::true_type propagate_on_container_swap;
+
+	template <typename U>
+	struct rebind {
+		typedef ArenaAllocator<U> other;
+	};
+
+	/// Creates an allocator that allocates from the given arena
+	ArenaAllocator(Arena& a) : arena(&a) { }
+
+	/// Allocators for other types from the same arena can be converted to this one
+	template <typename U>
+	ArenaAllocator(const ArenaAllocator<U>& o) : arena(o.arena) { }
+
+	T* allocate(size_t num) { return arena->allocateArray<T>(num); }
+
+	void deallocate(T*, size_t) { }
+
+	template <typename U>
+	bool operator==(const ArenaAllocator<U>& o) const { return arena == o.arena; }
+
+	template <typename U>
+	bool operator!=(const ArenaAllocator<U>& o) const { return arena != o.arena; }
+
+private:
+
+	template <typename U>
+	friend class ArenaAllocator;
+
+	Arena* arena; ///< The arena we allocate from
+};
+
+/**
+ * \brief A pair of arenas that take turns, for memory that lives for a frame (or two)
+ *
+ * Each frame allocates from the current arena. nextFrame() swaps the arenas
+ * and resets the new current one, so anything allocated during a frame stays valid
+ * through the next one as well, which is handy for comparing against last frame's results.
+ * Since the arenas keep their blocks, allocation settles down to bumping a pointer.
+ */
+class FrameArena {
+
+public:
+
+	/// Creates the two arenas (see Arena::Arena)
+	explicit FrameArena(size_t blockSize = Arena::defaultBlockSize) :
+		even(blockSize), odd(blockSize), active(&even), frame(0)
+	{
+	}
+
+	/// Returns the arena for this frame
+	Arena& current() { return *active; }
+
+	/// Returns the arena for last frame, which is still intact
+	Arena& previous() { return active == &even ? odd : even; }
+
+	/// Allocates and constructs an object that lives until the end of the next frame
+	template <typename T, typename... Args>
+	T* construct(Args&&... args) { return active->construct<T>(std::forward<Args>(args)...); }
+
+	/// Allocates uninitialized memory that lives until the end of the next frame
+	void* allocate(size_t bytes, size_t alignment = alignof(std::max_align_t))
+	{
+		return active->allocate(bytes, alignment);
+	}
+
+	/// Ends the frame. Last frame's arena is reset and becomes the current one.
+	void nextFrame()
+	{
+		++frame;
+		active = &previous();
+		active->reset();
+	}
+
+	/// Returns the number of frames ended so far
+	size_t frameNumber() const { return frame; }
+
+	/// The copy constructor is deleted (see Pool)
+	FrameArena(const FrameArena&) = delete;
+
+	/// The assignment operator is deleted (see Pool)
+	const FrameArena& operator=(const FrameArena&) = delete;
+
+private:
+
+	Arena even; ///< The arena for even-numbered frames
+	Arena odd; ///< The arena for odd-numbered frames
+	Arena* active; ///< The arena for the current frame
+	size_t frame; ///< The current frame's number
+};
@@ -1,5 +1,270 @@
 #include "CRC32Generator.hpp"
 
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#include <sys/uio.h>
+
+#include "WorkStealingExecutor.hpp"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define MKB_CRC_FOLDING
+#include <immintrin.h>
+#endif
+
+// The 64-bit form of the crc32 instruction only exists in 64-bit mode.
+#if defined(__GNUC__) && defined(__x86_64__)
+#define MKB_CRC_INSTRUCTION
+#endif
+
+namespace
+{
+	/// Reads a little-endian 32-bit word, wherever it is
+	inline uint32_t ReadLE32(const uint8_t* p)
+	{
+		uint32_t word;
+		memcpy(&word, p, sizeof(word));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+		word = __builtin_bswap32(word);
+#endif
+		return word;
+	}
+
+	/// The least data CRC32GenerateParallel gives a thread at once
+	const size_t minParallelChunk = 256 * 1024;
+
+	/// How many chunks CRC32GenerateParallel makes per thread, so that stealing can even out the load
+	const size_t chunksPerThread = 4;
+
+	/// The least data worth folding at all. Below this, slicing-by-16 wins.
+	const size_t foldingThreshold = 128;
+
+	/// The least data the 512-bit kernel can start with, which is already enough to win
+	const size_t wideFoldingThreshold = 256;
+
+#ifdef MKB_CRC_FOLDING
+	/// Folds both halves of a lane forward, per the constants in k
+	__attribute__((target("pclmul")))
+	inline __m128i Fold(__m128i x, __m128i k)
+	{
+		return _mm_xor_si128(_mm_clmulepi64_si128(x, k, 0x00), _mm_clmulepi64_si128(x, k, 0x11));
+	}
+
+	__attribute__((target("pclmul")))
+	inline __m128i Load(const uint8_t* p)
+	{
+		return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+	}
+
+	/**
+	\brief Folds the remaining whole lanes of data into x, then stores x
+	\returns The number of bytes folded
+	*/
+	__attribute__((target("pclmul")))
+	inline size_t FinishFolding(__m128i x, const uint8_t* data, size_t dataLength,
+	                            const uint64_t* foldBy1, uint8_t* out)
+	{
+		const __m128i k1 = Load(reinterpret_cast<const uint8_t*>(foldBy1));
+		const uint8_t* p = data;
+		for (; dataLength >= 16; dataLength -= 16, p += 16)
+			x = _mm_xor_si128(Fold(x, k1), Load(p));
+
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out), x);
+		return p - data;
+	}
+
+	/**
+	\brief Folds all the whole lanes of some data, four lanes at a time, with PCLMULQDQ
+	\param data The data, which must be at least 64 bytes long
+	\param dataLength The length of the data
+	\param crc The unfinalized CRC of everything before the data
+	\param foldBy1 The constants for folding one lane ahead
+	\param foldBy4 The constants for folding four lanes ahead
+	\param out Where to store the lane all the folded data ends up in
+	\returns The number of bytes folded, which is a multiple of 16
+	*/
+	__attribute__((target("pclmul")))
+	size_t FoldPCLMUL(const uint8_t* data, size_t dataLength, uint32_t crc,
+	                  const uint64_t* foldBy1, const uint64_t* foldBy4, uint8_t* out)
+	{
+		const uint8_t* p = data;
+		// The CRC so far is the same as XORing it into the next four bytes.
+		__m128i x0 = _mm_xor_si128(Load(p), _mm_cvtsi32_si128(crc));
+		__m128i x1 = Load(p + 16);
+		__m128i x2 = Load(p + 32);
+		__m128i x3 = Load(p + 48);
+		p += 64;
+		dataLength -= 64;
+
+		const __m128i k4 = Load(reinterpret_cast<const uint8_t*>(foldBy4));
+		for (; dataLength >= 64; dataLength -= 64, p += 64)
+		{
+			x0 = _mm_xor_si128(Fold(x0, k4), Load(p));
+			x1 = _mm_xor_si128(Fold(x1, k4), Load(p + 16));
+			x2 = _mm_xor_si128(Fold(x2, k4), Load(p + 32));
+			x3 = _mm_xor_si128(Fold(x3, k4), Load(p + 48));
+		}
+
+		const __m128i k1 = Load(reinterpret_cast<const uint8_t*>(foldBy1));
+		x1 = _mm_xor_si128(Fold(x0, k1), x1);
+		x2 = _mm_xor_si128(Fold(x1, k1), x2);
+		x3 = _mm_xor_si128(Fold(x2, k1), x3);
+
+		return (p - data) + FinishFolding(x3, p, dataLength, foldBy1, out);
+	}
+
+	// The zero-masking forms of broadcasts and extracts below do the same as the plain ones
+	// with every lane kept, but don't trip GCC's -Wuninitialized over _mm512_undefined_epi32().
+
+	/// Loads folding constants into every lane
+	__attribute__((target("avx512f,pclmul")))
+	inline __m512i Broadcast(const uint64_t* constants)
+	{
+		return _mm512_maskz_broadcast_i32x4(0xFFFF, Load(reinterpret_cast<const uint8_t*>(constants)));
+	}
+
+	/// Folds all four lanes of z forward, then XORs in y
+	__attribute__((target("avx512f,vpclmulqdq")))
+	inline __m512i Fold512(__m512i z, __m512i k, __m512i y)
+	{
+		// 0x96 is a three-way XOR.
+		return _mm512_ternarylogic_epi64(_mm512_clmulepi64_epi128(z, k, 0x00),
+		                                 _mm512_clmulepi64_epi128(z, k, 0x11), y, 0x96);
+	}
+
+	/**
+	\brief Like FoldPCLMUL, but folds sixteen lanes at a time with VPCLMULQDQ
+	\param data The data, which must be at least 256 bytes long
+	*/
+	__attribute__((target("avx512f,vpclmulqdq,pclmul")))
+	size_t FoldVPCLMUL(const uint8_t* data, size_t dataLength, uint32_t crc,
+	                   const uint64_t* foldBy1, const uint64_t* foldBy4, const uint64_t* foldBy16,
+	                   uint8_t* out)
+	{
+		const uint8_t* p = data;
+		__m512i z0 = _mm512_xor_si512(_mm512_loadu_si512(p),
+		                              _mm512_maskz_mov_epi32(1, _mm512_set1_epi32(crc)));
+		__m512i z1 = _mm512_loadu_si512(p + 64);
+		__m512i z2 = _mm512_loadu_si512(p + 128);
+		__m512i z3 = _mm512_loadu_si512(p + 192);
+		p += 256;
+		dataLength -= 256;
+
+		const __m512i k16 = Broadcast(foldBy16);
+		for (; dataLength >= 256; dataLength -= 256, p += 256)
+		{
+			z0 = Fold512(z0, k16, _mm512_loadu_si512(p));
+			z1 = Fold512(z1, k16, _mm512_loadu_si512(p + 64));
+			z2 = Fold512(z2, k16, _mm512_loadu_si512(p + 128));
+			z3 = Fold512(z3, k16, _mm512_loadu_si512(p + 192));
+		}
+
+		const __m512i k4 = Broadcast(foldBy4);
+		z1 = Fold512(z0, k4, z1);
+		z2 = Fold512(z1, k4, z2);
+		z3 = Fold512(z2, k4, z3);
+		for (; dataLength >= 64; dataLength -= 64, p += 64)
+			z3 = Fold512(z3, k4, _mm512_loadu_si512(p));
+
+		// Fold the four lanes of what's left into the last one.
+		const __m128i k1 = Load(reinterpret_cast<const uint8_t*>(foldBy1));
+		__m128i x = _mm512_maskz_extracti32x4_epi32(0xF, z3, 0);
+		x = _mm_xor_si128(Fold(x, k1), _mm512_maskz_extracti32x4_epi32(0xF, z3, 1));
+		x = _mm_xor_si128(Fold(x, k1), _mm512_maskz_extracti32x4_epi32(0xF, z3, 2));
+		x = _mm_xor_si128(Fold(x, k1), _mm512_maskz_extracti32x4_epi32(0xF, z3, 3));
+
+		return (p - data) + FinishFolding(x, p, dataLength, foldBy1, out);
+	}
+#endif
+
+#ifdef MKB_CRC_INSTRUCTION
+	/**
+	\brief The length of each of the three streams the crc32 instruction checksums side by side
+
+	Long streams make the cost of stitching them back together negligible,
+	and short ones pick up most of what is left over.
+	*/
+	const size_t longStream = 8192;
+	const size_t shortStream = 256;
+
+	/// Reads a little-endian 64-bit word, wherever it is
+	inline uint64_t ReadLE64(const uint8_t* p)
+	{
+		uint64_t word;
+		memcpy(&word, p, sizeof(word));
+		return word;
+	}
+
+	/// Shifts a CRC through the zero bytes the tables were built for
+	inline uint32_t Shift(uint32_t crc, const uint32_t (*shift)[256])
+	{
+		return shift[0][crc & 0xFF]
+		       ^ shift[1][(crc >> 8) & 0xFF]
+		       ^ shift[2][(crc >> 16) & 0xFF]
+		       ^ shift[3][crc >> 24];
+	}
+
+	/**
+	\brief Checksums runs of three streams of some length, side by side, with the crc32 instruction
+	\param crc The unfinalized CRC of everything before the data
+	\param data The data, which is advanced past the runs checksummed
+	\param dataLength The length of the data, which is reduced by the length of the runs
+	\param stream The length of each stream
+	\param shift Tables for shifting a CRC through one stream's worth of zeros
+	\returns The unfinalized CRC of everything up to the end of the last run
+	*/
+	__attribute__((target("sse4.2")))
+	inline uint32_t ThreeStreams(uint32_t crc, const uint8_t*& data, size_t& dataLength,
+	                             size_t stream, const uint32_t (*shift)[256])
+	{
+		for (; dataLength >= 3 * stream; dataLength -= 3 * stream)
+		{
+			uint64_t one = crc;
+			uint64_t two = 0;
+			uint64_t three = 0;
+			for (const uint8_t* end = data + stream; data < end; data += 8)
+			{
+				one = _mm_crc32_u64(one, ReadLE64(data));
+				two = _mm_crc32_u64(two, ReadLE64(data + stream));
+				three = _mm_crc32_u64(three, ReadLE64(data + 2 * stream));
+			}
+			// The loop only walked the first stream.
+			data += 2 * stream;
+
+			// The later streams started from nothing, so the CRC of the whole run
+			// is each stream's pushed through the ones after it.
+			crc = Shift(Shift(uint32_t(one), shift) ^ uint32_t(two), shift) ^ uint32_t(three);
+		}
+
+		return crc;
+	}
+
+	/// Runs the crc32 instruction over some data, starting from (and returning) an unfinalized CRC
+	__attribute__((target("sse4.2")))
+	uint32_t UpdateCRC32C(uint32_t crc, const uint8_t* data, size_t dataLength,
+	                      const uint32_t (*shiftLong)[256], const uint32_t (*shiftShort)[256])
+	{
+		// Line up on eight bytes so that no read straddles a cache line.
+		for (; dataLength && (reinterpret_cast<uintptr_t>(data) & 7); --dataLength, ++data)
+			crc = _mm_crc32_u8(crc, *data);
+
+		crc = ThreeStreams(crc, data, dataLength, longStream, shiftLong);
+		crc = ThreeStreams(crc, data, dataLength, shortStream, shiftShort);
+
+		uint64_t crc64 = crc;
+		for (; dataLength >= 8; dataLength -= 8, data += 8)
+			crc64 = _mm_crc32_u64(crc64, ReadLE64(data));
+
+		crc = uint32_t(crc64);
+		for (; dataLength; --dataLength, ++data)
+			crc = _mm_crc32_u8(crc, *data);
+
+		return crc;
+	}
+#endif
+}
+
 uint32_t CRC32Generator::Reflect(uint32_t ref, char ch)
 {
 	uint32_t value = 0;
@@ -8,7 +273,7 @@ uint32_t CRC32Generator::Reflect(uint32_t ref, char ch)
 	for (int pos = 1; pos < ch + 1; ++pos)
 	{
 		if (ref & 1)
-			value |= 1 << (ch - pos);
+			value |= 1u << (ch - pos);
 
 		ref >>= 1;
 	}
@@ -16,27 +281,312 @@ uint32_t CRC32Generator::Reflect(uint32_t ref, char ch)
 	return value;
 }
 
-CRC32Generator::CRC32Generator(uint32_t polynomial)
+CRC32Generator::Folding CRC32Generator::DetectFolding()
+{
+#ifdef MKB_CRC_FOLDING
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("vpclmulqdq"))
+		return FoldingVPCLMUL;
+	if (__builtin_cpu_supports("pclmul"))
+		return FoldingPCLMUL;
+#endif
+	return NoFolding;
+}
+
+bool CRC32Generator::DetectInstruction(uint32_t polynomial)
+{
+#ifdef MKB_CRC_INSTRUCTION
+	__builtin_cpu_init();
+	return polynomial == CastagnoliPolynomial && __builtin_cpu_supports("sse4.2");
+#else
+	(void)polynomial;
+	return false;
+#endif
+}
+
+uint32_t CRC32Generator::MultiplyMod(uint32_t a, uint32_t b) const
+{
+	// Reflected, the top bit is x^0, so walk a from its lowest power up,
+	// multiplying b by another x each step.
+	uint32_t product = 0;
+	for (uint32_t m = 1u << 31; m; m >>= 1)
+	{
+		if (a & m)
+			product ^= b;
+
+		b = (b & 1) ? (b >> 1) ^ reflectedPolynomial : b >> 1;
+	}
+
+	return product;
+}
+
+uint32_t CRC32Generator::XPowMod(uint64_t n) const
+{
+	uint32_t value = 1u << 31; // x^0
+	for (int k = 0; n; n >>= 1, ++k)
+	{
+		if (n & 1)
+			value = MultiplyMod(xPow2k[k], value);
+	}
+
+	return value;
+}
+
+void CRC32Generator::BuildShiftTables(size_t bytes, uint32_t (&shift)[4][256])
+{
+	const uint32_t factor = XPowMod(8 * uint64_t(bytes));
+	for (int k = 0; k < 4; ++k)
+	{
+		for (uint32_t b = 0; b <= 0xFF; ++b)
+			shift[k][b] = MultiplyMod(b << (8 * k), factor);
+	}
+}
+
+void CRC32Generator::FoldingConstants(unsigned distance, uint64_t (&constants)[2])
+{
+	constants[0] = uint64_t(XPowMod(distance + 63)) << 32;
+	constants[1] = uint64_t(XPowMod(distance - 1)) << 32;
+}
+
+CRC32Generator::CRC32Generator(uint32_t polynomial) :
+	reflectedPolynomial(Reflect(polynomial, 32)),
+	folding(DetectFolding()),
+	instruction(DetectInstruction(polynomial))
 {
 	// 256 values representing ASCII character codes.
 	for (int c = 0; c <= 0xFF; ++c)
 	{
-		table[c] = Reflect(c, 8) << 24;
+		table[0][c] = Reflect(c, 8) << 24;
 		for (int p = 0; p < 8; ++p)
 		{
-			table[c] = (table[c] << 1)
-			           ^ ((table[c] & (1 << 31)) ? polynomial : 0);
+			table[0][c] = (table[0][c] << 1)
+			              ^ ((table[0][c] & (1u << 31)) ? polynomial : 0);
 		}
-		table[c] = Reflect(table[c], 32);
+		table[0][c] = Reflect(table[0][c], 32);
+	}
+
+	// Each further table pushes the one before it through another zero byte.
+	for (int k = 1; k < sliceCount; ++k)
+	{
+		for (int c = 0; c <= 0xFF; ++c)
+			table[k][c] = (table[k - 1][c] >> 8) ^ table[0][table[k - 1][c] & 0xFF];
 	}
+
+	xPow2k[0] = 1u << 30; // x^1
+	for (int k = 1; k < 64; ++k)
+		xPow2k[k] = MultiplyMod(xPow2k[k - 1], xPow2k[k - 1]);
+
+	FoldingConstants(128, foldBy1);
+	FoldingConstants(4 * 128, foldBy4);
+	FoldingConstants(16 * 128, foldBy16);
+
+#ifdef MKB_CRC_INSTRUCTION
+	if (instruction)
+	{
+		BuildShiftTables(longStream, shiftLongStreams);
+		BuildShiftTables(shortStream, shiftShortStreams);
+	}
+#endif
 }
 
-uint32_t CRC32Generator::CRC32Generate(void* data, size_t dataLength)
+uint32_t CRC32Generator::UpdateBytewise(uint32_t crc, const uint8_t* data, size_t dataLength) const
 {
-	uint32_t crc = ~0;
+	for (; dataLength; --dataLength, ++data)
+		crc = table[0][(crc & 0xFF) ^ *data] ^ (crc >> 8);
+
+	return crc;
+}
 
-	for (uint8_t* cData = (uint8_t*)data; dataLength; --dataLength, ++cData)
-		crc = table[(crc & 0xFF) ^ *cData] ^ (crc >> 8);
+uint32_t CRC32Generator::UpdateSlicingBy8(uint32_t crc, const uint8_t* data, size_t dataLength) const
+{
+	for (; dataLength >= 8; dataLength -= 8, data += 8)
+	{
+		const uint32_t one = ReadLE32(data) ^ crc;
+		const uint32_t two = ReadLE32(data + 4);
+		crc = table[7][one & 0xFF]
+		      ^ table[6][(one >> 8) & 0xFF]
+		      ^ table[5][(one >> 16) & 0xFF]
+		      ^ table[4][one >> 24]
+		      ^ table[3][two & 0xFF]
+		      ^ table[2][(two >> 8) & 0xFF]
+		      ^ table[1][(two >> 16) & 0xFF]
+		      ^ table[0][two >> 24];
+	}
+
+	return UpdateBytewise(crc, data, dataLength);
+}
+
+uint32_t CRC32Generator::UpdateSlicingBy16(uint32_t crc, const uint8_t* data, size_t dataLength) const
+{
+	for (; dataLength >= 16; dataLength -= 16, data += 16)
+	{
+		const uint32_t one = ReadLE32(data) ^ crc;
+		const uint32_t two = ReadLE32(data + 4);
+		const uint32_t three = ReadLE32(data + 8);
+		const uint32_t four = ReadLE32(data + 12);
+		crc = table[15][one & 0xFF]
+		      ^ table[14][(one >> 8) & 0xFF]
+		      ^ table[13][(one >> 16) & 0xFF]
+		      ^ table[12][one >> 24]
+		      ^ table[11][two & 0xFF]
+		      ^ table[10][(two >> 8) & 0xFF]
+		      ^ table[9][(two >> 16) & 0xFF]
+		      ^ table[8][two >> 24]
+		      ^ table[7][three & 0xFF]
+		      ^ table[6][(three >> 8) & 0xFF]
+		      ^ table[5][(three >> 16) & 0xFF]
+		      ^ table[4][three >> 24]
+		      ^ table[3][four & 0xFF]
+		      ^ table[2][(four >> 8) & 0xFF]
+		      ^ table[1][(four >> 16) & 0xFF]
+		      ^ table[0][four >> 24];
+	}
+
+	return UpdateBytewise(crc, data, dataLength);
+}
+
+uint32_t CRC32Generator::UpdateFolding(uint32_t crc, const uint8_t* data, size_t dataLength) const
+{
+#ifdef MKB_CRC_FOLDING
+	if (folding != NoFolding && dataLength >= foldingThreshold)
+	{
+		uint8_t lane[16];
+		size_t folded;
+		if (folding == FoldingVPCLMUL && dataLength >= wideFoldingThreshold)
+			folded = FoldVPCLMUL(data, dataLength, crc, foldBy1, foldBy4, foldBy16, lane);
+		else
+			folded = FoldPCLMUL(data, dataLength, crc, foldBy1, foldBy4, lane);
+
+		// The last lane is congruent to everything up to its end,
+		// so its CRC (from nothing) is the CRC of all that.
+		crc = UpdateSlicingBy16(0, lane, sizeof(lane));
+		data += folded;
+		dataLength -= folded;
+	}
+#endif
+	return UpdateSlicingBy16(crc, data, dataLength);
+}
+
+uint32_t CRC32Generator::UpdateInstruction(uint32_t crc, const uint8_t* data, size_t dataLength) const
+{
+#ifdef MKB_CRC_INSTRUCTION
+	if (instruction)
+		return UpdateCRC32C(crc, data, dataLength, shiftLongStreams, shiftShortStreams);
+#endif
+	return UpdateFolding(crc, data, dataLength);
+}
+
+uint32_t CRC32Generator::Update(uint32_t crc, const uint8_t* data, size_t dataLength) const
+{
+	// The crc32 instruction beats 128-bit folding, but 512-bit folding beats it
+	// as soon as there is enough data to start.
+	if (instruction && (folding != FoldingVPCLMUL || dataLength < wideFoldingThreshold))
+		return UpdateInstruction(crc, data, dataLength);
+
+	return UpdateFolding(crc, data, dataLength);
+}
+
+uint32_t CRC32Generator::CRC32Generate(const void* data, size_t dataLength) const
+{
+	return ~Update(~0u, static_cast<const uint8_t*>(data), dataLength);
+}
 
-	return ~crc;
+CRC32Generator::State CRC32Generator::CRC32Begin() const
+{
+	State state;
+	state.crc = ~0u;
+	return state;
+}
+
+CRC32Generator::State CRC32Generator::CRC32Update(State state, const void* data, size_t dataLength) const
+{
+	state.crc = Update(state.crc, static_cast<const uint8_t*>(data), dataLength);
+	return state;
+}
+
+CRC32Generator::State CRC32Generator::CRC32UpdateSpans(State state, const Span* spans, size_t spanCount) const
+{
+	for (size_t i = 0; i < spanCount; ++i)
+		state = CRC32Update(state, spans[i].data, spans[i].length);
+
+	return state;
+}
+
+CRC32Generator::State CRC32Generator::CRC32UpdateSpans(State state, const iovec* spans, size_t spanCount) const
+{
+	for (size_t i = 0; i < spanCount; ++i)
+		state = CRC32Update(state, spans[i].iov_base, spans[i].iov_len);
+
+	return state;
+}
+
+uint32_t CRC32Generator::CRC32Finalize(State state) const
+{
+	return ~state.crc;
+}
+
+uint32_t CRC32Generator::CRC32Combine(uint32_t crcA, uint32_t crcB, uint64_t lengthB) const
+{
+	// The inversions on A's way in and out cancel against those of B (see CRC32Generate),
+	// so the finished checksums combine just like raw CRCs do.
+	return MultiplyMod(XPowMod(8 * lengthB), crcA) ^ crcB;
+}
+
+uint32_t CRC32Generator::CRC32GenerateParallel(const void* data, size_t dataLength,
+                                               WorkStealingExecutor& executor) const
+{
+	const size_t chunks = std::min(executor.threadCount() * chunksPerThread,
+	                               dataLength / minParallelChunk);
+	if (chunks <= 1)
+		return CRC32Generate(data, dataLength);
+
+	// Every chunk is the same length, save the last, which also gets whatever doesn't divide evenly.
+	const uint8_t* bytes = static_cast<const uint8_t*>(data);
+	const size_t chunkLength = dataLength / chunks;
+	const size_t lastLength = dataLength - (chunks - 1) * chunkLength;
+
+	std::vector<uint32_t> crcs(chunks);
+	executor.forEachChunk(chunks, [&](size_t i) {
+		crcs[i] = CRC32Generate(bytes + i * chunkLength, i + 1 == chunks ? lastLength : chunkLength);
+	});
+
+	uint32_t crc = crcs[0];
+	for (size_t i = 1; i < chunks; ++i)
+		crc = CRC32Combine(crc, crcs[i], i + 1 == chunks ? lastLength : chunkLength);
+
+	return crc;
+}
+
+uint32_t CRC32Generator::CRC32GenerateParallel(const void* data, size_t dataLength, size_t threads) const
+{
+	if (dataLength < 2 * minParallelChunk)
+		return CRC32Generate(data, dataLength);
+
+	WorkStealingExecutor executor(threads);
+	return CRC32GenerateParallel(data, dataLength, executor);
+}
+
+uint32_t CRC32Generator::CRC32GenerateBytewise(const void* data, size_t dataLength) const
+{
+	return ~UpdateBytewise(~0u, static_cast<const uint8_t*>(data), dataLength);
+}
+
+uint32_t CRC32Generator::CRC32GenerateSlicingBy8(const void* data, size_t dataLength) const
+{
+	return ~UpdateSlicingBy8(~0u, static_cast<const uint8_t*>(data), dataLength);
+}
+
+uint32_t CRC32Generator::CRC32GenerateSlicingBy16(const void* data, size_t dataLength) const
+{
+	return ~UpdateSlicingBy16(~0u, static_cast<const uint8_t*>(data), dataLength);
+}
+
+uint32_t CRC32Generator::CRC32GenerateFolding(const void* data, size_t dataLength) const
+{
+	return ~UpdateFolding(~0u, static_cast<const uint8_t*>(data), dataLength);
+}
+
+uint32_t CRC32Generator::CRC32GenerateInstruction(const void* data, size_t dataLength) const
+{
+	return ~UpdateInstruction(~0u, static_cast<const uint8_t*>(data), dataLength);
 }
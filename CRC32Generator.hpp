@@ -4,30 +4,258 @@
 #include <cstddef> // For size_t
 #include <stdint.h> // For uint32_t
 
+struct iovec;
+class WorkStealingExecutor;
+
 class CRC32Generator
 {
 public:
 	/// Polynomial used by IEEE for 32-bit CRC
 	static const uint32_t IEEEPolynomial = 0x04C11DB7;
 
-	/// Initializes the CRC generator and builds the needed lookup table
+	/**
+	\brief Polynomial of CRC-32C (Castagnoli), used by iSCSI, SCTP, ext4, and others
+
+	Generators made with it use the SSE4.2 crc32 instruction
+	if the CPU has one (see CRC32GenerateInstruction).
+	*/
+	static const uint32_t CastagnoliPolynomial = 0x1EDC6F41;
+
+	/**
+	\brief Initializes the CRC generator and builds the needed lookup tables
+	\param polynomial The CRC polynomial, in normal (MSB-first) form.
+			Data is processed least significant bit first (i.e. reflected),
+			as IEEE CRC-32 does, for any polynomial.
+	*/
 	explicit CRC32Generator(uint32_t polynomial = IEEEPolynomial);
 
+	/**
+	\brief The CRC of the data seen so far, for checksumming data that arrives in pieces
+
+	Start one with CRC32Begin, feed it each piece in order with CRC32Update,
+	and get the checksum of the whole with CRC32Finalize.
+	A state is plain data, so it can be stored and resumed later,
+	but only by a generator with the same polynomial.
+	*/
+	struct State
+	{
+		uint32_t crc; ///< The CRC so far, before the final inversion
+	};
+
+	/// A piece of data for CRC32UpdateSpans, laid out like iovec
+	struct Span
+	{
+		const void* data;
+		size_t length;
+	};
+
+	/// Returns the state for checksumming data that hasn't been seen yet
+	State CRC32Begin() const;
+
+	/**
+	\brief Adds the next piece of data to a checksum
+	\param state The state of the checksum, from CRC32Begin or an earlier CRC32Update
+	\param data The next piece of data
+	\param dataLength The length of the piece, in bytes
+	\returns The state with the piece added
+
+	Checksumming data in pieces gives the same result as checksumming it all at once,
+	with the same (fastest) kernels as CRC32Generate.
+	*/
+	State CRC32Update(State state, const void* data, size_t dataLength) const;
+
+	/**
+	\brief Adds each of some spans to a checksum in turn, as if they were contiguous
+
+	This has its own name, rather than overloading CRC32Update,
+	so that a list of spans can never be mistaken for the bytes to checksum.
+	*/
+	State CRC32UpdateSpans(State state, const Span* spans, size_t spanCount) const;
+
+	/// Adds each of some iovecs (say, from readv) to a checksum in turn, as if they were contiguous
+	State CRC32UpdateSpans(State state, const iovec* spans, size_t spanCount) const;
+
+	/// Returns the checksum of all the data added to a state
+	uint32_t CRC32Finalize(State state) const;
+
+	/**
+	\brief Combines the checksums of two pieces of data into the checksum of both
+	\param crcA The checksum of the first piece
+	\param crcB The checksum of the second piece
+	\param lengthB The length of the second piece, in bytes
+	\returns The checksum of the first piece followed by the second
+
+	Appending B to A shifts A's CRC through lengthB bytes, i.e. multiplies it by
+	x^(8 * lengthB) mod P, and then adds B's. Complexity is O(log lengthB)
+	*/
+	uint32_t CRC32Combine(uint32_t crcA, uint32_t crcB, uint64_t lengthB) const;
+
+	/**
+	\brief Generates a checksum on several threads at once
+	\param data A pointer to the data from which a checksum should be generated
+	\param dataLength The length of the data, in bytes
+	\param executor The threads to split the data between
+
+	The data is split into a few chunks per thread, each of which is checksummed
+	with CRC32Generate, and the chunks' checksums are then put together with CRC32Combine.
+	Data too short to be worth splitting is just passed to CRC32Generate.
+	*/
+	uint32_t CRC32GenerateParallel(const void* data, size_t dataLength,
+	                               WorkStealingExecutor& executor) const;
+
+	/**
+	\brief Generates a checksum on a given number of threads (zero meaning one per core)
+
+	This starts (and stops) its own threads, so prefer the overload that takes an executor
+	for checksumming many things.
+	*/
+	uint32_t CRC32GenerateParallel(const void* data, size_t dataLength, size_t threads) const;
+
 	/**
 	\brief Generates a 32-bit CRC checksum for a given amount of data
 	\param data A pointer to the data from which a checksum should be generated
 	\param dataLength The length of the data from which a checksum should be
 			generated, in bytes
 	\returns The 32-bit CRC checksum of the given data
+
+	This uses whichever of the kernels below is fastest on this CPU
+	for this polynomial and length of data.
+	*/
+	uint32_t CRC32Generate(const void* data, size_t dataLength) const;
+
+	/// Generates a checksum one byte at a time, with a single table
+	uint32_t CRC32GenerateBytewise(const void* data, size_t dataLength) const;
+
+	/**
+	\brief Generates a checksum eight bytes at a time (slicing-by-8)
+
+	Each byte of an eight-byte word is looked up in its own table,
+	and the lookups are independent of each other, so they can all be in flight at once
+	instead of each waiting on the last like the bytewise loop.
 	*/
-	uint32_t CRC32Generate(void* data, size_t dataLength);
+	uint32_t CRC32GenerateSlicingBy8(const void* data, size_t dataLength) const;
+
+	/// Generates a checksum sixteen bytes at a time (slicing-by-16, see CRC32GenerateSlicingBy8)
+	uint32_t CRC32GenerateSlicingBy16(const void* data, size_t dataLength) const;
+
+	/**
+	\brief Generates a checksum by folding the data with carry-less multiplies
+
+	The data is read in 128-bit lanes, and each lane is folded forward
+	onto one further along by multiplying it by x^distance mod P,
+	which keeps the lanes congruent (mod P) to all the data behind them.
+	Whatever is left in the last lane, and any bytes after it, are finished with the tables.
+
+	PCLMULQDQ folds four lanes at once, and VPCLMULQDQ (with AVX-512) sixteen.
+	The CPU is checked for them at construction, and if it has neither,
+	or there is too little data to fold, this falls back to CRC32GenerateSlicingBy16.
+	*/
+	uint32_t CRC32GenerateFolding(const void* data, size_t dataLength) const;
+
+	/**
+	\brief Generates a checksum with the SSE4.2 crc32 instruction
+
+	The instruction only computes CRC-32C, so for generators made with any polynomial
+	but CastagnoliPolynomial, or on CPUs without it, this falls back to CRC32GenerateFolding.
+
+	Each crc32 takes three cycles, but a new one can start every cycle,
+	so long data is split into three streams that are checksummed side by side.
+	Their CRCs are then stitched back together by shifting each one
+	through the length of the streams after it.
+	*/
+	uint32_t CRC32GenerateInstruction(const void* data, size_t dataLength) const;
 
 private:
 	/// Used by CRC32Init to flip the bits of an integer.
 	uint32_t Reflect(uint32_t ref, char ch);
 
-	/// Lookup table for the crc32 algorithm
-	uint32_t table[256];
+	/// Runs the bytewise loop over some data, starting from (and returning) an unfinalized CRC
+	uint32_t UpdateBytewise(uint32_t crc, const uint8_t* data, size_t dataLength) const;
+
+	/// Like UpdateBytewise, but with the slicing-by-8 loop
+	uint32_t UpdateSlicingBy8(uint32_t crc, const uint8_t* data, size_t dataLength) const;
+
+	/// Like UpdateBytewise, but with the slicing-by-16 loop
+	uint32_t UpdateSlicingBy16(uint32_t crc, const uint8_t* data, size_t dataLength) const;
+
+	/// Like UpdateBytewise, but folds with carry-less multiplies where it can
+	uint32_t UpdateFolding(uint32_t crc, const uint8_t* data, size_t dataLength) const;
+
+	/// Like UpdateBytewise, but uses the crc32 instruction where it can
+	uint32_t UpdateInstruction(uint32_t crc, const uint8_t* data, size_t dataLength) const;
+
+	/// Like UpdateBytewise, but with whichever of the kernels is fastest for the data
+	uint32_t Update(uint32_t crc, const uint8_t* data, size_t dataLength) const;
+
+	/// The widest carry-less multiply this CPU has
+	enum Folding
+	{
+		NoFolding,
+		FoldingPCLMUL, ///< PCLMULQDQ, 128 bits at a time
+		FoldingVPCLMUL ///< VPCLMULQDQ with AVX-512, 512 bits at a time
+	};
+
+	/// Asks the CPU what it supports
+	static Folding DetectFolding();
+
+	/// Returns true if the CPU has the crc32 instruction and the polynomial is the one it computes
+	static bool DetectInstruction(uint32_t polynomial);
+
+	/// Multiplies two polynomials mod the polynomial, all reflected
+	uint32_t MultiplyMod(uint32_t a, uint32_t b) const;
+
+	/// Returns x^n mod the polynomial, reflected. Complexity is O(log n)
+	uint32_t XPowMod(uint64_t n) const;
+
+	/**
+	\brief Builds tables that shift a CRC through some number of zero bytes
+
+	Appending zeros multiplies the CRC by x^(8 * bytes) mod P, which is linear,
+	so it can be done one byte of the CRC at a time: shift[k][b] is (b << 8k) shifted.
+	*/
+	void BuildShiftTables(size_t bytes, uint32_t (&shift)[4][256]);
+
+	/**
+	\brief Returns the constants for folding a 128-bit lane forward by some number of bits
+
+	Folding multiplies the high and low halves of the lane by x^(distance + 63) mod P
+	and x^(distance - 1) mod P, reflected into the top of a 64-bit word.
+	(The extra -1 makes up for the product of two reflected values coming out a bit short.)
+	*/
+	void FoldingConstants(unsigned distance, uint64_t (&constants)[2]);
+
+	/// The polynomial, reflected, without its x^32 term
+	const uint32_t reflectedPolynomial;
+
+	/// What CRC32GenerateFolding can use
+	const Folding folding;
+
+	/// True if CRC32GenerateInstruction can use the crc32 instruction
+	const bool instruction;
+
+	/// x^(2^k) mod P, reflected, for XPowMod to multiply together
+	uint32_t xPow2k[64];
+
+	/// Constants for folding 1, 4, and 16 lanes (of 128 bits each) ahead
+	uint64_t foldBy1[2];
+	uint64_t foldBy4[2];
+	uint64_t foldBy16[2];
+
+	/// Tables for shifting the CRC of one of the crc32 instruction's streams past the others
+	uint32_t shiftLongStreams[4][256];
+	uint32_t shiftShortStreams[4][256];
+
+	/// The number of bytes the widest kernel consumes per step, and so its number of tables
+	static const int sliceCount = 16;
+
+	/**
+	\brief Lookup tables for the crc32 algorithm
+
+	table[0] is the classic table, the CRC of each byte value.
+	table[k][b] is the CRC of byte b followed by k zero bytes,
+	which is what the slicing kernels need for the byte k places ahead of the end of a step.
+	*/
+	uint32_t table[sliceCount][256];
 };
 
 #endif
@@ -0,0 +1,389 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <exception>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "Pool.hpp"
+
+// Forward declaration (this comes after the pool itself)
+template <typename T>
+class ChunkedPoolIterator;
+
+/**
+ * \brief A pool that grows by adding fixed-size chunks instead of running out of room
+ * \tparam The type of the contents of the pool
+ *
+ * A Pool makes a single allocation up front, so it has to be sized for the
+ * worst case it will ever see. A ChunkedPool is a collection of Pools (chunks)
+ * of the same size. When every chunk is full, a new one is added,
+ * so construct only fails if the system itself is out of memory.
+ *
+ * Since chunks are never moved, objects keep their addresses for their whole lifetime,
+ * and each chunk keeps its objects contiguous for good spatial locality.
+ * Chunks that become empty are kept around for reuse,
+ * up to a configurable limit, past which they are freed.
+ *
+ * Iteration visits each chunk in order of address, and each chunk's objects
+ * in order of address, so iteration order is stable as long as the pool is not modified.
+ */
+template <typename T>
+class ChunkedPool {
+
+public:
+
+	typedef T value_type;
+
+	typedef ChunkedPoolIterator<T> iterator;
+
+	typedef ChunkedPoolIterator<const T> const_iterator;
+
+	friend class ChunkedPoolIterator<T>;
+	friend class ChunkedPoolIterator<const T>;
+
+	/// Used as _maxIdleChunks_ to never free empty chunks
+	static const size_t keepAllChunks = std::numeric_limits<size_t>::max();
+
+	/**
+	 * \brief Constructs an (empty) chunked pool
+	 * \param chunkSize The number of objects each chunk can hold
+	 * \param maxIdleChunks The number of empty chunks to hang on to for reuse.
+	 *                      Once more chunks than this are empty, the extras are freed.
+	 *
+	 * No chunks are allocated until the first object is constructed.
+	 */
+	explicit ChunkedPool(size_t chunkSize, size_t maxIdleChunks = keepAllChunks) :
+		chunks(),
+		available(),
+		chunkSize(chunkSize),
+		maxIdleChunks(maxIdleChunks),
+		idleChunks(0),
+		numAllocated(0)
+	{
+		if (chunkSize == 0)
+			throw std::invalid_argument("Chunks must be able to hold at least one object");
+	}
+
+	/**
+	 * \brief Destructor
+	 * \pre All objects in the pool have been destroyed
+	 * \warning If all objects have not been destroyed by the time this is called,
+	 *          std::terminate is called (see Pool::~Pool)
+	 */
+	~ChunkedPool()
+	{
+		if (numAllocated != 0) {
+			fprintf(stderr, "A chunked pool was destroyed before its elements were freed.\n");
+			std::terminate();
+		}
+
+		for (Chunk* c : chunks)
+			delete c;
+	}
+
+	/**
+	 * \brief Allocates, constructs, and returns a single object from the pool
+	 * \param args Arguments forwarded to a constructor of T
+	 * \returns a pointer to a T, allocated from the pool then constructed.
+	 * \throws std::bad_alloc only if a new chunk was needed and could not be allocated
+	 *
+	 * Complexity is O(1), or O(number of chunks) if a new chunk is added.
+	 */
+	template <typename... Args>
+	T* construct(Args&&... args)
+	{
+		Chunk* c = chunkWithRoom();
+
+		T* ret = c->pool.construct(std::forward<Args>(args)...);
+
+		if (c->pool.size() == 1)
+			--idleChunks;
+
+		if (c->pool.full()) {
+			available.pop_back();
+			c->available = false;
+		}
+
+		++numAllocated;
+		return ret;
+	}
+
+	/**
+	 * \brief Destroys then deallocates an object constructed from the pool
+	 * \throws std::invalid_argument if the object did not come from this pool
+	 *
+	 * Complexity is O(log(number of chunks)), or O(number of chunks) if a chunk is freed.
+	 */
+	void destroy(T* toRelease)
+	{
+		Chunk* c = findOwner(toRelease);
+		if (c == nullptr)
+			throw std::invalid_argument("The provided pointer is not valid");
+
+		c->pool.destroy(toRelease);
+		--numAllocated;
+
+		if (!c->available) {
+			available.push_back(c);
+			c->available = true;
+		}
+
+		if (c->pool.empty() && ++idleChunks > maxIdleChunks)
+			release(c);
+	}
+
+	/// Returns true if the object came from this pool
+	bool owns(const T* p) const { return findOwner(p) != nullptr; }
+
+	/// Returns the number of currently allocated objects. Complexity is O(1)
+	size_t size() const { return numAllocated; }
+
+	/// Returns true if no objects are allocated. Complexity is O(1)
+	bool empty() const { return numAllocated == 0; }
+
+	/// Returns the number of objects the pool can hold before it must grow. Complexity is O(1)
+	size_t capacity() const { return chunks.size() * chunkSize; }
+
+	/// Returns the number of chunks currently allocated. Complexity is O(1)
+	size_t chunkCount() const { return chunks.size(); }
+
+	/// Returns the number of objects held by each chunk
+	size_t chunk_size() const { return chunkSize; }
+
+	/**
+	 * \brief Frees all empty chunks
+	 *
+	 * Complexity is O(number of chunks)
+	 */
+	void shrinkToFit()
+	{
+		for (size_t i = chunks.size(); i-- > 0;) {
+			if (chunks[i]->pool.empty())
+				release(chunks[i]);
+		}
+	}
+
+	iterator begin() { return iterator(*this); }
+
+	const_iterator begin() const { return const_iterator(*this); }
+
+	const_iterator cbegin() const { return const_iterator(*this); }
+
+	iterator end() { return iterator(*this, chunks.size()); }
+
+	const_iterator end() const { return const_iterator(*this, chunks.size()); }
+
+	const_iterator cend() const { return const_iterator(*this, chunks.size()); }
+
+	/// The copy constructor is deleted (see Pool)
+	ChunkedPool(const ChunkedPool&) = delete;
+
+	/// The assignment operator is deleted (see Pool)
+	const ChunkedPool& operator=(const ChunkedPool&) = delete;
+
+private:
+
+	/// A chunk of the pool
+	struct Chunk {
+		Pool<T> pool; ///< The chunk's objects
+		bool available; ///< True if the chunk is in the list of chunks with free slots
+
+		explicit Chunk(size_t size) : pool(size), available(true) { }
+	};
+
+	/// Returns a chunk with at least one free slot, adding a new chunk if we need to
+	Chunk* chunkWithRoom()
+	{
+		if (!available.empty())
+			return available.back();
+
+		std::unique_ptr<Chunk> fresh(new Chunk(chunkSize));
+
+		// Keep the chunks sorted by address so we can binary search them in findOwner.
+		const auto at = std::upper_bound(chunks.begin(), chunks.end(), fresh.get(), &lessByAddress);
+		chunks.insert(at, fresh.get());
+		try {
+			available.push_back(fresh.get());
+		}
+		catch (...) {
+			chunks.erase(std::find(chunks.begin(), chunks.end(), fresh.get()));
+			throw;
+		}
+
+		++idleChunks;
+		return fresh.release();
+	}
+
+	/// Frees an empty chunk
+	void release(Chunk* c)
+	{
+		assert(c->pool.empty());
+
+		chunks.erase(std::lower_bound(chunks.begin(), chunks.end(), c, &lessByAddress));
+		if (c->available)
+			available.erase(std::find(available.begin(), available.end(), c));
+
+		--idleChunks;
+		delete c;
+	}
+
+	/// Finds the chunk that a pointer belongs to, or null if there is none
+	Chunk* findOwner(const T* p) const
+	{
+		// Find the last chunk that starts at or before p.
+		const auto after = std::upper_bound(chunks.begin(), chunks.end(), p,
+			[](const T* ptr, const Chunk* c) {
+				return std::less<const void*>()(ptr, c->pool.buff);
+			});
+
+		if (after == chunks.begin())
+			return nullptr;
+
+		Chunk* c = *(after - 1);
+		return c->pool.owns(p) ? c : nullptr;
+	}
+
+	/// Orders chunks by the address of their buffers
+	static bool lessByAddress(const Chunk* a, const Chunk* b)
+	{
+		return std::less<const void*>()(a->pool.buff, b->pool.buff);
+	}
+
+	std::vector<Chunk*> chunks; ///< All of our chunks, sorted by address
+	std::vector<Chunk*> available; ///< A stack of chunks that have free slots
+	size_t chunkSize; ///< The number of slots in each chunk
+	size_t maxIdleChunks; ///< The number of empty chunks we will keep around
+	size_t idleChunks; ///< The number of chunks that are currently empty
+	size_t numAllocated; ///< The number of allocated objects across all chunks
+};
+
+/**
+ * \brief A forward iterator over the objects in a ChunkedPool
+ * \warning This iterator is invalidated if the pool is modified
+ *
+ * See PoolIterator for what all the `std::remove_const` business is about.
+ */
+#pragma GCC diagnostic push
+// Shut gcc up about std::iterator having a non-virtual destructor,
+// and (as of C++17) about it being deprecated
+#pragma GCC diagnostic ignored "-Weffc++"
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+template <typename T>
+class ChunkedPoolIterator : public std::iterator<std::forward_iterator_tag, T> {
+#pragma GCC diagnostic pop
+
+	typedef ChunkedPool<typename std::remove_const<T>::type> PoolType;
+
+public:
+	/// Iterators must be default-constructible
+	ChunkedPoolIterator() : pool(nullptr), chunk(0), inner() { }
+
+	/// Default copy constructor - just copy the members
+	ChunkedPoolIterator(const ChunkedPoolIterator&) = default;
+
+	/// Default assignment operator - just copy the members
+	ChunkedPoolIterator& operator=(const ChunkedPoolIterator&) = default;
+
+	/// Creates an iterator that starts at the first object in a pool
+	ChunkedPoolIterator(const PoolType& p) : pool(&p), chunk(0), inner()
+	{
+		settle();
+	}
+
+	/// Creates an iterator at the start of a given chunk, e.g. for the ChunkedPool::end family
+	ChunkedPoolIterator(const PoolType& p, size_t startChunk) : pool(&p), chunk(startChunk), inner()
+	{
+		settle();
+	}
+
+	T& operator*() const { return *inner; }
+
+	T* operator->() const { return &*inner; }
+
+	/// Equality. Two iterators are true if they are pointing at the same item.
+	bool operator==(const ChunkedPoolIterator& o) const
+	{
+		assert(pool == o.pool);
+		// Default-constructed iterators have no pool to look at, and are all alike.
+		if (pool == nullptr)
+			return true;
+
+		if (chunk != o.chunk)
+			return false;
+
+		return chunk == pool->chunks.size() || inner == o.inner;
+	}
+
+	/// Inequality, so that we can be used in range-based for loops
+	bool operator!=(const ChunkedPoolIterator& o) const { return !(*this == o); }
+
+	/// Pre-increment
+	ChunkedPoolIterator& operator++()
+	{
+		++inner;
+		if (inner == innerEnd()) {
+			++chunk;
+			settle();
+		}
+		return *this;
+	}
+
+	/// Post-increment
+	ChunkedPoolIterator operator++(int)
+	{
+		ChunkedPoolIterator<T> ret(*this);
+		operator++();
+		return ret;
+	}
+
+	/// Increment by a given amount
+	ChunkedPoolIterator& operator+=(size_t by)
+	{
+		for (size_t i = 0; i < by && chunk < pool->chunks.size(); ++i)
+			operator++();
+
+		return *this;
+	}
+
+	/// Increment by a given amount
+	ChunkedPoolIterator operator+(size_t by)
+	{
+		ChunkedPoolIterator<T> ret(*this);
+		ret += by;
+		return ret;
+	}
+
+private:
+
+	/// Moves to the first object at or after the start of the current chunk
+	void settle()
+	{
+		for (; chunk < pool->chunks.size(); ++chunk) {
+			const Pool<typename std::remove_const<T>::type>& p = pool->chunks[chunk]->pool;
+			if (!p.empty()) {
+				inner = PoolIterator<T>(p);
+				return;
+			}
+		}
+
+		inner = PoolIterator<T>();
+	}
+
+	PoolIterator<T> innerEnd() const
+	{
+		return PoolIterator<T>(pool->chunks[chunk]->pool, pool->chunks[chunk]->pool.max_size());
+	}
+
+	const PoolType* pool; ///< The pool we are iterating over
+	size_t chunk; ///< The index of the chunk we are in
+	PoolIterator<T> inner; ///< Our position in that chunk
+};
@@ -0,0 +1,421 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+#include "TaggedIndexStack.hpp"
+
+/**
+ * \brief A fixed-size pool that many threads can construct and destroy objects from at once
+ * \tparam The type of the contents of the pool
+ *
+ * Wrapping a Pool in a mutex works, but every construct and destroy then fights over
+ * the same lock (and the same cache lines), which stops scaling after a handful of cores.
+ * This pool instead uses the "magazine" scheme from Bonwick and Adams'
+ * _Magazines and Vmem_ (the design behind the Solaris slab allocator):
+ *
+ * - Each thread allocates through its own ConcurrentPool::Cache,
+ *   which holds two magazines (small stacks) of free slots.
+ *   Constructing and destroying objects just pops and pushes those stacks,
+ *   touching no shared state.
+ * - Only when both magazines are empty (or both are full) does a cache go to the shared _depot_,
+ *   trading a whole magazine's worth of slots at once with a lock-free stack.
+ *   Having two magazines means a thread bouncing around a magazine boundary
+ *   doesn't go to the depot on every call.
+ *
+ * Objects can be destroyed through any cache, not just the one that constructed them,
+ * so objects can be freely handed from thread to thread.
+ *
+ * Since free slots can sit in other threads' caches,
+ * construction can fail before every slot in the pool is in use.
+ * Size the pool with some slack (up to 2 * magazineSize per cache).
+ *
+ * Like Pool, slots are never initialized up front.
+ * Slots that have never been used are handed out with a bump index,
+ * so a new pool costs nothing until it is used.
+ */
+template <typename T>
+class ConcurrentPool {
+
+public:
+
+	typedef T value_type;
+
+	/// The number of slots in a magazine
+	static const size_t magazineSize = 32;
+
+	class Cache;
+
+	/**
+	 * \brief Constructs a pool of a given size
+	 * \param poolSize The maximum number of elements this pool will be able to store
+	 * \throws std::bad_alloc if enough memory for the pool cannot be allocated
+	 * \throws std::invalid_argument if poolSize is too large to index with 32 bits
+	 */
+	explicit ConcurrentPool(size_t poolSize) :
+		buff(nullptr),
+		slotLinks(nullptr),
+		magazines(nullptr),
+		numSlots(poolSize),
+		numMagazines(poolSize / magazineSize + 1),
+		highWater(0),
+		fullMagazines(),
+		emptyMagazines(),
+		looseSlots()
+	{
+		if (poolSize >= TaggedIndexStack::none)
+			throw std::invalid_argument("Concurrent pools are limited to 2^32 - 1 slots");
+
+		buff = allocateSlots(poolSize);
+		if (buff == nullptr)
+			throw std::bad_alloc();
+
+		slotLinks = static_cast<std::atomic<uint32_t>*>(calloc(poolSize, sizeof(std::atomic<uint32_t>)));
+		magazines = static_cast<Magazine*>(malloc(numMagazines * sizeof(Magazine)));
+		if (slotLinks == nullptr || magazines == nullptr) {
+			free(magazines);
+			free(slotLinks);
+			free(buff);
+			throw std::bad_alloc();
+		}
+
+		// All magazines start out in the depot, empty.
+		for (size_t i = numMagazines; i-- > 0;) {
+			::new (&magazines[i].next) std::atomic<uint32_t>();
+			emptyMagazines.push((uint32_t)i, magazineLink());
+		}
+	}
+
+	/**
+	 * \brief Destructor
+	 * \pre All objects in the pool have been destroyed and all caches have been destroyed
+	 * \warning If all slots have not been freed by the time this is called,
+	 *          std::terminate is called (see Pool::~Pool)
+	 */
+	~ConcurrentPool()
+	{
+		if (freeSlots() != numSlots) {
+			fprintf(stderr, "A concurrent pool was destroyed before its elements were freed.\n");
+			std::terminate();
+		}
+
+		free(magazines);
+		free(slotLinks);
+		free(buff);
+	}
+
+	/// Returns the maximum number of allocations that can be made from the pool
+	size_t max_size() const { return numSlots; }
+
+	/**
+	 * \brief Counts the free slots that are not held by any cache
+	 * \warning This walks the depot and is only meaningful when no other threads
+	 *          are using the pool.
+	 *
+	 * Complexity is O(n)
+	 */
+	size_t freeSlots() const
+	{
+		size_t count = numSlots - std::min(highWater.load(), numSlots);
+
+		for (uint32_t m = fullMagazines.top(); m != TaggedIndexStack::none; m = magazines[m].next.load())
+			count += magazineSize;
+
+		for (uint32_t s = looseSlots.top(); s != TaggedIndexStack::none; s = slotLinks[s].load())
+			++count;
+
+		return count;
+	}
+
+	/**
+	 * \brief A thread's handle to a ConcurrentPool
+	 *
+	 * Each thread using the pool should have its own cache,
+	 * and all construction and destruction goes through it.
+	 * A cache must not be shared between threads without external synchronization,
+	 * and must be destroyed before the pool it came from.
+	 * When it is destroyed, its free slots are returned to the pool.
+	 */
+	class Cache {
+
+	public:
+
+		/// Creates a cache for the given pool
+		explicit Cache(ConcurrentPool& p) :
+			pool(&p),
+			storage(),
+			loaded(storage[0]),
+			previous(storage[1]),
+			loadedCount(0),
+			previousCount(0)
+		{ }
+
+		/// Destructor. Returns our free slots to the pool.
+		~Cache() { flush(); }
+
+		/**
+		 * \brief Allocates, constructs, and returns a single object from the pool
+		 * \param args Arguments forwarded to a constructor of T
+		 * \returns a pointer to a T, allocated from the pool then constructed.
+		 * \throws std::bad_alloc if there are no free slots in this cache or the pool's depot
+		 */
+		template <typename... Args>
+		T* construct(Args&&... args)
+		{
+			uint32_t slot = allocateSlot();
+			if (slot == TaggedIndexStack::none)
+				throw std::bad_alloc();
+
+			T* ret = reinterpret_cast<T*>(&pool->buff[slot]);
+
+			try {
+				::new (ret) T(std::forward<Args>(args)...);
+			}
+			catch (...) {
+				deallocateSlot(slot);
+				throw;
+			}
+
+			return ret;
+		}
+
+		/// Acts like construct, but returns null instead of throwing std::bad_alloc
+		template <typename... Args>
+		T* tryConstruct(Args&&... args)
+		{
+			try {
+				return construct(std::forward<Args>(args)...);
+			}
+			catch (const std::bad_alloc&) {
+				return nullptr;
+			}
+		}
+
+		/**
+		 * \brief Destroys then deallocates an object constructed from the pool
+		 *        (through any cache)
+		 * \throws std::invalid_argument if the object did not come from this cache's pool
+		 */
+		void destroy(T* toRelease)
+		{
+			const uint32_t slot = pool->indexOf(toRelease);
+
+			toRelease->~T();
+
+			deallocateSlot(slot);
+		}
+
+		/// Returns all free slots in this cache to the pool
+		void flush()
+		{
+			pool->release(loaded, loadedCount);
+			loadedCount = 0;
+			pool->release(previous, previousCount);
+			previousCount = 0;
+		}
+
+		Cache(const Cache&) = delete;
+
+		Cache& operator=(const Cache&) = delete;
+
+	private:
+
+		/// Pops a free slot, going to the depot if we need to.
+		/// Returns TaggedIndexStack::none if there are no free slots to be had.
+		uint32_t allocateSlot()
+		{
+			if (loadedCount == 0) {
+				// If our other magazine has anything in it, use that.
+				if (previousCount != 0)
+					swapMagazines();
+				// Otherwise trade for a full magazine from the depot.
+				else
+					loadedCount = pool->refill(loaded);
+
+				if (loadedCount == 0)
+					return TaggedIndexStack::none;
+			}
+
+			return loaded[--loadedCount];
+		}
+
+		/// Pushes a free slot, going to the depot if we need to.
+		void deallocateSlot(uint32_t slot)
+		{
+			if (loadedCount == magazineSize) {
+				// If our previous magazine is also full, send it back to the depot.
+				if (previousCount == magazineSize) {
+					pool->spill(previous);
+					previousCount = 0;
+				}
+
+				swapMagazines();
+			}
+
+			loaded[loadedCount++] = slot;
+		}
+
+		void swapMagazines()
+		{
+			std::swap(loaded, previous);
+			std::swap(loadedCount, previousCount);
+		}
+
+		ConcurrentPool* pool; ///< The pool we draw from
+		uint32_t storage[2][magazineSize]; ///< Storage for our two magazines
+		uint32_t* loaded; ///< The magazine we allocate from and free to
+		uint32_t* previous; ///< A second magazine, to avoid thrashing the depot
+		size_t loadedCount; ///< The number of free slots in _loaded_
+		size_t previousCount; ///< The number of free slots in _previous_
+	};
+
+	/// The copy constructor is deleted (see Pool)
+	ConcurrentPool(const ConcurrentPool&) = delete;
+
+	/// The assignment operator is deleted (see Pool)
+	const ConcurrentPool& operator=(const ConcurrentPool&) = delete;
+
+private:
+
+	/// A slot in our pool, which is just raw storage for a T.
+	/// The links for the depot's loose slots are kept in a separate array
+	/// (see LockFreePool for why).
+	typedef typename std::aligned_storage<sizeof(T), alignof(T)>::type Slot;
+
+	/**
+	 * \brief Allocates the memory for _count_ slots
+	 * \returns null if the memory cannot be allocated
+	 *
+	 * malloc only promises alignment for fundamental types, so over-aligned slots
+	 * come from posix_memalign instead (see Pool::allocateSlots).
+	 */
+	static Slot* allocateSlots(size_t count)
+	{
+		if (alignof(Slot) <= alignof(std::max_align_t))
+			return static_cast<Slot*>(malloc(count * sizeof(Slot)));
+
+		void* ret;
+		if (posix_memalign(&ret, alignof(Slot), count * sizeof(Slot)) != 0)
+			return nullptr;
+		return static_cast<Slot*>(ret);
+	}
+
+	/// A full magazine in the depot, or an empty one waiting to be filled
+	struct Magazine {
+		uint32_t slots[magazineSize]; ///< The indices of the free slots in this magazine
+		std::atomic<uint32_t> next; ///< The next magazine in whichever depot stack this is in
+	};
+
+	/// Gets the link of a magazine for the depot's stacks
+	struct MagazineLink {
+		Magazine* magazines;
+		std::atomic<uint32_t>& operator()(uint32_t i) const { return magazines[i].next; }
+	};
+
+	/// Gets the link of a slot for the depot's stack of loose slots
+	struct SlotLink {
+		std::atomic<uint32_t>* links;
+		std::atomic<uint32_t>& operator()(uint32_t i) const { return links[i]; }
+	};
+
+	MagazineLink magazineLink() const { return MagazineLink{magazines}; }
+
+	SlotLink slotLink() const { return SlotLink{slotLinks}; }
+
+	/// Gets the index of an object's slot
+	uint32_t indexOf(const T* t) const
+	{
+		const Slot* s = reinterpret_cast<const Slot*>(t);
+		if (s < buff || s >= buff + numSlots)
+			throw std::invalid_argument("The provided pointer is not valid");
+
+		return (uint32_t)(s - buff);
+	}
+
+	/**
+	 * \brief Fills an empty magazine from the depot
+	 * \returns The number of slots put in the magazine, which is zero only if the
+	 *          depot is completely empty.
+	 */
+	size_t refill(uint32_t* into)
+	{
+		// First choice: trade for a full magazine
+		const uint32_t m = fullMagazines.pop(magazineLink());
+		if (m != TaggedIndexStack::none) {
+			std::copy(magazines[m].slots, magazines[m].slots + magazineSize, into);
+			emptyMagazines.push(m, magazineLink());
+			return magazineSize;
+		}
+
+		// Second choice: grab slots that have never been used
+		size_t fresh = highWater.load(std::memory_order_relaxed);
+		while (fresh < numSlots) {
+			const size_t taken = std::min(magazineSize, numSlots - fresh);
+			if (highWater.compare_exchange_weak(fresh, fresh + taken, std::memory_order_relaxed)) {
+				for (size_t i = 0; i < taken; ++i)
+					into[i] = (uint32_t)(fresh + i);
+				return taken;
+			}
+		}
+
+		// Last choice: scrape together loose slots.
+		size_t count = 0;
+		for (; count < magazineSize; ++count) {
+			const uint32_t s = looseSlots.pop(slotLink());
+			if (s == TaggedIndexStack::none)
+				break;
+			into[count] = s;
+		}
+		return count;
+	}
+
+	/// Sends a full magazine's slots back to the depot
+	void spill(const uint32_t* from)
+	{
+		const uint32_t m = emptyMagazines.pop(magazineLink());
+		if (m == TaggedIndexStack::none) {
+			// This shouldn't happen, since there are more magazines than
+			// could possibly be filled, but just in case...
+			release(from, magazineSize);
+			return;
+		}
+
+		std::copy(from, from + magazineSize, magazines[m].slots);
+		fullMagazines.push(m, magazineLink());
+	}
+
+	/// Returns a (possibly partial) magazine's slots to the depot
+	void release(const uint32_t* from, size_t count)
+	{
+		if (count == magazineSize) {
+			spill(from);
+			return;
+		}
+
+		for (size_t i = 0; i < count; ++i)
+			looseSlots.push(from[i], slotLink());
+	}
+
+	Slot* buff; ///< The buffer for the entire pool
+	std::atomic<uint32_t>* slotLinks; ///< Links for the depot's stack of loose slots
+	Magazine* magazines; ///< Storage for the depot's magazines
+	size_t numSlots; ///< The total number of slots in the pool
+	size_t numMagazines; ///< The number of magazines in _magazines_
+	std::atomic<size_t> highWater; ///< Slots at or past this index have never been handed out
+	TaggedIndexStack fullMagazines; ///< Full magazines in the depot
+	TaggedIndexStack emptyMagazines; ///< Empty magazines in the depot
+	TaggedIndexStack looseSlots; ///< Free slots in the depot that aren't in a full magazine
+};
+
+template <typename T>
+const size_t ConcurrentPool<T>::magazineSize;
@@ -0,0 +1,235 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+#include "TaggedIndexStack.hpp"
+
+/**
+ * \brief A fixed-size pool whose construct and destroy are lock-free
+ * \tparam The type of the contents of the pool
+ *
+ * This is the same idea as Pool (a stack of free slots),
+ * except that the free list is a TaggedIndexStack, so any number of threads can
+ * construct and destroy objects at once without ever taking a lock.
+ * This makes it usable from places where blocking is not an option,
+ * such as real-time audio threads or signal handlers
+ * (use tryConstruct there, which reports a full pool without throwing).
+ *
+ * Free slots are linked by the 32-bit index of the next free slot instead of a pointer,
+ * which leaves room in the stack's head for a tag that guards against the ABA problem
+ * (see TaggedIndexStack).
+ * Unlike Pool, the links are kept in a separate array instead of inside the free slots.
+ * A thread popping the stack can read the link of a slot that another thread has
+ * just popped and is constructing an object in. The compare-and-swap throws the value away,
+ * but the read itself would race with the constructor's writes.
+ * Keeping links out of the slots costs four bytes per slot and removes that race.
+ * Slots that have never been used are handed out with an atomic bump index,
+ * so constructing the pool doesn't touch its buffer.
+ *
+ * All threads share the head of the free list, so it will not scale as well as
+ * ConcurrentPool under heavy contention. Its advantage is that it needs no per-thread state,
+ * and every free slot is available to every thread.
+ */
+template <typename T>
+class LockFreePool {
+
+public:
+
+	typedef T value_type;
+
+	/**
+	 * \brief Constructs a pool of a given size
+	 * \param poolSize The maximum number of elements this pool will be able to store
+	 * \throws std::bad_alloc if enough memory for the pool cannot be allocated
+	 * \throws std::invalid_argument if poolSize is too large to index with 32 bits
+	 */
+	explicit LockFreePool(size_t poolSize) :
+		buff(nullptr),
+		links(nullptr),
+		numSlots(poolSize),
+		highWater(0),
+		numAllocated(0),
+		freeSlots()
+	{
+		if (poolSize >= TaggedIndexStack::none)
+			throw std::invalid_argument("Lock-free pools are limited to 2^32 - 1 slots");
+
+		buff = allocateSlots(poolSize);
+		if (buff == nullptr)
+			throw std::bad_alloc();
+
+		// Zeroed memory is a valid (lock-free) atomic, and calloc lets the OS hand us
+		// untouched pages, so this costs nothing until slots are actually freed.
+		links = static_cast<std::atomic<uint32_t>*>(calloc(poolSize, sizeof(std::atomic<uint32_t>)));
+		if (links == nullptr) {
+			free(buff);
+			throw std::bad_alloc();
+		}
+	}
+
+	/**
+	 * \brief Destructor
+	 * \pre All slots in the pool have been freed
+	 * \warning If all slots have not been freed by the time this is called,
+	 *          std::terminate is called (see Pool::~Pool)
+	 */
+	~LockFreePool()
+	{
+		if (size() != 0) {
+			fprintf(stderr, "A lock-free pool was destroyed before its elements were freed.\n");
+			std::terminate();
+		}
+
+		free(links);
+		free(buff);
+	}
+
+	/// Returns the number of currently allocated slots in the pool
+	/// (which may be stale by the time you look at it if other threads are using the pool)
+	size_t size() const { return numAllocated.load(std::memory_order_relaxed); }
+
+	/// Returns the maximum number of allocations that can be made from the pool
+	size_t max_size() const { return numSlots; }
+
+	/// Returns true if no slots in the pool are allocated (see size())
+	bool empty() const { return size() == 0; }
+
+	/**
+	 * \brief Allocates, constructs, and returns a single object from the pool
+	 * \param args Arguments forwarded to a constructor of T
+	 * \returns a pointer to a T, allocated from the pool then constructed.
+	 * \throws std::bad_alloc if there is no room in the pool
+	 *
+	 * Allocation is lock-free. Whether construction is lock-free is up to T.
+	 */
+	template <typename... Args>
+	T* construct(Args&&... args)
+	{
+		T* ret = tryConstruct(std::forward<Args>(args)...);
+		if (ret == nullptr)
+			throw std::bad_alloc();
+
+		return ret;
+	}
+
+	/**
+	 * \brief Allocates, constructs, and returns a single object from the pool
+	 * \param args Arguments forwarded to a constructor of T
+	 * \returns a pointer to a T, allocated from the pool then constructed,
+	 *          or null if there is no room in the pool
+	 */
+	template <typename... Args>
+	T* tryConstruct(Args&&... args)
+	{
+		const uint32_t slot = allocateSlot();
+		if (slot == TaggedIndexStack::none)
+			return nullptr;
+
+		T* ret = reinterpret_cast<T*>(&buff[slot]);
+
+		try {
+			::new (ret) T(std::forward<Args>(args)...);
+		}
+		catch (...) {
+			deallocateSlot(slot);
+			throw;
+		}
+
+		return ret;
+	}
+
+	/**
+	 * \brief Destroys then deallocates an object constructed from the pool
+	 * \throws std::invalid_argument if the object did not come from this pool
+	 */
+	void destroy(T* toRelease)
+	{
+		const Slot* s = reinterpret_cast<const Slot*>(toRelease);
+		if (s < buff || s >= buff + numSlots)
+			throw std::invalid_argument("The provided pointer is not valid");
+
+		toRelease->~T();
+
+		deallocateSlot((uint32_t)(s - buff));
+	}
+
+	/// The copy constructor is deleted (see Pool)
+	LockFreePool(const LockFreePool&) = delete;
+
+	/// The assignment operator is deleted (see Pool)
+	const LockFreePool& operator=(const LockFreePool&) = delete;
+
+private:
+
+	/// A slot in our pool, which is just raw storage for a T
+	typedef typename std::aligned_storage<sizeof(T), alignof(T)>::type Slot;
+
+	/**
+	 * \brief Allocates the memory for _count_ slots
+	 * \returns null if the memory cannot be allocated
+	 *
+	 * malloc only promises alignment for fundamental types, so over-aligned slots
+	 * come from posix_memalign instead (see Pool::allocateSlots).
+	 */
+	static Slot* allocateSlots(size_t count)
+	{
+		if (alignof(Slot) <= alignof(std::max_align_t))
+			return static_cast<Slot*>(malloc(count * sizeof(Slot)));
+
+		void* ret;
+		if (posix_memalign(&ret, alignof(Slot), count * sizeof(Slot)) != 0)
+			return nullptr;
+		return static_cast<Slot*>(ret);
+	}
+
+	/// Gets the link of a slot for the free list
+	struct SlotLink {
+		std::atomic<uint32_t>* links;
+		std::atomic<uint32_t>& operator()(uint32_t i) const { return links[i]; }
+	};
+
+	/// Pops a free slot, or returns TaggedIndexStack::none if there is none
+	uint32_t allocateSlot()
+	{
+		uint32_t slot = freeSlots.pop(SlotLink{links});
+
+		// If there are no freed slots, try one we haven't used yet.
+		if (slot == TaggedIndexStack::none) {
+			size_t fresh = highWater.load(std::memory_order_relaxed);
+			for (;;) {
+				if (fresh >= numSlots)
+					return TaggedIndexStack::none;
+
+				if (highWater.compare_exchange_weak(fresh, fresh + 1, std::memory_order_relaxed))
+					break;
+			}
+			slot = (uint32_t)fresh;
+		}
+
+		numAllocated.fetch_add(1, std::memory_order_relaxed);
+		return slot;
+	}
+
+	/// Pushes a slot back onto the free list
+	void deallocateSlot(uint32_t slot)
+	{
+		numAllocated.fetch_sub(1, std::memory_order_relaxed);
+		freeSlots.push(slot, SlotLink{links});
+	}
+
+	Slot* buff; ///< The buffer for the entire pool
+	std::atomic<uint32_t>* links; ///< The index of the next free slot for each free slot
+	size_t numSlots; ///< The total number of slots in the pool
+	std::atomic<size_t> highWater; ///< Slots at or past this index have never been handed out
+	std::atomic<size_t> numAllocated; ///< The number of allocated slots in the pool
+	TaggedIndexStack freeSlots; ///< The stack of freed slots
+};
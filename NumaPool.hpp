@@ -0,0 +1,398 @@
+#pragma once
+
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <sched.h>
+#include <unistd.h>
+
+#ifdef MKB_USE_LIBNUMA
+#include <numa.h>
+#endif
+
+#include "Pool.hpp"
+
+/**
+ * \brief Helpers for finding out which CPUs belong to which NUMA node
+ *
+ * By default, the topology is read from sysfs (/sys/devices/system/node),
+ * so no extra libraries are needed. Define MKB_USE_LIBNUMA (and link with -lnuma)
+ * to ask libnuma instead, which also lets NumaPool bind each partition's memory
+ * to its node explicitly instead of relying on first-touch placement alone.
+ * Either way, if the topology can't be determined, everything is treated as one node.
+ */
+namespace Numa {
+
+/**
+ * \brief Parses a Linux CPU list (e.g. "0-3,8,10-11") into the CPUs it names
+ * \returns The CPUs, in the order listed, or an empty list if the string is malformed
+ */
+inline std::vector<int> parseCpuList(const std::string& list)
+{
+	std::vector<int> cpus;
+	const char* c = list.c_str();
+
+	while (*c != '\0' && *c != '\n') {
+		char* end;
+		const long first = strtol(c, &end, 10);
+		if (end == c || first < 0)
+			return std::vector<int>();
+
+		long last = first;
+		c = end;
+		if (*c == '-') {
+			last = strtol(c + 1, &end, 10);
+			if (end == c + 1 || last < first)
+				return std::vector<int>();
+			c = end;
+		}
+
+		for (long cpu = first; cpu <= last; ++cpu)
+			cpus.push_back((int)cpu);
+
+		if (*c == ',')
+			++c;
+		else if (*c != '\0' && *c != '\n')
+			return std::vector<int>();
+	}
+
+	return cpus;
+}
+
+/// The machine's NUMA nodes and the CPUs in each
+struct Topology {
+	std::vector<std::vector<int>> cpusOfNode; ///< The CPUs of each node, indexed by node
+	std::vector<int> nodeIds; ///< The system's number for each node
+	std::vector<int> nodeOfCpu; ///< The node of each CPU, indexed by CPU
+
+	Topology() : cpusOfNode(), nodeIds(), nodeOfCpu() { }
+
+	/// Returns the number of nodes (always at least one)
+	size_t nodeCount() const { return cpusOfNode.size(); }
+
+	/// Returns the node of the CPU the calling thread is running on
+	size_t currentNode() const
+	{
+		const int cpu = sched_getcpu();
+		if (cpu < 0 || (size_t)cpu >= nodeOfCpu.size())
+			return 0;
+		return nodeOfCpu[cpu];
+	}
+};
+
+/// Reads a file's contents as a string, or returns an empty string if it can't
+inline std::string readFile(const std::string& path)
+{
+	std::string contents;
+	FILE* f = fopen(path.c_str(), "r");
+	if (f == nullptr)
+		return contents;
+
+	char buf[256];
+	size_t got;
+	while ((got = fread(buf, 1, sizeof(buf), f)) > 0)
+		contents.append(buf, got);
+
+	fclose(f);
+	return contents;
+}
+
+/**
+ * \brief Discovers the machine's NUMA topology
+ *
+ * Nodes that have no CPUs (e.g. memory-only nodes) are left out,
+ * since no thread can call them local. Nodes are renumbered from zero if there are gaps.
+ */
+inline Topology discoverTopology()
+{
+	Topology t;
+
+#ifdef MKB_USE_LIBNUMA
+	if (numa_available() >= 0) {
+		const int cpuCount = numa_num_configured_cpus();
+		for (int cpu = 0; cpu < cpuCount; ++cpu) {
+			const int node = numa_node_of_cpu(cpu);
+			if (node < 0)
+				continue;
+
+			size_t i = 0;
+			while (i < t.nodeIds.size() && t.nodeIds[i] != node)
+				++i;
+			if (i == t.nodeIds.size()) {
+				t.nodeIds.push_back(node);
+				t.cpusOfNode.emplace_back();
+			}
+			t.cpusOfNode[i].push_back(cpu);
+		}
+	}
+#else
+	const std::vector<int> online = parseCpuList(readFile("/sys/devices/system/node/online"));
+	for (int node : online) {
+		const std::vector<int> cpus = parseCpuList(
+			readFile("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist"));
+		if (!cpus.empty()) {
+			t.cpusOfNode.push_back(cpus);
+			t.nodeIds.push_back(node);
+		}
+	}
+#endif
+
+	// No NUMA information means one node with every CPU on it.
+	if (t.cpusOfNode.empty()) {
+		const long cpuCount = sysconf(_SC_NPROCESSORS_CONF);
+		t.cpusOfNode.emplace_back();
+		t.nodeIds.assign(1, 0);
+		for (long cpu = 0; cpu < (cpuCount > 0 ? cpuCount : 1); ++cpu)
+			t.cpusOfNode[0].push_back((int)cpu);
+	}
+
+	for (size_t node = 0; node < t.cpusOfNode.size(); ++node) {
+		for (int cpu : t.cpusOfNode[node]) {
+			if ((size_t)cpu >= t.nodeOfCpu.size())
+				t.nodeOfCpu.resize(cpu + 1, 0);
+			t.nodeOfCpu[cpu] = (int)node;
+		}
+	}
+
+	return t;
+}
+
+/**
+ * \brief Runs a function on a thread pinned to a node's CPUs, and waits for it to finish
+ *
+ * If the thread can't be pinned (say, the process's affinity mask excludes that node),
+ * the function still runs, just wherever the scheduler puts it.
+ */
+template <typename F>
+void runOnNode(const std::vector<int>& cpus, F f)
+{
+	std::exception_ptr error;
+
+	std::thread pinned([&] {
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		for (int cpu : cpus) {
+			if (cpu < CPU_SETSIZE)
+				CPU_SET(cpu, &set);
+		}
+		sched_setaffinity(0, sizeof(set), &set);
+
+		try {
+			f();
+		}
+		catch (...) {
+			error = std::current_exception();
+		}
+	});
+	pinned.join();
+
+	if (error)
+		std::rethrow_exception(error);
+}
+
+} // end namespace Numa
+
+/**
+ * \brief A pool split into one partition per NUMA node, which many threads can use at once
+ * \tparam The type of the contents of the pool
+ *
+ * On a multi-socket machine, memory is attached to a particular socket (NUMA node),
+ * and touching another node's memory is considerably slower.
+ * Linux places a page on the node of the thread that first touches it,
+ * so a single Pool shared between nodes ends up scattered across them
+ * depending on which thread happened to use each page of slots first.
+ *
+ * A NumaPool instead keeps a separate Pool (partition) for each node.
+ * Each partition is created and first touched by a thread pinned to its node,
+ * so its memory lands there, and construct prefers the partition of the node
+ * the calling thread is running on, only falling back to other nodes when that one is full.
+ * Objects can be destroyed from any thread; they return to the partition they came from.
+ *
+ * Each partition is guarded by its own mutex, so threads on different nodes never contend.
+ * On a machine with a single node (or no NUMA information), this degrades to a Pool
+ * behind a mutex.
+ */
+template <typename T>
+class NumaPool {
+
+public:
+
+	typedef T value_type;
+
+	/**
+	 * \brief Constructs a pool with a partition on each NUMA node
+	 * \param slotsPerNode The number of objects each partition can hold
+	 * \throws std::bad_alloc if enough memory for the partitions cannot be allocated
+	 */
+	explicit NumaPool(size_t slotsPerNode) :
+		topology(Numa::discoverTopology()),
+		partitions(),
+		numAllocated(0)
+	{
+		if (slotsPerNode == 0)
+			throw std::invalid_argument("Partitions must be able to hold at least one object");
+
+		for (size_t node = 0; node < topology.nodeCount(); ++node) {
+			Numa::runOnNode(topology.cpusOfNode[node], [&] {
+				std::unique_ptr<Partition> p(new Partition(slotsPerNode));
+				firstTouch(p->pool, topology.nodeIds[node]);
+				partitions.push_back(std::move(p));
+			});
+		}
+	}
+
+	/**
+	 * \brief Destructor
+	 * \pre All objects in the pool have been destroyed
+	 * \warning If all objects have not been destroyed by the time this is called,
+	 *          std::terminate is called (see Pool::~Pool)
+	 */
+	~NumaPool()
+	{
+		if (size() != 0) {
+			fprintf(stderr, "A NUMA pool was destroyed before its elements were freed.\n");
+			std::terminate();
+		}
+	}
+
+	/**
+	 * \brief Allocates, constructs, and returns a single object,
+	 *        preferably from the calling thread's node
+	 * \param args Arguments forwarded to a constructor of T
+	 * \returns a pointer to a T, allocated from the pool then constructed.
+	 * \throws std::bad_alloc if every partition is full
+	 */
+	template <typename... Args>
+	T* construct(Args&&... args)
+	{
+		const size_t local = localNode();
+
+		for (size_t i = 0; i < partitions.size(); ++i) {
+			Partition& p = *partitions[(local + i) % partitions.size()];
+			std::lock_guard<std::mutex> guard(p.lock);
+
+			T* ret = p.pool.tryConstruct(std::forward<Args>(args)...);
+			if (ret != nullptr) {
+				numAllocated.fetch_add(1, std::memory_order_relaxed);
+				return ret;
+			}
+		}
+
+		throw std::bad_alloc();
+	}
+
+	/**
+	 * \brief Destroys then deallocates an object constructed from the pool
+	 * \throws std::invalid_argument if the object did not come from this pool
+	 */
+	void destroy(T* toRelease)
+	{
+		Partition& p = *partitions[nodeOf(toRelease)];
+		std::lock_guard<std::mutex> guard(p.lock);
+		p.pool.destroy(toRelease);
+		numAllocated.fetch_sub(1, std::memory_order_relaxed);
+	}
+
+	/**
+	 * \brief Returns the node whose partition an object came from
+	 * \throws std::invalid_argument if the object did not come from this pool
+	 */
+	size_t nodeOf(const T* p) const
+	{
+		for (size_t node = 0; node < partitions.size(); ++node) {
+			if (partitions[node]->pool.owns(p))
+				return node;
+		}
+
+		throw std::invalid_argument("The provided pointer is not valid");
+	}
+
+	/// Returns true if the object came from this pool
+	bool owns(const T* p) const
+	{
+		for (const auto& partition : partitions) {
+			if (partition->pool.owns(p))
+				return true;
+		}
+		return false;
+	}
+
+	/// Returns the node the calling thread is currently running on
+	size_t localNode() const { return topology.currentNode(); }
+
+	/// Returns the number of partitions, i.e. NUMA nodes
+	size_t nodeCount() const { return partitions.size(); }
+
+	/// Returns the number of currently allocated objects
+	/// (which may be stale by the time you look at it if other threads are using the pool)
+	size_t size() const { return numAllocated.load(std::memory_order_relaxed); }
+
+	/// Returns the maximum number of objects the pool can hold, across all nodes
+	size_t max_size() const { return partitions.size() * partitions[0]->pool.max_size(); }
+
+	/// Returns true if no objects are allocated (see size())
+	bool empty() const { return size() == 0; }
+
+	/// The copy constructor is deleted (see Pool)
+	NumaPool(const NumaPool&) = delete;
+
+	/// The assignment operator is deleted (see Pool)
+	const NumaPool& operator=(const NumaPool&) = delete;
+
+private:
+
+	/// One node's share of the pool
+	struct Partition {
+		std::mutex lock; ///< Guards the pool
+		Pool<T> pool; ///< The node's objects
+
+		explicit Partition(size_t size) : lock(), pool(size) { }
+	};
+
+	/**
+	 * \brief Makes sure a partition's memory is placed on its node
+	 *
+	 * This runs on a thread pinned to the node, and writes to every page of the pool's buffer
+	 * (without changing anything) so that the kernel places each page there.
+	 * With libnuma, we also bind the buffer to the node outright first,
+	 * in case the process's memory policy would put it elsewhere.
+	 */
+	static void firstTouch(Pool<T>& pool, int node)
+	{
+		char* const start = reinterpret_cast<char*>(pool.buff);
+		const size_t bytes = pool.max_size() * sizeof(typename Pool<T>::Slot);
+		const size_t pageSize = sysconf(_SC_PAGESIZE);
+
+#ifdef MKB_USE_LIBNUMA
+		// Binding works on whole pages, and we don't want to move other allocations
+		// that share the first and last pages, so only bind the pages entirely inside the buffer.
+		const uintptr_t first = (reinterpret_cast<uintptr_t>(start) + pageSize - 1) & ~(pageSize - 1);
+		const uintptr_t last = (reinterpret_cast<uintptr_t>(start) + bytes) & ~(pageSize - 1);
+		if (numa_available() >= 0 && last > first)
+			numa_tonode_memory(reinterpret_cast<void*>(first), last - first, node);
+#else
+		(void)node;
+#endif
+
+		for (size_t offset = 0; offset < bytes; offset += pageSize) {
+			volatile char* page = start + offset;
+			*page = *page;
+		}
+	}
+
+	Numa::Topology topology; ///< Which CPUs are on which nodes
+	std::vector<std::unique_ptr<Partition>> partitions; ///< The partition for each node
+	std::atomic<size_t> numAllocated; ///< The number of allocated objects across all partitions
+};
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstddef>
+
+#include "Pool.hpp"
+#include "WorkStealingExecutor.hpp"
+
+namespace ParallelDetail {
+
+/**
+ * \brief Picks how many slots go in each chunk of a parallel pass over _extent_ slots
+ * \param extent The number of slots to cover
+ * \param threads The number of threads the pass is split between
+ * \param grain The requested number of slots per chunk, or zero to pick one
+ *
+ * Chunks are whole words of the occupancy bitmap (64 slots), so no two threads
+ * scan the same word or touch the same slot's cache line. Unless asked otherwise,
+ * we aim for about eight chunks per thread, which leaves plenty to steal
+ * when objects are bunched up in one part of the pool.
+ */
+inline size_t chunkSlots(size_t extent, size_t threads, size_t grain)
+{
+	if (grain == 0)
+		grain = extent / (threads * 8);
+
+	const size_t words = (grain + PoolBits::wordBits - 1) / PoolBits::wordBits;
+	return (words == 0 ? 1 : words) * PoolBits::wordBits;
+}
+
+/// Does the work for both the const and non-const versions of parallelForEach
+template <typename P, typename Fn>
+void forEachInPool(WorkStealingExecutor& executor, P& pool, const Fn& fn, size_t grain)
+{
+	const size_t extent = pool.highWaterMark();
+	if (extent == 0)
+		return;
+
+	grain = chunkSlots(extent, executor.threadCount(), grain);
+	executor.forEachChunk((extent + grain - 1) / grain, [&](size_t chunk) {
+		const size_t first = chunk * grain;
+		pool.forEachInSlots(first, first + grain, fn);
+	});
+}
+
+} // end namespace ParallelDetail
+
+/**
+ * \brief Calls _fn_ on every object in a pool, split across an executor's threads
+ * \param executor The threads to split the work between
+ * \param pool The pool whose objects are visited
+ * \param fn Called once with a reference to each object. It is called from many threads
+ *           at once, so aside from the object it is given, it must be thread-safe.
+ * \param grain The number of slots handed out at a time, rounded up to a multiple of 64.
+ *              Zero picks a size based on the pool and the number of threads.
+ * \throws Whatever _fn_ throws (see WorkStealingExecutor::forEachChunk),
+ *         in which case some objects may not have been visited
+ *
+ * The pool is split by slot, not by object, since slot ranges can be found without
+ * walking the pool. Only slots below the high-water mark are visited, and work stealing
+ * keeps the threads busy when objects are bunched up in part of that range.
+ * The pool must not be modified until this returns.
+ */
+template <typename T, size_t Alignment, typename Fn>
+void parallelForEach(WorkStealingExecutor& executor, Pool<T, Alignment>& pool, const Fn& fn,
+                     size_t grain = 0)
+{
+	ParallelDetail::forEachInPool(executor, pool, fn, grain);
+}
+
+/// \copydoc parallelForEach
+template <typename T, size_t Alignment, typename Fn>
+void parallelForEach(WorkStealingExecutor& executor, const Pool<T, Alignment>& pool, const Fn& fn,
+                     size_t grain = 0)
+{
+	ParallelDetail::forEachInPool(executor, pool, fn, grain);
+}
@@ -0,0 +1,478 @@
+#pragma once
+
+#include <cassert>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "CRC32Generator.hpp"
+#include "Exceptions.hpp"
+#include "Pool.hpp"
+
+/**
+ * \brief A pool whose contents live in a memory-mapped file, and so outlive the process
+ * \tparam T The type of the contents of the pool, which must be trivially copyable
+ *
+ * The file holds a header, the occupancy bitmap, and the slots themselves,
+ * and is mapped in whole. Objects are constructed and destroyed in place,
+ * just like in a Pool, so a process that reopens the file picks up
+ * exactly where the last one left off without rebuilding anything.
+ *
+ * The file is mapped at a different address each time, so nothing in it is a pointer:
+ * the free list links slots by index, and callers who need to refer to objects
+ * across runs should keep indices (see indexOf() and at()) rather than pointers.
+ * For the same reason, T must be trivially copyable, i.e. plain data
+ * that does not point into the process that made it.
+ * The file records the size and alignment of T, and refuses to open as a pool
+ * of anything else, but a different type of the same shape can't be told apart.
+ *
+ * ### Crash consistency
+ *
+ * While a pool is open, its header is marked dirty on disk. Closing the pool
+ * writes everything out, then stores the header with a CRC-32 checksum and marks it clean.
+ * On open, a header that is dirty or fails its checksum means the last process
+ * didn't close the pool properly, so the free list and counts are rebuilt
+ * from the occupancy bitmap, which is the source of truth (see recovered()).
+ *
+ * What survives a crash depends on what crashed:
+ * - If only the process died, every write it made is still in the page cache,
+ *   so everything but an object caught halfway through construction survives.
+ * - If the whole machine went down, only what was written out by the last sync()
+ *   (or by the kernel, whenever it chose to) is guaranteed to be there.
+ *   Objects changed since then may be stale or torn, and the bitmap may not
+ *   match them, so sync() after any changes that must not be lost.
+ *
+ * Objects are not destroyed when the pool is closed (that's the point),
+ * and T's destructor is never run by the pool.
+ *
+ * \warning Like Pool, this is not thread-safe, and nothing stops two processes
+ *          from opening the same file at once. Don't.
+ */
+template <typename T>
+class PersistentPool {
+
+	static_assert(std::is_trivially_copyable<T>::value,
+	              "Only trivially copyable types can be stored in a file");
+
+public:
+
+	typedef T value_type;
+
+	/**
+	 * \brief Opens the pool stored in a file, or creates it if there is no such file
+	 * \param path The file
+	 * \param poolSize The number of objects a new pool can hold.
+	 *                 If the file already holds a pool, its own size is used instead.
+	 * \throws Exceptions::FileException if the file can't be opened, created, or mapped,
+	 *         or if it holds something other than a pool of T
+	 */
+	PersistentPool(const std::string& path, size_t poolSize) :
+		fd(-1),
+		mapping(nullptr),
+		mappedBytes(0),
+		header(nullptr),
+		occupied(nullptr),
+		buff(nullptr),
+		wasCreated(false),
+		wasRecovered(false)
+	{
+		fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+		if (fd < 0)
+			fail("Could not open " + path);
+
+		try {
+			struct stat st;
+			if (fstat(fd, &st) != 0)
+				fail("Could not stat " + path);
+
+			if (st.st_size == 0)
+				create(poolSize);
+			else
+				open(path, st.st_size);
+
+			// Until we close cleanly, a crash should make the next open recover.
+			header->clean = 0;
+			storeChecksum();
+			if (msync(mapping, sizeof(Header), MS_SYNC) != 0)
+				fail("Could not write the header of " + path);
+		}
+		catch (...) {
+			if (mapping != nullptr)
+				munmap(mapping, mappedBytes);
+			::close(fd);
+			throw;
+		}
+	}
+
+	/**
+	 * \brief Closes the pool, writing everything to the file and marking it clean
+	 *
+	 * Objects are left in the pool for the next process to open it.
+	 */
+	~PersistentPool()
+	{
+		// Write out the contents before the header that vouches for them.
+		// There is nobody to tell if this fails, but the next open will recover.
+		if (msync(mapping, mappedBytes, MS_SYNC) == 0) {
+			header->clean = 1;
+			storeChecksum();
+			msync(mapping, sizeof(Header), MS_SYNC);
+		}
+		munmap(mapping, mappedBytes);
+		::close(fd);
+	}
+
+	/**
+	 * \brief Allocates and constructs an object in the pool
+	 * \param args Arguments forwarded to a constructor of T
+	 * \throws std::bad_alloc if the pool is full
+	 *
+	 * Complexity is O(1)
+	 */
+	template <typename... Args>
+	T* construct(Args&&... args)
+	{
+		const uint64_t index = allocateSlot();
+		T* t = reinterpret_cast<T*>(buff + index);
+		try {
+			::new (t) T(std::forward<Args>(args)...);
+		}
+		catch (...) {
+			freeSlot(index);
+			throw;
+		}
+
+		// Only mark the slot in use once it holds an object.
+		PoolBits::set(occupied, index);
+		return t;
+	}
+
+	/**
+	 * \brief Destroys and deallocates an object in the pool
+	 * \throws std::invalid_argument if the pointer is not to a slot in the pool
+	 * \throws std::logic_error if the slot does not hold an object
+	 *
+	 * Complexity is O(1)
+	 */
+	void destroy(T* t)
+	{
+		const size_t index = indexOf(t);
+		if (!PoolBits::test(occupied, index))
+			throw std::logic_error("Double destroy detected");
+
+		PoolBits::clear(occupied, index);
+		freeSlot(index);
+	}
+
+	/**
+	 * \brief Returns the index of an object's slot, which stays the same across runs
+	 * \throws std::invalid_argument if the pointer is not to a slot in the pool
+	 */
+	size_t indexOf(const T* t) const
+	{
+		const char* p = reinterpret_cast<const char*>(t);
+		const char* start = reinterpret_cast<const char*>(buff);
+		if (p < start || p >= start + header->slotCount * sizeof(Slot)
+		    || (p - start) % sizeof(Slot) != 0)
+			throw std::invalid_argument("The provided pointer is not valid");
+
+		return (p - start) / sizeof(Slot);
+	}
+
+	/// Returns the object in a given slot, or null if the slot is empty or out of range
+	T* at(size_t index)
+	{
+		if (index >= header->slotCount || !PoolBits::test(occupied, index))
+			return nullptr;
+
+		return reinterpret_cast<T*>(buff + index);
+	}
+
+	/// \copydoc at
+	const T* at(size_t index) const { return const_cast<PersistentPool*>(this)->at(index); }
+
+	/**
+	 * \brief Calls _fn_ on each object in the pool, in order of slot
+	 *
+	 * Complexity is O(high-water mark / 64 + number of objects)
+	 */
+	template <typename Fn>
+	void forEach(Fn&& fn)
+	{
+		const size_t limit = header->highWater;
+		for (size_t i = PoolBits::find(occupied, 0, limit, true); i < limit;
+		     i = PoolBits::find(occupied, i + 1, limit, true))
+			fn(*reinterpret_cast<T*>(buff + i));
+	}
+
+	/**
+	 * \brief Writes everything to the file, so that it survives even if the machine crashes
+	 * \throws Exceptions::FileException if the data couldn't be written
+	 *
+	 * The header stays marked dirty, so if the machine does crash,
+	 * the next open still rebuilds the bookkeeping from the (now durable) bitmap.
+	 *
+	 * Complexity is O(pages changed since the last sync)
+	 */
+	void sync()
+	{
+		if (msync(mapping, mappedBytes, MS_SYNC) != 0)
+			fail("Could not write the pool to its file");
+	}
+
+	/// Returns true if the file didn't exist (or was empty) and the pool was made from scratch
+	bool created() const { return wasCreated; }
+
+	/**
+	 * \brief Returns true if the pool had to be rebuilt from its bitmap,
+	 *        either because it wasn't closed cleanly or because its free list was damaged
+	 */
+	bool recovered() const { return wasRecovered; }
+
+	/// Returns the number of objects in the pool. Complexity is O(1)
+	size_t size() const { return header->numAllocated; }
+
+	/// Returns the maximum number of objects the pool can hold. Complexity is O(1)
+	size_t max_size() const { return header->slotCount; }
+
+	/// Returns true if the pool is empty. Complexity is O(1)
+	bool empty() const { return header->numAllocated == 0; }
+
+	/// Returns true if the pool is full. Complexity is O(1)
+	bool full() const { return header->numAllocated == header->slotCount; }
+
+	/// The copy constructor is deleted (see Pool)
+	PersistentPool(const PersistentPool&) = delete;
+
+	/// The assignment operator is deleted (see Pool)
+	const PersistentPool& operator=(const PersistentPool&) = delete;
+
+private:
+
+	/// A slot, which links to the next free slot by index when it is empty
+	union Slot {
+		T data;
+		uint64_t next;
+	};
+
+	/// The start of the file. Every field is fixed-size so the layout is the same everywhere.
+	struct Header {
+		char magic[8]; ///< Identifies the file as a pool
+		uint32_t version; ///< The version of this layout
+		uint32_t checksum; ///< CRC-32 of the header, taken with this field set to zero
+		uint64_t objectSize; ///< sizeof(T), to catch files made for other types
+		uint64_t objectAlignment; ///< alignof(T), for the same reason
+		uint64_t slotCount; ///< The number of slots in the pool
+		uint64_t bitmapOffset; ///< Where the occupancy bitmap starts, from the start of the file
+		uint64_t dataOffset; ///< Where the slots start, from the start of the file
+		uint64_t highWater; ///< Slots at or past this index have never been used
+		uint64_t firstFree; ///< The index of the first slot on the free list, or noSlot
+		uint64_t numAllocated; ///< The number of slots holding objects
+		uint32_t clean; ///< Nonzero if the pool was closed properly
+		uint32_t reserved; ///< Padding, which is always zero
+	};
+
+	static const uint32_t layoutVersion = 1;
+
+	/// Used as a slot index to mean "no slot"
+	static const uint64_t noSlot = ~uint64_t(0);
+
+	/// Where the slots start in the file is rounded up to this, so they begin on a page
+	static const size_t fileAlignment = 4096;
+
+	static const char* magic() { return "MKbPool"; }
+
+	static size_t roundUp(size_t n, size_t to) { return (n + to - 1) / to * to; }
+
+	[[noreturn]] static void fail(const std::string& what)
+	{
+		THROW(Exceptions::FileException, what + ": " + strerror(errno));
+	}
+
+	/// Computes the header's checksum
+	uint32_t headerChecksum() const
+	{
+		Header copy = *header;
+		copy.checksum = 0;
+		static const CRC32Generator crc;
+		return crc.CRC32Generate(&copy, sizeof(copy));
+	}
+
+	void storeChecksum() { header->checksum = headerChecksum(); }
+
+	/// Lays out a new pool in an empty file
+	void create(size_t poolSize)
+	{
+		const size_t bitmapOffset = roundUp(sizeof(Header), sizeof(uint64_t));
+		const size_t dataOffset =
+			roundUp(bitmapOffset + PoolBits::wordsFor(poolSize) * sizeof(uint64_t), fileAlignment);
+		const size_t bytes = dataOffset + poolSize * sizeof(Slot);
+
+		// The file starts out sparse, so (like Pool) slots take up no room until they are used.
+		if (ftruncate(fd, bytes) != 0)
+			fail("Could not size the pool's file");
+
+		map(bytes);
+
+		Header h;
+		memset(&h, 0, sizeof(h));
+		memcpy(h.magic, magic(), sizeof(h.magic));
+		h.version = layoutVersion;
+		h.objectSize = sizeof(T);
+		h.objectAlignment = alignof(T);
+		h.slotCount = poolSize;
+		h.bitmapOffset = bitmapOffset;
+		h.dataOffset = dataOffset;
+		h.highWater = 0;
+		h.firstFree = noSlot;
+		h.numAllocated = 0;
+		memcpy(header, &h, sizeof(h));
+
+		locate();
+		wasCreated = true;
+	}
+
+	/// Maps an existing pool and checks it over, recovering it if need be
+	void open(const std::string& path, size_t bytes)
+	{
+		if (bytes < sizeof(Header))
+			THROW(Exceptions::FileException, path + " is too small to hold a pool");
+
+		map(bytes);
+
+		if (memcmp(header->magic, magic(), sizeof(header->magic)) != 0
+		    || header->version != layoutVersion)
+			THROW(Exceptions::FileException, path + " does not hold a pool");
+
+		if (header->objectSize != sizeof(T) || header->objectAlignment != alignof(T))
+			THROW(Exceptions::FileException, path + " holds a pool of a different type");
+
+		// Make sure the layout fits in the file before we trust any of it.
+		// The offsets could be anything, so check each against the file on its own
+		// before subtracting from it, rather than adding to it and maybe wrapping around.
+		const uint64_t count = header->slotCount;
+		const uint64_t bitmapOffset = header->bitmapOffset;
+		const uint64_t dataOffset = header->dataOffset;
+		if (count > uint64_t(bytes) / sizeof(Slot)
+		    || bitmapOffset < sizeof(Header) || bitmapOffset > bytes
+		    || dataOffset < bitmapOffset || dataOffset > bytes
+		    || PoolBits::wordsFor(count) * sizeof(uint64_t) > dataOffset - bitmapOffset
+		    || dataOffset % alignof(Slot) != 0
+		    || count * sizeof(Slot) > bytes - dataOffset)
+			THROW(Exceptions::FileException, path + " has a corrupt pool header");
+
+		locate();
+
+		if (!header->clean || header->checksum != headerChecksum())
+			recover();
+	}
+
+	void map(size_t bytes)
+	{
+		void* m = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if (m == MAP_FAILED)
+			fail("Could not map the pool's file");
+
+		mapping = m;
+		mappedBytes = bytes;
+		header = static_cast<Header*>(m);
+	}
+
+	/// Finds the bitmap and slots in the mapping
+	void locate()
+	{
+		char* base = static_cast<char*>(mapping);
+		occupied = reinterpret_cast<uint64_t*>(base + header->bitmapOffset);
+		buff = reinterpret_cast<Slot*>(base + header->dataOffset);
+	}
+
+	/**
+	 * \brief Rebuilds the header's bookkeeping from the occupancy bitmap
+	 *
+	 * The high-water mark is put just past the last object, and every free slot below it
+	 * goes on the free list, lowest first. Any object whose construction was cut short
+	 * by a crash was never marked in the bitmap, so its slot is simply reclaimed.
+	 */
+	void recover()
+	{
+		const size_t count = header->slotCount;
+		const size_t last = PoolBits::findLastSet(occupied, count);
+		const size_t highWater = last == count ? 0 : last + 1;
+
+		size_t live = 0;
+		uint64_t* link = &header->firstFree;
+		for (size_t i = 0; i < highWater; ++i) {
+			if (PoolBits::test(occupied, i)) {
+				++live;
+			}
+			else {
+				*link = i;
+				link = &buff[i].next;
+			}
+		}
+		*link = noSlot;
+
+		// Bits past the end of the pool shouldn't be set, but nothing says the file is sane.
+		const size_t words = PoolBits::wordsFor(count);
+		if (count % PoolBits::wordBits != 0)
+			occupied[words - 1] &= (uint64_t(1) << (count % PoolBits::wordBits)) - 1;
+
+		header->highWater = highWater;
+		header->numAllocated = live;
+		wasRecovered = true;
+	}
+
+	/// Returns true if a free list link can be followed, i.e. it is noSlot or an empty slot
+	bool validLink(uint64_t link) const
+	{
+		return link == noSlot || (link < header->slotCount && !PoolBits::test(occupied, link));
+	}
+
+	/// Takes a slot off the free list, or from past the high-water mark
+	uint64_t allocateSlot()
+	{
+		// The checksum only covers the header, so a damaged data page could hold any link.
+		// Rather than follow one out of the pool (or onto an object), rebuild the list from the bitmap.
+		if (!validLink(header->firstFree)
+		    || (header->firstFree != noSlot && !validLink(buff[header->firstFree].next)))
+			recover();
+
+		uint64_t index = header->firstFree;
+		if (index != noSlot) {
+			header->firstFree = buff[index].next;
+		}
+		else {
+			if (header->highWater == header->slotCount)
+				throw std::bad_alloc();
+			index = header->highWater++;
+		}
+
+		++header->numAllocated;
+		return index;
+	}
+
+	/// Puts a slot back on the free list
+	void freeSlot(uint64_t index)
+	{
+		buff[index].next = header->firstFree;
+		header->firstFree = index;
+		--header->numAllocated;
+	}
+
+	int fd; ///< The pool's file
+	void* mapping; ///< Where the file is mapped
+	size_t mappedBytes; ///< The size of the mapping
+	Header* header; ///< The header, at the start of the mapping
+	uint64_t* occupied; ///< The occupancy bitmap, in the mapping
+	Slot* buff; ///< The slots, in the mapping
+	bool wasCreated; ///< True if the file was made by this process
+	bool wasRecovered; ///< True if the file was recovered by this process
+};
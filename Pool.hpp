@@ -2,24 +2,290 @@
 
 #include <exception>
 #include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
 #include <cstdlib>
+#include <iterator>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <set>
 #include <new>
+#include <stdexcept>
 #include <utility>
 #include <type_traits>
-#include <queue>
+#include <typeinfo>
+#include <vector>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+// Forward declaration, which also gives the default alignment
+template <typename T, size_t Alignment = alignof(T)>
+class Pool;
 
 // Forward declaration (this comes after the pool itself)
-template <typename T>
+template <typename T, size_t Alignment = alignof(T)>
 class PoolAllocator;
 
 // Forward declaration (this comes after the pool itself)
-template <typename T>
+template <typename T, size_t Alignment = alignof(T)>
 class PoolIterator;
 
+// Forward declaration (this comes after the pool itself)
+template <typename T, size_t Alignment = alignof(T)>
+class PoolDeleter;
+
+// Forward declaration (this comes after the pool itself)
+template <typename T, size_t Alignment = alignof(T)>
+class PoolSharedPtr;
+
+/// How a Pool gets the memory for its slots
+enum class PoolBacking {
+	heap, ///< Ordinary heap memory from malloc (or posix_memalign for over-aligned slots)
+	hugePages ///< Anonymous memory from mmap, with transparent huge pages requested via madvise
+};
+
+// Forward declaration (see ChunkedPool.hpp)
+template <typename T>
+class ChunkedPool;
+
+// Forward declaration (see NumaPool.hpp)
+template <typename T>
+class NumaPool;
+
+/// Helpers for scanning the occupancy bitmaps used by Pool and friends
+namespace PoolBits {
+
+/// The number of slots tracked by each word of an occupancy bitmap
+static const size_t wordBits = 64;
+
+/// The number of words needed for a bitmap of _bits_ bits
+inline size_t wordsFor(size_t bits) { return (bits + wordBits - 1) / wordBits; }
+
+inline bool test(const uint64_t* words, size_t i)
+{
+	return (words[i / wordBits] >> (i % wordBits)) & 1;
+}
+
+inline void set(uint64_t* words, size_t i) { words[i / wordBits] |= uint64_t(1) << (i % wordBits); }
+
+inline void clear(uint64_t* words, size_t i) { words[i / wordBits] &= ~(uint64_t(1) << (i % wordBits)); }
+
+/**
+ * \brief Finds the first bit at or after _from_ that is set (or clear, if _set_ is false)
+ * \returns The index of that bit, or _limit_ if there is none before _limit_
+ *
+ * Scans a word at a time, so runs of uninteresting bits cost 1/64th of a step each.
+ */
+inline size_t find(const uint64_t* words, size_t from, size_t limit, bool set)
+{
+	if (from >= limit)
+		return limit;
+
+	const uint64_t flip = set ? 0 : ~uint64_t(0);
+	size_t word = from / wordBits;
+	uint64_t w = (words[word] ^ flip) & (~uint64_t(0) << (from % wordBits));
+	const size_t lastWord = (limit - 1) / wordBits;
+
+	while (w == 0) {
+		if (++word > lastWord)
+			return limit;
+		w = words[word] ^ flip;
+	}
+
+	const size_t found = word * wordBits + __builtin_ctzll(w);
+	return found < limit ? found : limit;
+}
+
+/**
+ * \brief Finds the _n_th (starting from 1) set bit at or after _from_
+ * \returns The index of that bit, or _limit_ if there are fewer than _n_ before _limit_
+ *
+ * Whole words are skipped by their population count.
+ */
+inline size_t findNth(const uint64_t* words, size_t from, size_t limit, size_t n)
+{
+	assert(n > 0);
+
+	if (from >= limit)
+		return limit;
+
+	size_t word = from / wordBits;
+	uint64_t w = words[word] & (~uint64_t(0) << (from % wordBits));
+	const size_t lastWord = (limit - 1) / wordBits;
+
+	for (;;) {
+		const size_t count = __builtin_popcountll(w);
+		if (count >= n) {
+			// Knock off the lowest set bits until ours is the lowest
+			for (; n > 1; --n)
+				w &= w - 1;
+
+			const size_t found = word * wordBits + __builtin_ctzll(w);
+			return found < limit ? found : limit;
+		}
+
+		n -= count;
+		if (++word > lastWord)
+			break;
+		w = words[word];
+	}
+
+	return limit;
+}
+
+/**
+ * \brief Finds the last set bit before _limit_
+ * \returns The index of that bit, or _limit_ if there is none
+ */
+inline size_t findLastSet(const uint64_t* words, size_t limit)
+{
+	if (limit == 0)
+		return limit;
+
+	size_t word = (limit - 1) / wordBits;
+	const size_t used = limit - word * wordBits;
+	uint64_t w = words[word];
+	if (used < wordBits)
+		w &= (uint64_t(1) << used) - 1;
+
+	while (w == 0) {
+		if (word-- == 0)
+			return limit;
+		w = words[word];
+	}
+
+	return word * wordBits + (wordBits - 1 - __builtin_clzll(w));
+}
+
+} // end namespace PoolBits
+
+/**
+ * \brief A snapshot of a pool's statistics (see Pool::stats)
+ *
+ * The counters are only kept if MKB_POOL_STATS is defined, and are zero otherwise.
+ * Counts of allocations and deallocations are in slots, so a block of five from
+ * Pool::allocate counts as five.
+ */
+struct PoolStats {
+	size_t capacity; ///< The number of slots in the pool
+	size_t slotSize; ///< The size of each slot, in bytes
+	size_t size; ///< The number of allocated slots
+	size_t largestFreeRun; ///< The largest block that could currently be allocated
+	size_t peakSize; ///< The most slots ever allocated at once
+	size_t allocations; ///< The number of slots allocated
+	size_t deallocations; ///< The number of slots deallocated
+	size_t failedAllocations; ///< The number of allocations that failed for lack of room
+	size_t blockAllocations; ///< The number of multi-slot blocks allocated
+	size_t freeListRefills; ///< The number of times the free list was refilled from the run index
+	size_t runIndexRebuilds; ///< The number of times the free list was folded into the run index
+	size_t rebuildWordsScanned; ///< The number of bitmap words scanned by those rebuilds
+};
+
+/**
+ * \brief Keeps track of every live pool, so that their statistics can be dumped
+ *
+ * With MKB_POOL_STATS defined, each Pool adds itself here when it is constructed
+ * and removes itself when it is destroyed. Without it, the registry is always empty.
+ *
+ * \warning Like pools themselves, reading a pool's statistics isn't thread-safe.
+ *          Adding and removing pools is, but snapshot() and dump() should be called
+ *          while no pool is being modified (between frames, say).
+ */
+class PoolRegistry {
+
+public:
+
+	/// A pool's name and statistics
+	struct Entry {
+		const char* name; ///< The name given to Pool::setName, or the mangled name of T
+		PoolStats stats; ///< The pool's statistics at the time of the snapshot
+	};
+
+	/// A pool's link in the registry. Only Pool should need these.
+	struct Node {
+		Node* prev;
+		Node* next;
+		const void* pool; ///< The pool, to pass to getStats
+		PoolStats (*getStats)(const void*); ///< Gets the pool's statistics
+		const char* name; ///< The pool's name
+
+		Node() : prev(this), next(this), pool(nullptr), getStats(nullptr), name(nullptr) { }
+
+		Node(const Node&) = delete;
+
+		Node& operator=(const Node&) = delete;
+	};
+
+	/// Returns the name and statistics of every live pool, oldest first
+	static std::vector<Entry> snapshot()
+	{
+		std::vector<Entry> entries;
+		std::lock_guard<std::mutex> guard(lock());
+		for (const Node* n = head().next; n != &head(); n = n->next)
+			entries.push_back(Entry{n->name, n->getStats(n->pool)});
+		return entries;
+	}
+
+	/// Prints a table of every live pool's statistics
+	static void dump(FILE* out = stderr)
+	{
+		const std::vector<Entry> entries = snapshot();
+		fprintf(out, "%-32s %10s %10s %10s %10s %12s %12s %8s %8s\n", "pool", "capacity", "size",
+		        "peak", "largest", "allocs", "deallocs", "failed", "rebuilds");
+		for (const Entry& e : entries) {
+			fprintf(out, "%-32s %10zu %10zu %10zu %10zu %12zu %12zu %8zu %8zu\n", e.name,
+			        e.stats.capacity, e.stats.size, e.stats.peakSize, e.stats.largestFreeRun,
+			        e.stats.allocations, e.stats.deallocations, e.stats.failedAllocations,
+			        e.stats.runIndexRebuilds);
+		}
+	}
+
+	/// Adds a pool to the registry
+	static void add(Node* n)
+	{
+		std::lock_guard<std::mutex> guard(lock());
+		n->prev = head().prev;
+		n->next = &head();
+		head().prev->next = n;
+		head().prev = n;
+	}
+
+	/// Removes a pool from the registry
+	static void remove(Node* n)
+	{
+		std::lock_guard<std::mutex> guard(lock());
+		n->prev->next = n->next;
+		n->next->prev = n->prev;
+		n->prev = n->next = n;
+	}
+
+private:
+
+	static std::mutex& lock()
+	{
+		static std::mutex m;
+		return m;
+	}
+
+	/// The sentinel of our (circular) list of pools
+	static Node& head()
+	{
+		static Node h;
+		return h;
+	}
+};
+
 /**
  * \brief Provides a pool of memory from which a given type can be allocated
  * \tparam The type of the contents of the pool
+ * \tparam Alignment The alignment of each slot, which must be a power of two.
+ *         Slots are always aligned to at least alignof(T), but asking for more can be useful,
+ *         e.g. 64 to give each object its own cache line so that objects used by different
+ *         threads don't falsely share one, or 32 for AVX loads and stores.
+ *         Since a slot's size is a multiple of its alignment, this pads the slots too.
  *
  * In situations where objects are frequently allocated and deallocated, using the default
  * "new" and "delete", which are thinly wrapped _malloc_ and _free_ calls, has two main problems:
@@ -42,7 +308,20 @@ class PoolIterator;
  *
  * In order to track which slots in the pool are in use and which aren't,
  * this class stores a singly-linked list of free slots _inside_ the free slots
- * (see the Slot union).
+ * (see the Slot union), along with a bitmap holding one bit per slot.
+ * Slots that have never been used aren't on the list at all. They sit past a
+ * high-water mark and are handed out in order, so constructing a pool doesn't touch
+ * its buffer, and memory is only paged in as the pool fills.
+ * The free list is an unordered stack, so single slots are handed out and
+ * taken back in constant time, while the bitmap lets us iterate over the pool
+ * and catch double frees without caring about the order of the free list.
+ *
+ * Multi-slot blocks (see allocate) don't come from the free list. Free runs of slots are
+ * instead kept in an index sorted both by address (for coalescing neighbors on deallocate)
+ * and by size (for best-fit lookup), both in O(log n).
+ * Single slots freed to the free list aren't coalesced right away. They are folded back into
+ * the index (with a pass over the bitmap) only when a block can't be found otherwise,
+ * and when the free list runs dry, it is refilled with a few slots from the smallest run.
  *
  * At this point, you may be wondering: Isn't there
  * [boost::pool](http://www.boost.org/doc/libs/1_55_0/libs/pool/doc/html/index.html)?
@@ -57,7 +336,7 @@ class PoolIterator;
  *          using a Pool. Several functions perform O(n) verification steps in functions
  *          that are otherwise O(1).
  */
-template <typename T>
+template <typename T, size_t Alignment>
 class Pool {
 
 public:
@@ -65,42 +344,103 @@ public:
 	typedef T value_type;
 
 	/// Provides a quick typedef for the pool's allocator (see PoolAllocator)
-	typedef PoolAllocator<T> allocator;
+	typedef PoolAllocator<T, Alignment> allocator;
 
 	/// Provides a typedef for the unique_ptr returned from Pool functions
-	typedef std::unique_ptr<T, std::function<void(T*)>> unique_ptr;
+	typedef std::unique_ptr<T, PoolDeleter<T, Alignment>> unique_ptr;
+
+	/// Provides a typedef for the shared pointer returned from Pool functions
+	typedef PoolSharedPtr<T, Alignment> shared_ptr;
+
+	typedef PoolIterator<T, Alignment> iterator;
+
+	typedef PoolIterator<const T, Alignment> const_iterator;
+
+	friend class PoolIterator<T, Alignment>;
+	friend class PoolIterator<const T, Alignment>;
+	friend class ChunkedPool<T>;
+	friend class NumaPool<T>;
+	friend class PoolSharedPtr<T, Alignment>;
+
+	/**
+	 * \brief A generational handle to an object in the pool
+	 *
+	 * A raw pointer to a destroyed object can't tell that its slot has since been
+	 * reused by another object. A handle can: it holds the index of its object's slot
+	 * and the slot's _generation_, which the pool bumps every time the slot is freed.
+	 * Pool::resolve returns null for any handle whose generation no longer matches.
+	 *
+	 * The generation is a full 32 bits. Squeezing the whole handle into 32 bits would leave
+	 * only a few bits of generation, which a hot slot (remember the free list is LIFO)
+	 * could wrap around in a matter of frames, bringing stale handles back to life.
+	 */
+	struct Handle {
+		uint32_t index; ///< The index of the object's slot
+		uint32_t generation; ///< The generation of the slot when the handle was made
+
+		/// A null handle, which never resolves to anything
+		Handle() : index(nullIndex), generation(0) { }
+
+		Handle(uint32_t i, uint32_t g) : index(i), generation(g) { }
 
-	typedef PoolIterator<T> iterator;
+		/// Returns true if this is a null handle
+		bool isNull() const { return index == nullIndex; }
 
-	typedef PoolIterator<const T> const_iterator;
+		bool operator==(const Handle& o) const { return index == o.index && generation == o.generation; }
 
-	friend class PoolIterator<T>;
-	friend class PoolIterator<const T>;
+		bool operator!=(const Handle& o) const { return !(*this == o); }
+
+		/// The slot index used by null handles
+		static const uint32_t nullIndex = 0xFFFFFFFF;
+	};
 
 	/**
 	 * \brief Constructs a pool of a given size
 	 * \param poolSize The maximum number of elements this pool will be able to store
-	 * \throws std::bad_alloc if enough memory for the pool cannot be allocated with malloc
+	 * \param backing Where the memory for the slots comes from.
+	 *                Huge pages are worth it for multi-gigabyte pools, which would otherwise
+	 *                spend a lot of time on TLB misses.
+	 * \throws std::bad_alloc if enough memory for the pool cannot be allocated
 	 */
-	Pool(size_t poolSize) :
+	explicit Pool(size_t poolSize, PoolBacking backing = PoolBacking::heap) :
 		buff(nullptr),
+		occupied(nullptr),
+		generations(nullptr),
+		refCounts(nullptr),
 		firstFree(nullptr),
+		runsByStart(),
+		runsBySize(),
+		highWater(0),
 		numSlots(poolSize),
-		numAllocated(0)
+		numAllocated(0),
+		rawSlots(0),
+		backing(backing)
+#ifdef MKB_POOL_STATS
+		, counters()
+		, registryNode()
+#endif
 	{
-		buff = static_cast<Slot*>(malloc(poolSize * sizeof(Slot)));
-		if (buff == nullptr)
+		buff = allocateSlots(poolSize, backing);
+
+		// Everything starts out free, so the bitmap starts out zeroed.
+		occupied = static_cast<uint64_t*>(calloc(PoolBits::wordsFor(poolSize), sizeof(uint64_t)));
+		generations = static_cast<uint32_t*>(calloc(poolSize, sizeof(uint32_t)));
+		if (occupied == nullptr || generations == nullptr) {
+			free(generations);
+			free(occupied);
+			freeSlots(buff, numSlots, backing);
 			throw std::bad_alloc();
+		}
 
-		// Initialize all our slots. Since they all start free,
-		// they will point to the next slot.
-		for (size_t i = 0; i < poolSize; ++i)
-			buff[i].next = &buff[i + 1];
+		// We don't touch the slots themselves. They are all past the high-water mark,
+		// so they will be handed out in order as they are needed.
 
-		// The last slot's next pointer should point to null
-		buff[poolSize - 1].next = nullptr;
-		// The first free slot is our first slot
-		firstFree = &buff[0];
+#ifdef MKB_POOL_STATS
+		registryNode.pool = this;
+		registryNode.getStats = [](const void* p) { return static_cast<const Pool*>(p)->stats(); };
+		registryNode.name = typeid(T).name();
+		PoolRegistry::add(&registryNode);
+#endif
 	}
 
 	/**
@@ -110,21 +450,67 @@ public:
 	 *          std::terminate is called.
 	 *          In the author's opinion, this is much better than soldiering on
 	 *          in some undefined state with dangling pointers.
+	 *          If you just want everything gone, call clear() first.
 	 */
 	~Pool()
 	{
 		// If everything isn't free, we're in undefined territory.
 		// Give up!
-		if (firstFree != buff || size() != 0) {
+		if (size() != 0) {
 			fprintf(stderr, "A pool was destroyed before its elements were freed.\n");
 			std::terminate();
 		}
 
-		free(buff);
+#ifdef MKB_POOL_STATS
+		PoolRegistry::remove(&registryNode);
+#endif
+
+		free(refCounts);
+		free(generations);
+		free(occupied);
+		freeSlots(buff, numSlots, backing);
+	}
+
+	/**
+	 * \brief Gets a snapshot of the pool's statistics
+	 *
+	 * Complexity is O(n), as finding the largest free run scans the occupancy bitmap
+	 */
+	PoolStats stats() const
+	{
+		PoolStats s = PoolStats();
+		s.capacity = numSlots;
+		s.slotSize = sizeof(Slot);
+		s.size = numAllocated;
+		s.largestFreeRun = largestFreeRun();
+#ifdef MKB_POOL_STATS
+		s.peakSize = counters.peakSize;
+		s.allocations = counters.allocations;
+		s.deallocations = counters.deallocations;
+		s.failedAllocations = counters.failedAllocations;
+		s.blockAllocations = counters.blockAllocations;
+		s.freeListRefills = counters.freeListRefills;
+		s.runIndexRebuilds = counters.runIndexRebuilds;
+		s.rebuildWordsScanned = counters.rebuildWordsScanned;
+#endif
+		return s;
+	}
+
+	/**
+	 * \brief Names the pool in PoolRegistry's output (by default, the mangled name of T is used)
+	 * \param name The name, which must outlive the pool (a string literal, say)
+	 */
+	void setName(const char* name)
+	{
+#ifdef MKB_POOL_STATS
+		registryNode.name = name;
+#else
+		(void)name;
+#endif
 	}
 
 	/// A convenience function to get an allocator for this pool
-	PoolAllocator<T> getAllocator() { return PoolAllocator<T>(*this); }
+	allocator getAllocator() { return allocator(*this); }
 
 	/**
 	 * \brief Gets the number of free slots
@@ -135,11 +521,16 @@ public:
 	size_t remaining() const
 	{
 #ifndef NDEBUG
-		// Just walk the free list until we hit null
+		// Walk the free list until we hit null...
 		size_t check = 0;
 		for (Slot* curr = firstFree; curr != nullptr; curr = curr->next)
 			++check;
 
+		// ...and add up the free runs and the slots we haven't touched yet
+		for (const auto& run : runsByStart)
+			check += run.second;
+		check += numSlots - highWater;
+
 		assert(check == numSlots - numAllocated);
 #endif
 		return numSlots - numAllocated;
@@ -173,103 +564,128 @@ public:
 	 */
 	bool full() const { return numAllocated == numSlots; }
 
+	/**
+	 * \brief Returns the length of the longest run of free slots,
+	 *        i.e. the largest block allocate could currently return
+	 *
+	 * Complexity is O(n), as this scans the occupancy bitmap
+	 */
+	size_t largestFreeRun() const
+	{
+		size_t largest = 0;
+		for (size_t i = PoolBits::find(occupied, 0, numSlots, false); i < numSlots;) {
+			const size_t runEnd = PoolBits::find(occupied, i, numSlots, true);
+			if (runEnd - i > largest)
+				largest = runEnd - i;
+			i = PoolBits::find(occupied, runEnd, numSlots, false);
+		}
+		return largest;
+	}
+
+	/**
+	 * \brief Returns true if the given pointer points to a slot in this pool
+	 * \warning This does not check if the slot is allocated.
+	 *
+	 * Complexity is O(1)
+	 */
+	bool owns(const T* p) const { return isValidPointer(reinterpret_cast<const Slot*>(p)); }
+
 	/**
 	 * \brief Allocates (but does not construct)
 	 *        _num_ contiguous objects and returns a pointer to the first one
 	 * \param num The number of contiguous objects to allocate from the pool
 	 * \throws std::bad_alloc if there is not enough space for _num_ congituous objects
 	 *         anywhere in the pool
-	 * \todo This could be optimized for the case where we are allocating
-	 *       a single slot.
 	 *
-	 * Allocation is done by best-fit, and, in the case of a tie,
+	 * Allocation is done by best-fit among the indexed free runs, and, in the case of a tie,
 	 * by whatever block is first in the pool.
+	 * A single slot is simply taken from the head of the free list.
+	 *
+	 * The never-used slots past the high-water mark count as one more run.
 	 *
-	 * Complexity is O(n), as we must search for free blocks via the
-	 * free list.
+	 * Complexity is O(1) for a single slot and O(log n) otherwise.
+	 * If no run is big enough, slots on the free list are folded into the index
+	 * first, which costs a pass over the occupancy bitmap.
+	 *
+	 * Allocating zero objects returns a pointer that must not be dereferenced
+	 * (but can be passed back to deallocate) and takes nothing from the pool.
 	 *
 	 * This function is mainly intneded for use with a PoolAllocator
 	 * and probably shouldn't be used raw.
 	 */
 	T* allocate(size_t num)
 	{
-		// A potential block to allocate
-		struct Block {
-			// The start of the block
-			Slot* start;
-			// The number of slots in the block
-			size_t size;
-			// A pointer to the "next free" pointer pointing to this block.
-			// Useful so that we can update it if this block is used.
-			Slot** previous;
-
-			Block(Slot* st, size_t sz, Slot** prev) : start(st), size(sz), previous(prev) { }
-		};
-
-		// Provides ordering for the priority queue of which block to pick.
-		const auto calcFit = [num](const Block& b1, const Block& b2) {
-			// We shouldn't have blocks that don't fit our needed amount in the queue
-			assert(b1.size >= num);
-			assert(b2.size >= num);
-			const int n = (int)num;
-			const int b1n = (int)b1.size;
-			const int b2n = (int)b2.size;
-			const int a1 = abs(b1n - n);
-			const int a2 = abs(b2n - n);
-			if (a1 == a2)
-				return b1.start > b2.start; // If these are the same fit, prefer the one closer to the start
-			else
-				return  a1 > a2; // Sort by best fit
-		};
-
-		// By using a priority queue with calcFit, we get a best-fit algorithm.
-		std::priority_queue<Block, std::vector<Block>, decltype(calcFit)> bestFitter(calcFit);
-
-		// Iterate through our free list, finding contiguous chunks
-		Slot** curr = &firstFree;
-		std::pair<size_t, Slot**> countInfo = getContiguousCount(*curr);
-		for (; *curr != nullptr; curr = countInfo.second, countInfo = getContiguousCount(*curr)) {
-			// If a chunk can fit our needed size, throw it in the priority queue.
-			if (countInfo.first >= num)
-				bestFitter.emplace(*curr, countInfo.first, curr);
-		}
-
-		// We didn't find any block that could meet our request.
-		if (bestFitter.empty())
-			throw std::bad_alloc();
+		// Don't let an empty block anywhere near the run index.
+		if (num == 0)
+			return reinterpret_cast<T*>(buff);
+
+		if (num == 1) {
+			T* ret = reinterpret_cast<T*>(allocateSlot());
+			++rawSlots;
+			return ret;
+		}
 
-		numAllocated += num;
+		// Find the smallest run that fits, preferring the one closest to the start.
+		auto fit = runsBySize.lower_bound(std::make_pair(num, size_t(0)));
+
+		// If nothing fits, some of the free list might be adjacent to an indexed run,
+		// or to each other. Coalesce everything and try again.
+		if (fit == runsBySize.end() && numSlots - highWater < num && firstFree != nullptr) {
+			rebuildRuns();
+			fit = runsBySize.lower_bound(std::make_pair(num, size_t(0)));
+		}
+
+		// The untouched tail is past every indexed run,
+		// so it only wins if it is a strictly better fit.
+		const size_t tail = numSlots - highWater;
+		size_t start;
+		if (fit != runsBySize.end() && (tail < num || fit->first <= tail)) {
+			start = fit->second;
+			takeFromRun(runsByStart.find(start), num);
+		}
+		else if (tail >= num) {
+			start = highWater;
+			highWater += num;
+		}
+		else {
+			// We didn't find any block that could meet our request.
+			countFailure();
+			throw std::bad_alloc();
+		}
 
-		// The top of the priority queue gives us our best fit.
-		const auto best = bestFitter.top();
+		for (size_t i = start; i < start + num; ++i)
+			PoolBits::set(occupied, i);
 
-		// Set our previous "next free" pointer to
-		// the next pointer at the end of this block,
-		// effectively skipping this block
-		*best.previous = best.start[num - 1].next;
+		numAllocated += num;
+		rawSlots += num;
+		countAllocations(num);
+#ifdef MKB_POOL_STATS
+		++counters.blockAllocations;
+#endif
 
-		return reinterpret_cast<T*>(best.start); // Return our best fit block
+		return reinterpret_cast<T*>(buff + start); // Return our best fit block
 	}
 
 	/**
 	 * \brief Deallocates _num_ contiguous objects staritng at the given address
 	 * \param allocated A pointer to the block of objects to deallocate
 	 * \param num The number of contiguous objects to deallocate from the pool
-	 * \warning Some verification is done to make sure that _allocated_ is
-	 *          a valid pointer to a slot in the pool, but none is made
-	 *          to ensure that this block was actually allocated, as doing so
-	 *          would be inconveniently expensive.
-	 * \todo This could be optimized for the case where we are deallocating
-	 *       a single slot.
+	 * \throws std::invalid_argument if _allocated_ is not a valid pointer to a slot in the pool
+	 * \throws std::logic_error if any slot in the block is not currently allocated
 	 *
-	 * Complexity is O(n), as we must iterate through the free list
-	 * and update it.
+	 * Complexity is O(num + log n), as each slot is checked against the occupancy bitmap
+	 * before the block is merged with its free neighbors in the run index.
+	 * A single slot is pushed onto the free list, just like destroy.
+	 * Deallocating zero objects does nothing.
 	 *
 	 * This function is mainly intneded for use with a PoolAllocator
 	 * and probably shouldn't be used raw.
 	 */
 	void deallocate(T* allocated, size_t num)
 	{
+		if (num == 0)
+			return;
+
 		// We can do this since a Slot
 		Slot* blockStart = reinterpret_cast<Slot*>(allocated);
 
@@ -277,38 +693,42 @@ public:
 		if (!isValidPointer(blockStart))
 			throw std::invalid_argument("The provided pointer is not valid");
 
-		// If the original author sucks at indirection and you can eliminate
-		// some of the corner cases below, go nuts.
+		const size_t first = blockStart - buff;
+		if (first + num > numSlots)
+			throw std::invalid_argument("The provided block runs past the end of the pool");
 
-		// This will be our first free node
-		if (firstFree == nullptr) {
-			blockStart[num - 1].next = nullptr;
-			firstFree = blockStart;
+		// Check the whole block before we touch anything.
+		for (size_t i = first; i < first + num; ++i) {
+			if (!PoolBits::test(occupied, i))
+				throw std::logic_error("Double deallocate detected");
 		}
-		// The slot comes before our previously first free slot
-		else if (blockStart < firstFree) {
-			blockStart[num - 1].next = firstFree;
-			firstFree = blockStart;
+
+		if (num == 1) {
+			deallocateSlot(blockStart);
+			--rawSlots;
+			return;
 		}
-		// Walk the free list, inserting this block in the correct place
-		else {
-			Slot** curr = &firstFree;
-			while ((*curr)->next != nullptr && (*curr)->next < blockStart) {
-				curr = &(*curr)->next;
-			}
-			if ((*curr)->next == blockStart) {
-				throw std::logic_error("Double deallocate detected");
-			}
 
-			blockStart[num - 1].next = (*curr)->next;
-			(*curr)->next = blockStart;
+		for (size_t i = first; i < first + num; ++i) {
+			PoolBits::clear(occupied, i);
+			++generations[i];
 		}
 
-		// Set up the block's "next free" pointers
-		for (size_t i = 0; i < num - 1; ++i)
-			blockStart[i].next = &blockStart[i + 1];
+		try {
+			addRun(first, num);
+		}
+		catch (const std::bad_alloc&) {
+			// We couldn't grow the index. Just put the block on the free list instead,
+			// in reverse so that it comes off the free list in order.
+			for (size_t i = first + num; i-- > first;) {
+				buff[i].next = firstFree;
+				firstFree = &buff[i];
+			}
+		}
 
 		numAllocated -= num;
+		rawSlots -= num;
+		countDeallocations(num);
 	}
 
 
@@ -322,8 +742,16 @@ public:
 	template <typename... Args>
 	T* construct(Args&&... args)
 	{
-		T* ret = allocate(1);
-		::new (ret) T(std::forward<Args>(args)...);
+		Slot* slot = allocateSlot();
+		T* ret = reinterpret_cast<T*>(slot);
+
+		try {
+			::new (ret) T(std::forward<Args>(args)...);
+		}
+		catch (...) {
+			deallocateSlot(slot);
+			throw;
+		}
 
 		return ret;
 	}
@@ -333,11 +761,17 @@ public:
 	 * \param args Variadic template magic that forwards whatever aruments that you would pass
 	 *             to a constructor of T.
 	 * \returns a pointer to a T, allocated from the pool then constructed,
-	 *          or null if there is no room in the Pool
+	 *          or null if there is no room in the Pool or T's constructor throws std::bad_alloc
 	 */
 	template <typename... Args>
 	T* tryConstruct(Args&&... args)
 	{
+		// Check for room up front so that a full pool doesn't cost us a throw and catch.
+		if (full()) {
+			countFailure();
+			return nullptr;
+		}
+
 		try {
 			return construct(std::forward<Args>(args)...);
 		}
@@ -351,15 +785,29 @@ public:
 	template <typename... Args>
 	unique_ptr constructUnique(Args&&... args)
 	{
-		return unique_ptr(construct(std::forward<Args>(args)...), [this](T* t) { destroy(t); });
+		return unique_ptr(construct(std::forward<Args>(args)...), PoolDeleter<T, Alignment>(*this));
 	}
 
-	/// Acts as the same manner as construct, but returns a std::shared_ptr
-	/// that destroys the object automatically when all shared pointers to this object falls out of scope
+	/**
+	 * \brief Acts as the same manner as construct, but returns a shared pointer
+	 *        that destroys the object automatically when all shared pointers to this object
+	 *        fall out of scope
+	 * \see PoolSharedPtr
+	 */
 	template <typename... Args>
-	std::shared_ptr<T> constructShared(Args&&... args)
+	shared_ptr constructShared(Args&&... args)
 	{
-		return std::shared_ptr<T>(construct(std::forward<Args>(args)...), [this](T* t) { destroy(t); });
+		// Reference counts are only needed if someone uses shared pointers,
+		// so don't pay for them until then.
+		if (refCounts == nullptr) {
+			refCounts = static_cast<uint32_t*>(calloc(numSlots, sizeof(uint32_t)));
+			if (refCounts == nullptr)
+				throw std::bad_alloc();
+		}
+
+		T* t = construct(std::forward<Args>(args)...);
+		refCounts[reinterpret_cast<Slot*>(t) - buff] = 1;
+		return shared_ptr(t, this);
 	}
 
 
@@ -367,9 +815,288 @@ public:
 	/// or _tryConstruct_
 	void destroy(T* toRelease)
 	{
+		Slot* slot = reinterpret_cast<Slot*>(toRelease);
+
+		if (!isValidPointer(slot))
+			throw std::invalid_argument("The provided pointer is not valid");
+
+		// Check this before we run a destructor on a dead object
+		if (!PoolBits::test(occupied, slot - buff))
+			throw std::logic_error("Double deallocate detected");
+
 		toRelease->~T(); // Call its destructor
 
-		deallocate(toRelease, 1);
+		deallocateSlot(slot);
+	}
+
+	/**
+	 * \brief Constructs _count_ objects at once
+	 * \param count The number of objects to construct
+	 * \param out An output iterator, to which a pointer to each new object is written
+	 * \param args Arguments passed to the constructor of every new object.
+	 *             Since they are used repeatedly, they are not forwarded.
+	 * \returns _out_, advanced past the last pointer written
+	 * \throws std::bad_alloc if there is not room for all _count_ objects,
+	 *         in which case nothing is constructed.
+	 *
+	 * This checks for room once, then pops and constructs slots in one tight loop.
+	 * If a constructor throws, its slot is returned to the pool, but objects constructed
+	 * before it stay alive (their pointers were already written to _out_),
+	 * and are the caller's to destroy.
+	 *
+	 * Complexity is O(count)
+	 */
+	template <typename OutputIt, typename... Args>
+	OutputIt constructN(size_t count, OutputIt out, const Args&... args)
+	{
+		if (count > numSlots - numAllocated) {
+			countFailure();
+			throw std::bad_alloc();
+		}
+
+		for (size_t i = 0; i < count; ++i) {
+			Slot* slot = allocateSlot();
+			T* t = reinterpret_cast<T*>(slot);
+
+			try {
+				::new (t) T(args...);
+			}
+			catch (...) {
+				deallocateSlot(slot);
+				throw;
+			}
+
+			*out = t;
+			++out;
+		}
+
+		return out;
+	}
+
+	/**
+	 * \brief Destroys every object in a range of pointers to objects from this pool
+	 * \throws std::invalid_argument or std::logic_error as destroy() does,
+	 *         in which case the objects before the offending one have been destroyed.
+	 *
+	 * Complexity is O(number of objects)
+	 */
+	template <typename InputIt>
+	void destroyAll(InputIt first, InputIt last)
+	{
+		for (; first != last; ++first) {
+			T* t = *first;
+			Slot* slot = reinterpret_cast<Slot*>(t);
+			if (!isValidPointer(slot))
+				throw std::invalid_argument("The provided pointer is not valid");
+
+			const size_t index = slot - buff;
+			if (!PoolBits::test(occupied, index))
+				throw std::logic_error("Double deallocate detected");
+
+			t->~T();
+
+			PoolBits::clear(occupied, index);
+			++generations[index];
+			slot->next = firstFree;
+			firstFree = slot;
+			--numAllocated;
+			countDeallocations(1);
+		}
+	}
+
+	/// Destroys every object in a container (or any other range) of pointers
+	/// to objects from this pool (see destroyAll(InputIt, InputIt))
+	template <typename Range>
+	void destroyAll(const Range& r) { destroyAll(std::begin(r), std::end(r)); }
+
+	/**
+	 * \brief Destroys every object in the pool
+	 *
+	 * This visits each live object with a single pass over the occupancy bitmap
+	 * (skipping it entirely if T is trivially destructible),
+	 * then forgets the free list and moves the high-water mark back to the start,
+	 * so the pool ends up just like a new one
+	 * (save for its generations, which are bumped so that any outstanding handles go stale).
+	 * Use this to reset a pool between frames or steps.
+	 *
+	 * \warning Any outstanding pointers to objects in the pool, smart or not, are left dangling.
+	 *
+	 * Complexity is O(pool size)
+	 */
+	void clear()
+	{
+		const size_t words = PoolBits::wordsFor(numSlots);
+		for (size_t w = 0; w < words; ++w) {
+			for (uint64_t bits = occupied[w]; bits != 0; bits &= bits - 1) {
+				const size_t index = w * PoolBits::wordBits + __builtin_ctzll(bits);
+				if (!std::is_trivially_destructible<T>::value)
+					buff[index].data.~T();
+				++generations[index];
+			}
+			occupied[w] = 0;
+		}
+
+		runsByStart.clear();
+		runsBySize.clear();
+		firstFree = nullptr;
+		highWater = 0;
+		countDeallocations(numAllocated);
+		numAllocated = 0;
+		rawSlots = 0;
+	}
+
+	/// What Pool::compact tells its callback about each object it moves
+	struct Relocation {
+		T* from; ///< Where the object was. This no longer holds an object.
+		T* to; ///< Where the object is now
+		Handle oldHandle; ///< The handle the object had, which is now stale
+		Handle newHandle; ///< The handle the object has now
+	};
+
+	/**
+	 * \brief Moves every object to the front of the pool, so that they are contiguous
+	 * \param relocated Called as `relocated(r)` with a const Relocation& for each object moved,
+	 *                  right after it is moved, so that owners can fix up their pointers
+	 *                  or handles. The object has already been moved by then,
+	 *                  so its new home should be used.
+	 * \param releaseTail If true, the pages past the last object are returned to the
+	 *                    operating system. They will be faulted back in as they are used.
+	 * \returns The number of objects moved
+	 * \throws std::logic_error if any slots came from allocate() (blocks of raw memory can't
+	 *         be moved) or are owned by a PoolSharedPtr (which can't be told about the move)
+	 * \throws Whatever T's move constructor or _relocated_ throws. The objects moved so far
+	 *         stay moved, and the pool is otherwise left as it was.
+	 *
+	 * Objects are taken from the back of the pool and move-constructed (or copied, if their
+	 * move constructor could throw and they can be copied) into the free slot closest
+	 * to the front, then the original is destroyed. Objects already at the front stay put.
+	 * Afterwards, the pool's objects are in its first size() slots, and new objects go
+	 * after them, so iteration no longer has to skip over holes.
+	 *
+	 * Handles to moved objects go stale, just as if the object had been destroyed:
+	 * they resolve to null, never to some other object.
+	 *
+	 * Complexity is O(highest slot used / 64 + objects moved)
+	 */
+	template <typename Relocate>
+	size_t compact(Relocate&& relocated, bool releaseTail = false)
+	{
+		if (rawSlots != 0)
+			throw std::logic_error("Blocks from allocate() can't be moved by compact()");
+
+		if (refCounts != nullptr) {
+			for (size_t i = PoolBits::find(occupied, 0, highWater, true); i < highWater;
+			     i = PoolBits::find(occupied, i + 1, highWater, true)) {
+				if (refCounts[i] != 0)
+					throw std::logic_error("Objects owned by a PoolSharedPtr can't be moved by compact()");
+			}
+		}
+
+		// Every free slot below the high-water mark will either be filled or end up past it,
+		// so the free list and run index go away, and free slots are found with the bitmap.
+		firstFree = nullptr;
+		runsByStart.clear();
+		runsBySize.clear();
+
+		size_t moved = 0;
+		size_t to = 0;
+		size_t from = highWater;
+		try {
+			for (;;) {
+				to = PoolBits::find(occupied, to, highWater, false);
+				from = PoolBits::findLastSet(occupied, from);
+				if (from == highWater || from < to)
+					break;
+
+				T* src = reinterpret_cast<T*>(buff + from);
+				T* dst = reinterpret_cast<T*>(buff + to);
+				::new (dst) T(std::move_if_noexcept(*src));
+				src->~T();
+
+				PoolBits::set(occupied, to);
+				PoolBits::clear(occupied, from);
+				Relocation r = {src, dst, handleAt(from), handleAt(to)};
+				++generations[from];
+				++moved;
+
+				relocated(static_cast<const Relocation&>(r));
+			}
+		}
+		catch (...) {
+			threadFreeSlots();
+			throw;
+		}
+
+		highWater = numAllocated;
+
+		if (releaseTail)
+			releasePastHighWater();
+
+		return moved;
+	}
+
+	/// Acts in the same manner as construct, but returns a Handle to the new object
+	template <typename... Args>
+	Handle constructHandle(Args&&... args)
+	{
+		return handleOf(construct(std::forward<Args>(args)...));
+	}
+
+	/**
+	 * \brief Destroys then deallocates the object a handle refers to
+	 * \throws std::logic_error if the handle is stale (or null)
+	 */
+	void destroy(Handle h)
+	{
+		T* t = resolve(h);
+		if (t == nullptr)
+			throw std::logic_error("Destroy of a stale handle detected");
+
+		destroy(t);
+	}
+
+	/**
+	 * \brief Gets a handle to an allocated object in the pool
+	 * \throws std::invalid_argument if the pointer does not point to an allocated object
+	 *         in the pool
+	 *
+	 * Complexity is O(1)
+	 */
+	Handle handleOf(const T* t) const
+	{
+		const Slot* s = reinterpret_cast<const Slot*>(t);
+		if (!isValidPointer(s) || !PoolBits::test(occupied, s - buff))
+			throw std::invalid_argument("The provided pointer is not valid");
+
+		const size_t index = s - buff;
+		if (index >= Handle::nullIndex)
+			throw std::invalid_argument("The object is too far into the pool to have a handle");
+
+		return Handle((uint32_t)index, generations[index]);
+	}
+
+	/**
+	 * \brief Gets the object a handle refers to
+	 * \returns The object, or null if the handle is null or stale
+	 *          (i.e. its object has been destroyed, even if its slot has since been reused)
+	 *
+	 * Complexity is O(1)
+	 */
+	T* resolve(Handle h)
+	{
+		return const_cast<T*>(static_cast<const Pool*>(this)->resolve(h));
+	}
+
+	/// \copydoc resolve(Handle)
+	const T* resolve(Handle h) const
+	{
+		if (h.isNull()
+		    || h.index >= numSlots
+		    || generations[h.index] != h.generation
+		    || !PoolBits::test(occupied, h.index))
+			return nullptr;
+
+		return reinterpret_cast<const T*>(buff + h.index);
 	}
 
 	iterator begin() { return iterator(*this); }
@@ -378,11 +1105,52 @@ public:
 
 	const_iterator cbegin() const { return const_iterator(*this); }
 
-	iterator end() { return iterator(buff + numSlots); }
+	iterator end() { return iterator(*this, numSlots); }
+
+	const_iterator end() const { return const_iterator(*this, numSlots); }
+
+	const_iterator cend() const { return const_iterator(*this, numSlots); }
+
+	/**
+	 * \brief Returns one past the highest slot that has been used since the pool
+	 *        was constructed or cleared. Every slot at or past this is free.
+	 *
+	 * Complexity is O(1)
+	 */
+	size_t highWaterMark() const { return highWater; }
+
+	/**
+	 * \brief Calls _fn_ on each object in slots [_first_, _last_), in order of address
+	 *
+	 * Unlike iterators, slot ranges can be handed out without walking the pool,
+	 * so this is how the pool is split between threads (see parallelForEach).
+	 * Ranges that don't share a word of the occupancy bitmap (i.e. that are split at
+	 * multiples of 64 slots) can be visited by different threads at once.
+	 *
+	 * Complexity is O((last - first) / 64 + number of objects visited)
+	 */
+	template <typename Fn>
+	void forEachInSlots(size_t first, size_t last, Fn&& fn)
+	{
+		if (last > highWater)
+			last = highWater;
+
+		for (size_t i = PoolBits::find(occupied, first, last, true); i < last;
+		     i = PoolBits::find(occupied, i + 1, last, true))
+			fn(*reinterpret_cast<T*>(buff + i));
+	}
 
-	const_iterator end() const { return const_iterator(buff + numSlots); }
+	/// \copydoc forEachInSlots
+	template <typename Fn>
+	void forEachInSlots(size_t first, size_t last, Fn&& fn) const
+	{
+		if (last > highWater)
+			last = highWater;
 
-	const_iterator cend() const { return const_iterator(buff + numSlots); }
+		for (size_t i = PoolBits::find(occupied, first, last, true); i < last;
+		     i = PoolBits::find(occupied, i + 1, last, true))
+			fn(*reinterpret_cast<const T*>(buff + i));
+	}
 
 	// No copy or assign
 
@@ -396,44 +1164,377 @@ public:
 
 private:
 
+	static_assert(Alignment != 0 && (Alignment & (Alignment - 1)) == 0,
+	              "Pool alignment must be a power of two");
+
+	/// The alignment of each slot: what was asked for, but at least what T and Slot::next need
+	static constexpr size_t slotAlignment =
+		Alignment > alignof(T)
+			? (Alignment > alignof(void*) ? Alignment : alignof(void*))
+			: (alignof(T) > alignof(void*) ? alignof(T) : alignof(void*));
+
+	/// The size of the pages we ask for with PoolBacking::hugePages
+	static const size_t hugePageSize = 2 * 1024 * 1024;
+
 	/// A slot in our pool.
 	/// We use this union so that we can hold a pointer to the next free slot
 	/// when the slot is not in use
-	union Slot {
+	union alignas(slotAlignment) Slot {
 		T data; ///< The allocated data in the slot, or alternatively...
 		Slot* next; ///< ...A pointer to the next free slot
 	};
 
+	/// Free runs in the index, mapping each run's first slot to its length
+	typedef std::map<size_t, size_t> RunMap;
+
+	/// The number of slots moved from the run index to the free list when it runs dry
+	static const size_t refillCount = 64;
+
+	/**
+	 * \brief Pops a single slot off the head of the free list
+	 * \throws std::bad_alloc if the pool is full
+	 *
+	 * If the free list is empty, we refill it from the run index,
+	 * and failing that, take the next slot past the high-water mark.
+	 *
+	 * Complexity is O(1), or O(log n) to refill the free list from the run index
+	 */
+	Slot* allocateSlot()
+	{
+		Slot* ret;
+		if (firstFree == nullptr && runsBySize.empty()) {
+			if (highWater == numSlots) {
+				countFailure();
+				throw std::bad_alloc();
+			}
+
+			ret = &buff[highWater++];
+		}
+		else {
+			if (firstFree == nullptr)
+				refillFreeList();
+
+			ret = firstFree;
+			firstFree = ret->next;
+		}
+
+		PoolBits::set(occupied, ret - buff);
+		++numAllocated;
+		countAllocations(1);
+		return ret;
+	}
+
 	/**
-	 * \brief Gets the number of contiguous slots start
-	 * \param s The first free slot in a possible group of contiguous slots
-	 * \returns The number of contiguous slots, starting at the given slot,
-	 *          and the next free pointer after this current slot,
-	 *          or 0 and null if null is given as an input
-	 * \warning This function assumes that the pointer it is passed is free.
+	 * \brief Pushes a single slot onto the head of the free list
+	 * \param s The slot to free, which must be a valid pointer
+	 * \throws std::logic_error if the slot is not currently allocated
+	 *
+	 * Complexity is O(1)
 	 */
-	std::pair<size_t, Slot**> getContiguousCount(Slot* s) const
+	void deallocateSlot(Slot* s)
 	{
-		if (s == nullptr)
-			return std::pair<size_t, Slot**>(0, nullptr);
 		assert(isValidPointer(s));
-		size_t contig = 1;
-		while (s->next == s + 1) {
-			++contig;
-			++s;
+
+		const size_t index = s - buff;
+		if (!PoolBits::test(occupied, index))
+			throw std::logic_error("Double deallocate detected");
+
+		PoolBits::clear(occupied, index);
+		++generations[index];
+		s->next = firstFree;
+		firstFree = s;
+		--numAllocated;
+		countDeallocations(1);
+	}
+
+	/**
+	 * \brief Moves a few slots from the smallest free run onto the free list
+	 * \throws std::bad_alloc if there are no free runs
+	 *
+	 * Taking from the smallest run fills in small holes and leaves the big runs
+	 * for multi-slot blocks. Slots are taken from the front of the run and pushed in reverse,
+	 * so they come off the free list in order.
+	 */
+	void refillFreeList()
+	{
+		if (runsBySize.empty())
+			throw std::bad_alloc();
+
+		const size_t start = runsBySize.begin()->second;
+		const size_t length = runsBySize.begin()->first;
+		const size_t count = length < refillCount ? length : refillCount;
+		takeFromRun(runsByStart.find(start), count);
+#ifdef MKB_POOL_STATS
+		++counters.freeListRefills;
+#endif
+
+		for (size_t i = start + count; i-- > start;) {
+			buff[i].next = firstFree;
+			firstFree = &buff[i];
+		}
+	}
+
+	/**
+	 * \brief Removes _count_ slots from the front of a free run in the index
+	 * \throws std::bad_alloc if the index cannot allocate room for the rest of the run,
+	 *         in which case nothing is changed
+	 */
+	void takeFromRun(RunMap::iterator run, size_t count)
+	{
+		const size_t start = run->first;
+		const size_t length = run->second;
+		assert(count <= length);
+
+		// Add what's left before removing anything, since adding can throw.
+		if (count < length) {
+			runsBySize.emplace(length - count, start + count);
+			try {
+				runsByStart.emplace_hint(std::next(run), start + count, length - count);
+			}
+			catch (...) {
+				runsBySize.erase(std::make_pair(length - count, start + count));
+				throw;
+			}
+		}
+
+		runsBySize.erase(std::make_pair(length, start));
+		runsByStart.erase(run);
+	}
+
+	/**
+	 * \brief Adds a free run to the index, merging it with any adjacent runs
+	 * \throws std::bad_alloc if the index cannot allocate room for the run,
+	 *         in which case nothing is changed
+	 *
+	 * A run that reaches the high-water mark (along with any run before it)
+	 * just moves the mark back instead of going in the index.
+	 *
+	 * Complexity is O(log n)
+	 */
+	void addRun(size_t start, size_t length)
+	{
+		const RunMap::iterator after = runsByStart.lower_bound(start);
+
+		if (start + length == highWater) {
+			highWater = start;
+			if (after != runsByStart.begin()) {
+				const RunMap::iterator before = std::prev(after);
+				if (before->first + before->second == start) {
+					highWater = before->first;
+					runsBySize.erase(std::make_pair(before->second, before->first));
+					runsByStart.erase(before);
+				}
+			}
+			return;
+		}
+
+		const RunMap::iterator right =
+			(after != runsByStart.end() && after->first == start + length) ? after : runsByStart.end();
+
+		RunMap::iterator left = runsByStart.end();
+		if (after != runsByStart.begin()) {
+			const RunMap::iterator before = std::prev(after);
+			if (before->first + before->second == start)
+				left = before;
+		}
+
+		const size_t mergedStart = left != runsByStart.end() ? left->first : start;
+		const size_t mergedLength = length
+			+ (left != runsByStart.end() ? left->second : 0)
+			+ (right != runsByStart.end() ? right->second : 0);
+
+		// Add the merged run before removing anything, since adding can throw.
+		runsBySize.emplace(mergedLength, mergedStart);
+		if (left != runsByStart.end()) {
+			runsBySize.erase(std::make_pair(left->second, left->first));
+			left->second = mergedLength;
+		}
+		else {
+			try {
+				runsByStart.emplace_hint(after, start, mergedLength);
+			}
+			catch (...) {
+				runsBySize.erase(std::make_pair(mergedLength, mergedStart));
+				throw;
+			}
+		}
+
+		if (right != runsByStart.end()) {
+			runsBySize.erase(std::make_pair(right->second, right->first));
+			runsByStart.erase(right);
+		}
+	}
+
+	/// Returns the handle for the object in a given slot, or a null one if it is too far in
+	Handle handleAt(size_t index) const
+	{
+		return index < Handle::nullIndex ? Handle((uint32_t)index, generations[index]) : Handle();
+	}
+
+	/**
+	 * \brief Puts every free slot below the high-water mark on the free list, lowest first
+	 *
+	 * Unlike rebuildRuns, this can't fail, so it is used to put things back together
+	 * when compact is interrupted by an exception.
+	 */
+	void threadFreeSlots()
+	{
+		Slot** link = &firstFree;
+		for (size_t i = PoolBits::find(occupied, 0, highWater, false); i < highWater;
+		     i = PoolBits::find(occupied, i + 1, highWater, false)) {
+			*link = &buff[i];
+			link = &buff[i].next;
 		}
+		*link = nullptr;
+	}
 
-		return std::pair<size_t, Slot**>(contig, &s->next);
+	/// Hands the whole pages past the high-water mark back to the operating system
+	void releasePastHighWater()
+	{
+		const uintptr_t pageSize = sysconf(_SC_PAGESIZE);
+		const uintptr_t first = ((uintptr_t)(buff + highWater) + pageSize - 1) & ~(pageSize - 1);
+		const uintptr_t last = (uintptr_t)(buff + numSlots) & ~(pageSize - 1);
+
+		// This is only advice, so there is nothing to do if it fails.
+		if (first < last)
+			madvise((void*)first, last - first, MADV_DONTNEED);
+	}
+
+	/// Records that _num_ slots were allocated (a no-op without MKB_POOL_STATS)
+	void countAllocations(size_t num)
+	{
+#ifdef MKB_POOL_STATS
+		counters.allocations += num;
+		if (numAllocated > counters.peakSize)
+			counters.peakSize = numAllocated;
+#else
+		(void)num;
+#endif
+	}
+
+	/// Records that _num_ slots were deallocated (a no-op without MKB_POOL_STATS)
+	void countDeallocations(size_t num)
+	{
+#ifdef MKB_POOL_STATS
+		counters.deallocations += num;
+#else
+		(void)num;
+#endif
+	}
+
+	/// Records an allocation that failed for lack of room (a no-op without MKB_POOL_STATS)
+	void countFailure()
+	{
+#ifdef MKB_POOL_STATS
+		++counters.failedAllocations;
+#endif
+	}
+
+	/**
+	 * \brief Rebuilds the run index from the occupancy bitmap,
+	 *        moving everything on the free list into it
+	 * \throws std::bad_alloc if the index cannot be allocated, in which case nothing is changed
+	 *
+	 * Complexity is O(h / 64 + r log r), where h is the high-water mark
+	 * and r is the number of free runs
+	 */
+	void rebuildRuns()
+	{
+		RunMap byStart;
+		std::set<std::pair<size_t, size_t>> bySize;
+
+		size_t newHighWater = highWater;
+		for (size_t i = PoolBits::find(occupied, 0, highWater, false); i < highWater;) {
+			const size_t runEnd = PoolBits::find(occupied, i, highWater, true);
+
+			// A run reaching the high-water mark joins the untouched slots past it.
+			if (runEnd == highWater) {
+				newHighWater = i;
+				break;
+			}
+
+			byStart.emplace_hint(byStart.end(), i, runEnd - i);
+			bySize.emplace(runEnd - i, i);
+			i = PoolBits::find(occupied, runEnd, highWater, false);
+		}
+
+		runsByStart.swap(byStart);
+		runsBySize.swap(bySize);
+#ifdef MKB_POOL_STATS
+		++counters.runIndexRebuilds;
+		counters.rebuildWordsScanned += PoolBits::wordsFor(highWater);
+#endif
+		highWater = newHighWater;
+		firstFree = nullptr;
+	}
+
+	/**
+	 * \brief Allocates the memory for _count_ slots
+	 * \throws std::bad_alloc if the memory cannot be allocated
+	 *
+	 * malloc only promises alignment for fundamental types, so over-aligned slots
+	 * come from posix_memalign instead.
+	 * For huge pages, we map a bit extra so that we can trim the mapping to start
+	 * on a huge page boundary, since the kernel can only back aligned 2 MiB ranges
+	 * with a huge page.
+	 */
+	static Slot* allocateSlots(size_t count, PoolBacking backing)
+	{
+		if (backing == PoolBacking::heap) {
+			const size_t bytes = count * sizeof(Slot);
+			void* ret;
+			if (slotAlignment <= alignof(std::max_align_t))
+				ret = malloc(bytes);
+			else if (posix_memalign(&ret, slotAlignment, bytes) != 0)
+				ret = nullptr;
+
+			if (ret == nullptr)
+				throw std::bad_alloc();
+			return static_cast<Slot*>(ret);
+		}
+
+		const size_t alignment = slotAlignment > hugePageSize ? slotAlignment : hugePageSize;
+		const size_t mapped = mappedBytes(count);
+		void* raw = mmap(nullptr, mapped + alignment, PROT_READ | PROT_WRITE,
+		                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (raw == MAP_FAILED)
+			throw std::bad_alloc();
+
+		char* const rawStart = static_cast<char*>(raw);
+		char* const start = reinterpret_cast<char*>(
+			(reinterpret_cast<uintptr_t>(rawStart) + alignment - 1) & ~(uintptr_t)(alignment - 1));
+		if (start != rawStart)
+			munmap(rawStart, start - rawStart);
+		munmap(start + mapped, (rawStart + mapped + alignment) - (start + mapped));
+
+		// This is only a hint. If transparent huge pages are off, we just get normal pages.
+		madvise(start, mapped, MADV_HUGEPAGE);
+		return reinterpret_cast<Slot*>(start);
+	}
+
+	/// Frees memory from allocateSlots
+	static void freeSlots(Slot* slots, size_t count, PoolBacking backing)
+	{
+		if (backing == PoolBacking::heap)
+			free(slots);
+		else
+			munmap(slots, mappedBytes(count));
+	}
+
+	/// The size of the mapping for _count_ slots backed by huge pages
+	static size_t mappedBytes(size_t count)
+	{
+		return (count * sizeof(Slot) + hugePageSize - 1) / hugePageSize * hugePageSize;
 	}
 
 	/// \brief Checks if a pointer is within the range of the buffer and is aligned.
 	/// \warning This does not check if the pointer is free or used. That would take too much time.
-	bool isValidPointer(Slot* s) const
+	bool isValidPointer(const Slot* s) const
 	{
 		if (s < buff || s >= buff + numSlots)
 			return false; // The pointer is not inside our buffer
 
-		const uintptr_t distance = (char*)s - (char*)buff;
+		const uintptr_t distance = (const char*)s - (const char*)buff;
 
 		if (distance % sizeof(Slot) != 0)
 			return false; // The pointer is not aligned
@@ -442,31 +1543,199 @@ private:
 	}
 
 	Slot* buff; ///< The buffer for the entire pool
-	Slot* firstFree; ///< A pointer to the first free slot in the pool
+	uint64_t* occupied; ///< A bitmap with a set bit for each allocated slot
+	uint32_t* generations; ///< The number of times each slot has been freed (see Handle)
+	uint32_t* refCounts; ///< Reference counts for PoolSharedPtr, allocated on first use
+	Slot* firstFree; ///< The top of the stack of free single slots
+	RunMap runsByStart; ///< Free runs not on the free list, by their first slot
+	std::set<std::pair<size_t, size_t>> runsBySize; ///< The same runs as (length, first slot)
+	size_t highWater; ///< Slots at or past this index are free and on no list (and may be untouched)
 	size_t numSlots; ///< The total number of slots in the pool
 	size_t numAllocated; ///< The number of allocated slots in the pool
+	size_t rawSlots; ///< The number of those slots that came from allocate() (see compact)
+	PoolBacking backing; ///< Where the memory for our slots came from
+#ifdef MKB_POOL_STATS
+	PoolStats counters; ///< Our running counters (the fields stats() fills in itself are unused)
+	PoolRegistry::Node registryNode; ///< Our entry in PoolRegistry
+#endif
 };
 
-/// An extremely simple allocator for a Pool of type T
-/// which can be used by the standard library containers
-template <typename T>
+/**
+ * \brief An allocator for a Pool of type T which can be used by the standard library containers
+ *
+ * A pool only holds T, so this cannot be rebound to other types,
+ * which rules out node-based containers like std::list and std::map
+ * (use SmallObjectStlAllocator for those). It works fine with std::vector and std::deque.
+ *
+ * Since memory from one pool can't be freed to another,
+ * allocators only compare equal if they share a pool,
+ * and the pool follows the container when it is copied, moved, or swapped.
+ */
+template <typename T, size_t Alignment>
 class PoolAllocator {
 
 public:
 
 	typedef T value_type;
 
+	typedef std::true_type propagate_on_container_copy_assignment;
+
+	typedef std::true_type propagate_on_container_move_assignment;
+
+	typedef std::true_type propagate_on_container_swap;
+
+	/// The standard library rebinds allocators to their own type, which this spells out,
+	/// since our Alignment parameter keeps std::allocator_traits from doing it for us.
+	/// (Rebinding to any other type gives an allocator for a pool we don't have.)
+	template <typename U>
+	struct rebind {
+		typedef PoolAllocator<U, Alignment> other;
+	};
+
 	/// Constructor. Takes a reference to the pool from which to allocate
-	PoolAllocator(Pool<T>& p) : pool(p) { }
+	PoolAllocator(Pool<T, Alignment>& p) : pool(&p) { }
 
 	/// Calls _allocate_ on the allocator's pool.
-	T* allocate(size_t num) { return pool.allocate(num); }
+	T* allocate(size_t num) { return pool->allocate(num); }
 
 	/// Calls _deallocate_ on the allocator's pool.
-	void deallocate(T* allocated, size_t n) { return pool.deallocate(allocated, n); }
+	void deallocate(T* allocated, size_t n) { return pool->deallocate(allocated, n); }
+
+	bool operator==(const PoolAllocator& o) const { return pool == o.pool; }
+
+	bool operator!=(const PoolAllocator& o) const { return pool != o.pool; }
 
 	/// The pool to use.
-	Pool<T>& pool;
+	Pool<T, Alignment>* pool;
+};
+
+/**
+ * \brief A deleter for std::unique_ptr that returns objects to their Pool
+ *
+ * This holds nothing but a pointer to the pool, so a Pool::unique_ptr is the size of
+ * two pointers, and deletion is a direct (inlinable) call to Pool::destroy.
+ */
+template <typename T, size_t Alignment>
+class PoolDeleter {
+
+public:
+
+	/// Creates a deleter with no pool, which is only useful as a placeholder
+	/// (e.g. for a default-constructed unique_ptr)
+	PoolDeleter() : pool(nullptr) { }
+
+	/// Creates a deleter that returns objects to the given pool
+	explicit PoolDeleter(Pool<T, Alignment>& p) : pool(&p) { }
+
+	/// Destroys an object and returns it to the pool
+	void operator()(T* t) const
+	{
+		assert(pool != nullptr);
+		pool->destroy(t);
+	}
+
+	/// The pool to return objects to
+	Pool<T, Alignment>* pool;
+};
+
+/**
+ * \brief A reference-counted pointer to an object in a Pool
+ *
+ * This acts like a std::shared_ptr created with Pool::constructShared,
+ * but std::shared_ptr needs a control block for its reference counts,
+ * and with a custom deleter, that is a separate heap allocation for every object.
+ * Here, the pool instead keeps a reference count for each of its slots
+ * (allocated the first time constructShared is called),
+ * so sharing an object costs no allocations,
+ * and the pointer itself is just an object pointer and a pool pointer.
+ *
+ * \warning Like the Pool itself, reference counting is not thread-safe.
+ *          Copying or releasing pointers to the same object from multiple threads
+ *          needs external synchronization.
+ */
+template <typename T, size_t Alignment>
+class PoolSharedPtr {
+
+public:
+
+	typedef T element_type;
+
+	/// Creates a null pointer
+	PoolSharedPtr() : ptr(nullptr), pool(nullptr) { }
+
+	/// Creates a null pointer
+	PoolSharedPtr(std::nullptr_t) : ptr(nullptr), pool(nullptr) { }
+
+	/// Shares ownership with another pointer
+	PoolSharedPtr(const PoolSharedPtr& o) : ptr(o.ptr), pool(o.pool)
+	{
+		if (ptr != nullptr)
+			++count();
+	}
+
+	/// Takes ownership from another pointer, leaving it null
+	PoolSharedPtr(PoolSharedPtr&& o) : ptr(o.ptr), pool(o.pool)
+	{
+		o.ptr = nullptr;
+		o.pool = nullptr;
+	}
+
+	/// Releases our reference, destroying the object if we were the last one
+	~PoolSharedPtr() { reset(); }
+
+	PoolSharedPtr& operator=(PoolSharedPtr o)
+	{
+		swap(o);
+		return *this;
+	}
+
+	/// Releases our reference, destroying the object if we were the last one,
+	/// and leaves us null.
+	void reset()
+	{
+		if (ptr != nullptr && --count() == 0)
+			pool->destroy(ptr);
+
+		ptr = nullptr;
+		pool = nullptr;
+	}
+
+	void swap(PoolSharedPtr& o)
+	{
+		std::swap(ptr, o.ptr);
+		std::swap(pool, o.pool);
+	}
+
+	T* get() const { return ptr; }
+
+	T& operator*() const { return *ptr; }
+
+	T* operator->() const { return ptr; }
+
+	explicit operator bool() const { return ptr != nullptr; }
+
+	/// Returns the number of pointers sharing this object, or 0 if we're null
+	size_t use_count() const { return ptr != nullptr ? count() : 0; }
+
+	bool operator==(const PoolSharedPtr& o) const { return ptr == o.ptr; }
+
+	bool operator!=(const PoolSharedPtr& o) const { return ptr != o.ptr; }
+
+private:
+
+	friend class Pool<T, Alignment>;
+
+	/// Used by Pool::constructShared, which sets up the reference count
+	PoolSharedPtr(T* t, Pool<T, Alignment>* p) : ptr(t), pool(p) { }
+
+	/// Gets our object's reference count from the pool
+	uint32_t& count() const
+	{
+		return pool->refCounts[reinterpret_cast<typename Pool<T, Alignment>::Slot*>(ptr) - pool->buff];
+	}
+
+	T* ptr; ///< The object we point to
+	Pool<T, Alignment>* pool; ///< The pool the object lives in
 };
 
 /**
@@ -489,35 +1758,39 @@ public:
  */
 
 #pragma GCC diagnostic push
-// Shut gcc up about std::iterator having a non-virtual destructor
+// Shut gcc up about std::iterator having a non-virtual destructor,
+// and (as of C++17) about it being deprecated
 #pragma GCC diagnostic ignored "-Weffc++"
-template <typename T>
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+template <typename T, size_t Alignment>
 class PoolIterator : public std::iterator<std::forward_iterator_tag, T> {
 #pragma GCC diagnostic pop
 
 public:
 	/// Iterators must be default-constructible
-	PoolIterator() : current(nullptr), nextFree(nullptr) { }
+	PoolIterator() : buff(nullptr), occupied(nullptr), index(0), numSlots(0) { }
 
 	/// Default copy constructor - just copy the members
 	PoolIterator(const PoolIterator&) = default;
 
+	/// Default assignment operator - just copy the members
+	PoolIterator& operator=(const PoolIterator&) = default;
+
 	/// Creates an iterator that starts at the first used slot in a pool
-	PoolIterator(const Pool<typename std::remove_const<T>::type>& pool) :
-		current(pool.buff),
-		nextFree(pool.firstFree)
+	PoolIterator(const Pool<typename std::remove_const<T>::type, Alignment>& pool) :
+		buff(pool.buff),
+		occupied(pool.occupied),
+		index(PoolBits::find(pool.occupied, 0, pool.numSlots, true)),
+		numSlots(pool.numSlots)
 	{
-		// If our current slot is a free node, keep incrementing until it is not.
-		while (current == nextFree) {
-			++current;
-			nextFree = nextFree->next;
-		}
 	}
 
-	/// Creates an iterator for the Pool::end family of functions
-	PoolIterator(typename Pool<typename std::remove_const<T>::type>::Slot* end) :
-		current(end),
-		nextFree(nullptr)
+	/// Creates an iterator at a given slot, e.g. for the Pool::end family of functions
+	PoolIterator(const Pool<typename std::remove_const<T>::type, Alignment>& pool, size_t at) :
+		buff(pool.buff),
+		occupied(pool.occupied),
+		index(at),
+		numSlots(pool.numSlots)
 	{
 	}
 
@@ -525,58 +1798,56 @@ public:
 	// Iterators act like pointers to their current item and can be dereferenced
 	// as such.
 
-	T& operator*() const { return *reinterpret_cast<T*>(current); }
+	T& operator*() const { return *reinterpret_cast<T*>(buff + index); }
 
-	T* operator->() const { return reinterpret_cast<T*>(current); }
+	T* operator->() const { return reinterpret_cast<T*>(buff + index); }
 
 	/// Equality. Two iterators are true if they are pointing at the same item.
 	bool operator==(const PoolIterator& o) const
 	{
-#ifndef NDEBUG
-		// If the two are equal, nextFree should also be the same unless
-		// someone modified the tree like they weren't supposed to.
-		if (current == o.current)
-			assert(nextFree == o.nextFree);
-#endif
-		return current == o.current;
+		// Comparing iterators from two different pools is meaningless
+		assert(buff == o.buff);
+		return index == o.index;
 	}
 
+	/// Inequality, so that we can be used in range-based for loops
+	bool operator!=(const PoolIterator& o) const { return !(*this == o); }
+
 	/// Comparison operator, needed for all forward iterators
 	bool operator<(const PoolIterator& o) const
 	{
-		assert(current != nullptr);
-		assert(o.current != nullptr);
-		return current < o.current;
+		assert(buff != nullptr);
+		assert(buff == o.buff);
+		return index < o.index;
 	}
 
 	/// Pre-increment
 	PoolIterator& operator++()
 	{
-		// Increment the current pointer
-		++current;
-
-		// If our current slot is a free node, keep incrementing until it is not.
-		while (current == nextFree) {
-			++current;
-			nextFree = nextFree->next;
-		}
-
+		// Skip to the next used slot
+		index = PoolBits::find(occupied, index + 1, numSlots, true);
 		return *this;
 	}
 
 	/// Post-increment
 	PoolIterator operator++(int)
 	{
-		PoolIterator<T> ret(*this);
+		PoolIterator ret(*this);
 		operator++();
 		return ret;
 	}
 
-	/// Increment by a given amount
+	/**
+	 * \brief Increment by a given amount
+	 *
+	 * Free slots are skipped a word of the occupancy bitmap at a time,
+	 * so this costs time proportional to the distance travelled / 64
+	 * instead of the number of items skipped.
+	 */
 	PoolIterator& operator+=(size_t by)
 	{
-		for (size_t i = 0; i < by; ++i)
-			operator++();
+		if (by != 0)
+			index = PoolBits::findNth(occupied, index + 1, numSlots, by);
 
 		return *this;
 	}
@@ -584,13 +1855,15 @@ public:
 	/// Increment by a given amount
 	PoolIterator operator+(size_t by)
 	{
-		PoolIterator<T> ret(*this);
+		PoolIterator ret(*this);
 		ret += by;
 		return ret;
 	}
 
 private:
 	// gcc tells me I need to use "typename". Huh. Okay.
-	typename Pool<typename std::remove_const<T>::type>::Slot* current;
-	typename Pool<typename std::remove_const<T>::type>::Slot* nextFree;
+	typename Pool<typename std::remove_const<T>::type, Alignment>::Slot* buff; ///< The pool's buffer
+	const uint64_t* occupied; ///< The pool's occupancy bitmap
+	size_t index; ///< The index of the slot we're currently at
+	size_t numSlots; ///< The number of slots in the pool (i.e. our end index)
 };
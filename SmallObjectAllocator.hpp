@@ -0,0 +1,460 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <limits>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+
+#include <sys/mman.h>
+
+#if __cplusplus >= 201703L
+#include <memory_resource>
+#endif
+
+/**
+ * \brief A general-purpose allocator for small objects, built from Pool-style slabs
+ *
+ * Giving each type its own Pool works well for a handful of hot types,
+ * but with dozens of types, memory ends up scattered across dozens of pools that are
+ * each sized for their own worst case. This allocator instead sorts requests by size:
+ * every request of up to maxSize bytes is rounded up to one of a set of _size classes_
+ * (8-byte steps up to 128 bytes, then 16-byte steps up to 1024 bytes),
+ * and each size class hands out slots from its own _slabs_, which work just like Pool
+ * (an intrusive stack of free slots, plus a bump pointer through slots never used).
+ * Anything bigger than maxSize goes to malloc.
+ *
+ * All slabs are carved out of one big range of address space reserved up front with mmap.
+ * The reservation costs no memory (it is mapped PROT_NONE),
+ * and each slab is only made accessible when a size class needs it.
+ * Keeping all slabs in one range means we can tell whether a pointer is ours
+ * with a simple range check, and find its size class from a side table indexed by slab,
+ * so deallocate doesn't need to be told the size.
+ * That is what lets this allocator stand in for the global operator new
+ * (see SmallObjectNew.cpp).
+ * If the reserved range is ever used up, allocations fall back to malloc.
+ *
+ * Each size class has its own lock, so this is safe to use from multiple threads,
+ * and threads only contend when they allocate objects of the same size class at the same time.
+ * Slabs are never returned to the system.
+ *
+ * Slots of a size class are aligned to the largest power of two (up to the page size)
+ * dividing the class size, which satisfies the alignment of any type that size could hold,
+ * since a type's size is always a multiple of its alignment.
+ */
+class SmallObjectAllocator {
+
+public:
+
+	/// The largest request, in bytes, served from slabs
+	static const size_t maxSize = 1024;
+
+	/// The size of each slab, in bytes
+	static const size_t slabSize = 64 * 1024;
+
+	/// The number of size classes
+	static const size_t classCount = 16 + (maxSize - 128) / 16;
+
+	/// The default amount of address space reserved for slabs
+	static const size_t defaultReserve = size_t(1) << 30;
+
+	/**
+	 * \brief Creates an allocator
+	 * \param reserveBytes The amount of address space to reserve for slabs.
+	 *                     This is just address space, so it can be generous.
+	 * \throws std::bad_alloc if the address space cannot be reserved
+	 * \throws std::invalid_argument if _reserveBytes_ is smaller than a slab
+	 */
+	explicit SmallObjectAllocator(size_t reserveBytes = defaultReserve) :
+		base(nullptr),
+		slabClasses(nullptr),
+		numSlabs(reserveBytes / slabSize),
+		nextSlab(0),
+		classes()
+	{
+		if (numSlabs == 0)
+			throw std::invalid_argument("At least one slab's worth of address space is needed");
+
+		void* reserved = mmap(nullptr, numSlabs * slabSize, PROT_NONE,
+		                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+		if (reserved == MAP_FAILED)
+			throw std::bad_alloc();
+
+		// We can't use new here, since we might be operator new.
+		void* table = mmap(nullptr, numSlabs, PROT_READ | PROT_WRITE,
+		                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (table == MAP_FAILED) {
+			munmap(reserved, numSlabs * slabSize);
+			throw std::bad_alloc();
+		}
+
+		base = static_cast<char*>(reserved);
+		slabClasses = static_cast<uint8_t*>(table);
+
+		for (size_t i = 0; i < classCount; ++i)
+			classes[i].size = classSize(i);
+	}
+
+	/// Destructor. Unmaps all slabs, so everything allocated from them had better be dead.
+	~SmallObjectAllocator()
+	{
+		munmap(slabClasses, numSlabs);
+		munmap(base, numSlabs * slabSize);
+	}
+
+	/**
+	 * \brief Allocates _bytes_ bytes
+	 * \throws std::bad_alloc if the memory cannot be allocated
+	 *
+	 * Complexity is O(1)
+	 */
+	void* allocate(size_t bytes)
+	{
+		if (bytes <= maxSize) {
+			void* ret = fromSlabs(bytes);
+			if (ret != nullptr)
+				return ret;
+		}
+
+		// Too big for our slabs, or we're out of address space.
+		return mallocOrThrow(bytes);
+	}
+
+	/**
+	 * \brief Deallocates memory from allocate when the size is not known
+	 *
+	 * Complexity is O(1)
+	 */
+	void deallocate(void* p)
+	{
+		if (!owns(p)) {
+			free(p);
+			return;
+		}
+
+		push(classes[slabClasses[slabOf(p)]], p);
+	}
+
+	/**
+	 * \brief Deallocates memory from allocate
+	 * \param p The memory to deallocate
+	 * \param bytes The size passed to allocate
+	 *
+	 * This is a bit quicker than deallocate(void*), since we needn't look up
+	 * the size class. Complexity is O(1)
+	 */
+	void deallocate(void* p, size_t bytes)
+	{
+		if (!owns(p)) {
+			free(p);
+			return;
+		}
+
+		assert(bytes <= maxSize);
+		assert(slabClasses[slabOf(p)] == classOf(bytes));
+		push(classes[classOf(bytes)], p);
+	}
+
+	/**
+	 * \brief Allocates _bytes_ bytes aligned to _alignment_, which must be a power of two
+	 * \throws std::bad_alloc if the memory cannot be allocated
+	 *
+	 * Since a slot is aligned to the largest power of two dividing its size,
+	 * this just rounds the request up to a multiple of the alignment.
+	 */
+	void* allocate(size_t bytes, size_t alignment)
+	{
+		assert(alignment != 0 && (alignment & (alignment - 1)) == 0);
+		const size_t rounded = alignedSize(bytes, alignment);
+		if (rounded <= maxSize) {
+			void* ret = fromSlabs(rounded);
+			if (ret != nullptr)
+				return ret;
+		}
+
+		if (alignment <= alignof(std::max_align_t))
+			return mallocOrThrow(rounded);
+
+		// Too big for our slabs (or they're full) and too aligned for plain malloc
+		void* ret;
+		if (posix_memalign(&ret, alignment, rounded) != 0)
+			throw std::bad_alloc();
+		return ret;
+	}
+
+	/// Deallocates memory from allocate(size_t, size_t)
+	void deallocate(void* p, size_t bytes, size_t alignment)
+	{
+		deallocate(p, alignedSize(bytes, alignment));
+	}
+
+	/// Returns true if _p_ was allocated from one of our slabs
+	bool owns(const void* p) const
+	{
+		const char* c = static_cast<const char*>(p);
+		return c >= base && c < base + numSlabs * slabSize;
+	}
+
+	/// Returns the number of slabs handed out to size classes so far
+	size_t slabsUsed() const { return std::min(nextSlab.load(std::memory_order_relaxed), numSlabs); }
+
+	/// Returns the size class used for requests of _bytes_ bytes (which must be at most maxSize)
+	static size_t classOf(size_t bytes)
+	{
+		assert(bytes <= maxSize);
+		if (bytes <= 128)
+			return bytes == 0 ? 0 : (bytes - 1) / 8;
+
+		return 16 + (bytes - 129) / 16;
+	}
+
+	/// Returns the size of the slots in a size class
+	static size_t classSize(size_t sizeClass)
+	{
+		assert(sizeClass < classCount);
+		if (sizeClass < 16)
+			return (sizeClass + 1) * 8;
+
+		return 128 + (sizeClass - 15) * 16;
+	}
+
+	/**
+	 * \brief Returns an allocator shared by the whole process
+	 *
+	 * This is never destroyed, since objects allocated from it may well outlive
+	 * any static destructor we could run.
+	 */
+	static SmallObjectAllocator& global()
+	{
+		// Make sure we don't try to allocate memory for the allocator from itself.
+		alignas(SmallObjectAllocator) static char storage[sizeof(SmallObjectAllocator)];
+		static SmallObjectAllocator* instance = ::new (storage) SmallObjectAllocator(size_t(64) << 30);
+		return *instance;
+	}
+
+	/// The copy constructor is deleted (see Pool)
+	SmallObjectAllocator(const SmallObjectAllocator&) = delete;
+
+	/// The assignment operator is deleted (see Pool)
+	const SmallObjectAllocator& operator=(const SmallObjectAllocator&) = delete;
+
+private:
+
+	/// A free slot in a size class
+	struct FreeSlot {
+		FreeSlot* next;
+	};
+
+	/// The state of a size class
+	struct SizeClass {
+		std::mutex lock; ///< Guards everything else in the size class
+		FreeSlot* freeList; ///< A stack of freed slots
+		char* bump; ///< The next never-used slot in the newest slab
+		char* bumpEnd; ///< The end of the usable part of the newest slab
+		size_t size; ///< The size of each slot
+
+		SizeClass() : lock(), freeList(nullptr), bump(nullptr), bumpEnd(nullptr), size(0) { }
+	};
+
+	/// Gets the index of the slab that holds _p_, which must be ours
+	size_t slabOf(const void* p) const { return (static_cast<const char*>(p) - base) / slabSize; }
+
+	/// Pushes a slot onto its size class's free list
+	void push(SizeClass& c, void* p)
+	{
+		std::lock_guard<std::mutex> guard(c.lock);
+		FreeSlot* s = static_cast<FreeSlot*>(p);
+		s->next = c.freeList;
+		c.freeList = s;
+	}
+
+	/// Gives a size class a new slab. The class's lock must be held.
+	/// Returns false if we are out of address space.
+	bool newSlab(SizeClass& c, size_t sizeClass)
+	{
+		const size_t slab = nextSlab.fetch_add(1, std::memory_order_relaxed);
+		if (slab >= numSlabs)
+			return false;
+
+		char* start = base + slab * slabSize;
+		if (mprotect(start, slabSize, PROT_READ | PROT_WRITE) != 0)
+			return false;
+
+		slabClasses[slab] = (uint8_t)sizeClass;
+		c.bump = start;
+		// Don't hand out a partial slot at the end of the slab
+		c.bumpEnd = start + (slabSize / c.size) * c.size;
+		return true;
+	}
+
+	static size_t roundUp(size_t bytes, size_t alignment)
+	{
+		return (bytes + alignment - 1) & ~(alignment - 1);
+	}
+
+	/**
+	 * \brief Returns the size of the slot for an aligned request
+	 *
+	 * Zero bytes are rounded up to a whole _alignment_ too,
+	 * since the smallest slots are only aligned to their own size.
+	 */
+	static size_t alignedSize(size_t bytes, size_t alignment)
+	{
+		return roundUp(bytes == 0 ? 1 : bytes, alignment);
+	}
+
+	/// Takes a slot for _bytes_ bytes (at most maxSize) from our slabs,
+	/// or returns null if we're out of address space
+	void* fromSlabs(size_t bytes)
+	{
+		const size_t sizeClass = classOf(bytes);
+		SizeClass& c = classes[sizeClass];
+		std::lock_guard<std::mutex> guard(c.lock);
+
+		// First choice: something that was freed
+		FreeSlot* ret = c.freeList;
+		if (ret != nullptr) {
+			c.freeList = ret->next;
+			return ret;
+		}
+
+		// Second choice: a slot in the current slab that hasn't been used yet
+		if (c.bump == c.bumpEnd && !newSlab(c, sizeClass))
+			return nullptr;
+
+		void* fresh = c.bump;
+		c.bump += c.size;
+		return fresh;
+	}
+
+	static void* mallocOrThrow(size_t bytes)
+	{
+		void* ret = malloc(bytes == 0 ? 1 : bytes);
+		if (ret == nullptr)
+			throw std::bad_alloc();
+		return ret;
+	}
+
+	char* base; ///< The start of the address space reserved for slabs
+	uint8_t* slabClasses; ///< The size class of each slab
+	size_t numSlabs; ///< The number of slabs that fit in our reserved address space
+	std::atomic<size_t> nextSlab; ///< The index of the next slab to hand out
+	SizeClass classes[classCount]; ///< The state of each size class
+};
+
+/**
+ * \brief A standard library allocator that allocates from a SmallObjectAllocator
+ *
+ * Unlike PoolAllocator, this can be rebound to any type,
+ * so node-based containers (std::list, std::map, std::unordered_map, and friends)
+ * can allocate their nodes from size classes instead of malloc.
+ *
+ * Allocators compare equal if they share a SmallObjectAllocator,
+ * and the SmallObjectAllocator follows the container when it is copied, moved, or swapped.
+ */
+template <typename T>
+class SmallObjectStlAllocator {
+
+public:
+
+	typedef T value_type;
+
+	typedef std::true_type propagate_on_container_copy_assignment;
+
+	typedef std::true_type propagate_on_container_move_assignment;
+
+	typedef std::true_type propagate_on_container_swap;
+
+	template <typename U>
+	struct rebind {
+		typedef SmallObjectStlAllocator<U> other;
+	};
+
+	/// Creates an allocator that uses SmallObjectAllocator::global()
+	SmallObjectStlAllocator() : soa(&SmallObjectAllocator::global()) { }
+
+	/// Creates an allocator that uses the given SmallObjectAllocator
+	SmallObjectStlAllocator(SmallObjectAllocator& a) : soa(&a) { }
+
+	/// Rebinding constructor
+	template <typename U>
+	SmallObjectStlAllocator(const SmallObjectStlAllocator<U>& o) : soa(o.soa) { }
+
+	T* allocate(size_t n)
+	{
+		if (n > std::numeric_limits<size_t>::max() / sizeof(T))
+			throw std::bad_alloc();
+
+		return static_cast<T*>(soa->allocate(n * sizeof(T), alignof(T)));
+	}
+
+	void deallocate(T* p, size_t n) { soa->deallocate(p, n * sizeof(T), alignof(T)); }
+
+	template <typename U>
+	bool operator==(const SmallObjectStlAllocator<U>& o) const { return soa == o.soa; }
+
+	template <typename U>
+	bool operator!=(const SmallObjectStlAllocator<U>& o) const { return soa != o.soa; }
+
+	/// The SmallObjectAllocator to use
+	SmallObjectAllocator* soa;
+};
+
+#if __cplusplus >= 201703L
+
+/**
+ * \brief A std::pmr::memory_resource that allocates from a SmallObjectAllocator
+ *
+ * This lets std::pmr containers (which rebind a polymorphic_allocator to their nodes)
+ * use size classes without changing their type.
+ * Two resources are equal if they share a SmallObjectAllocator.
+ *
+ * Only C++17 builds have this. The default build is C++11, so it and its test
+ * are built by `make unit_tests_cxx17`.
+ */
+class SmallObjectResource : public std::pmr::memory_resource {
+
+public:
+
+	/// Creates a resource that uses SmallObjectAllocator::global()
+	SmallObjectResource() : soa(&SmallObjectAllocator::global()) { }
+
+	/// Creates a resource that uses the given SmallObjectAllocator
+	explicit SmallObjectResource(SmallObjectAllocator& a) : soa(&a) { }
+
+	/// Copies share the original's SmallObjectAllocator
+	SmallObjectResource(const SmallObjectResource&) = default;
+
+	SmallObjectResource& operator=(const SmallObjectResource&) = default;
+
+	/// Returns the SmallObjectAllocator we use
+	SmallObjectAllocator& allocator() const { return *soa; }
+
+private:
+
+	void* do_allocate(size_t bytes, size_t alignment) override
+	{
+		return soa->allocate(bytes, alignment);
+	}
+
+	void do_deallocate(void* p, size_t bytes, size_t alignment) override
+	{
+		soa->deallocate(p, bytes, alignment);
+	}
+
+	bool do_is_equal(const std::pmr::memory_resource& o) const noexcept override
+	{
+		const SmallObjectResource* other = dynamic_cast<const SmallObjectResource*>(&o);
+		return other != nullptr && other->soa == soa;
+	}
+
+	SmallObjectAllocator* soa; ///< The allocator backing this resource
+};
+
+#endif
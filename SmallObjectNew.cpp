@@ -0,0 +1,110 @@
+/**
+ * \file
+ * \brief Replaces the global operator new and delete with SmallObjectAllocator::global()
+ *
+ * Link this file into a program (and only one program per process, obviously)
+ * to send every dynamic allocation through the small object allocator.
+ * Requests larger than SmallObjectAllocator::maxSize still end up in malloc.
+ *
+ * Over-aligned types (C++17's aligned operator new) are not replaced,
+ * since size classes only guarantee the alignment implied by their size.
+ */
+
+#include <new>
+
+#include "SmallObjectAllocator.hpp"
+
+namespace {
+
+/**
+ * \brief Allocates the way operator new has to: on failure, the new handler
+ *        is called and the allocation retried, until it succeeds or there is no handler
+ * \throws std::bad_alloc if the allocation fails and there is no new handler
+ *         (or whatever the handler throws)
+ */
+void* allocateOrHandle(size_t bytes)
+{
+	for (;;) {
+		try {
+			return SmallObjectAllocator::global().allocate(bytes);
+		}
+		catch (const std::bad_alloc&) {
+			const std::new_handler handler = std::get_new_handler();
+			if (handler == nullptr)
+				throw;
+			handler();
+		}
+	}
+}
+
+} // end anonymous namespace
+
+void* operator new(size_t bytes)
+{
+	return allocateOrHandle(bytes);
+}
+
+void* operator new[](size_t bytes)
+{
+	return allocateOrHandle(bytes);
+}
+
+void* operator new(size_t bytes, const std::nothrow_t&) noexcept
+{
+	try {
+		return allocateOrHandle(bytes);
+	}
+	catch (...) {
+		return nullptr;
+	}
+}
+
+void* operator new[](size_t bytes, const std::nothrow_t&) noexcept
+{
+	try {
+		return allocateOrHandle(bytes);
+	}
+	catch (...) {
+		return nullptr;
+	}
+}
+
+void operator delete(void* p) noexcept
+{
+	if (p != nullptr)
+		SmallObjectAllocator::global().deallocate(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+	if (p != nullptr)
+		SmallObjectAllocator::global().deallocate(p);
+}
+
+void operator delete(void* p, const std::nothrow_t&) noexcept
+{
+	if (p != nullptr)
+		SmallObjectAllocator::global().deallocate(p);
+}
+
+void operator delete[](void* p, const std::nothrow_t&) noexcept
+{
+	if (p != nullptr)
+		SmallObjectAllocator::global().deallocate(p);
+}
+
+#ifdef __cpp_sized_deallocation
+// With sized deallocation, we can skip looking up the size class.
+
+void operator delete(void* p, size_t bytes) noexcept
+{
+	if (p != nullptr)
+		SmallObjectAllocator::global().deallocate(p, bytes);
+}
+
+void operator delete[](void* p, size_t bytes) noexcept
+{
+	if (p != nullptr)
+		SmallObjectAllocator::global().deallocate(p, bytes);
+}
+#endif
@@ -0,0 +1,453 @@
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <iterator>
+#include <new>
+#include <stdexcept>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include "Pool.hpp"
+
+/// Helpers for SoaPool
+namespace SoaDetail {
+
+/// Something to hang a column number off of, for picking overloads by column
+template <size_t I>
+using Column = std::integral_constant<size_t, I>;
+
+} // end namespace SoaDetail
+
+/**
+ * \brief A pool that stores each field of its rows in a separate array (structure of arrays)
+ * \tparam Columns The type of each field, in order
+ *
+ * A Pool<T> keeps whole objects together, so a pass that only reads one field of T
+ * still pulls every other field through the cache along with it.
+ * An SoaPool<float, float, int> instead keeps all of the first fields in one array,
+ * all of the second fields in another, and so on. A slot is a row across all of them:
+ * construct hands out a slot in every column at once, and destroy frees it in all of them.
+ * A pass over one column then only touches that column's memory.
+ *
+ * Fields are referred to by their column number, e.g. `get<0>(slot)`.
+ * Rows are referred to by their slot index, which, like a pointer into a Pool,
+ * stays the same for the row's lifetime.
+ *
+ * Like Pool, columns are allocated up front and paged in as they are used,
+ * and free slots below the high-water mark are reused most recent first.
+ * Each column starts on a cache line boundary.
+ *
+ * \warning As with Pool, this is not thread-safe.
+ */
+template <typename... Columns>
+class SoaPool {
+
+	static_assert(sizeof...(Columns) > 0, "An SoaPool needs at least one column");
+
+public:
+
+	/// The number of columns
+	static const size_t columnCount = sizeof...(Columns);
+
+	/// The type of column _I_
+	template <size_t I>
+	using ColumnType = typename std::tuple_element<I, std::tuple<Columns...>>::type;
+
+	class Row;
+
+	class Iterator;
+
+	typedef Iterator iterator;
+
+	/**
+	 * \brief Constructs a pool with a given number of rows
+	 * \throws std::bad_alloc if the columns cannot be allocated
+	 */
+	explicit SoaPool(size_t poolSize) :
+		columns(),
+		occupied(nullptr),
+		freeSlots(nullptr),
+		freeCount(0),
+		highWater(0),
+		numSlots(poolSize),
+		numAllocated(0)
+	{
+		occupied = static_cast<uint64_t*>(calloc(PoolBits::wordsFor(poolSize), sizeof(uint64_t)));
+		freeSlots = static_cast<size_t*>(calloc(poolSize, sizeof(size_t)));
+		if (occupied == nullptr || freeSlots == nullptr || !allocateColumns(SoaDetail::Column<0>())) {
+			freeColumns(SoaDetail::Column<0>());
+			free(freeSlots);
+			free(occupied);
+			throw std::bad_alloc();
+		}
+	}
+
+	/**
+	 * \brief Destructor
+	 * \pre Every row has been destroyed
+	 * \warning If any rows are still around, std::terminate is called (see Pool::~Pool)
+	 */
+	~SoaPool()
+	{
+		if (numAllocated != 0) {
+			fprintf(stderr, "An SoA pool was destroyed before its rows were freed.\n");
+			std::terminate();
+		}
+
+		freeColumns(SoaDetail::Column<0>());
+		free(freeSlots);
+		free(occupied);
+	}
+
+	/**
+	 * \brief Constructs a row from a value for each column
+	 * \returns The row's slot
+	 * \throws std::bad_alloc if the pool is full
+	 * \throws Whatever a column's copy constructor throws, in which case the pool is unchanged
+	 *
+	 * Complexity is O(1)
+	 */
+	size_t construct(const Columns&... values)
+	{
+		const size_t index = allocateSlot();
+
+		try {
+			constructColumns(index, SoaDetail::Column<0>(), std::tuple<const Columns&...>(values...));
+		}
+		catch (...) {
+			freeSlot(index);
+			throw;
+		}
+
+		return index;
+	}
+
+	/// Constructs a row with every column value-initialized
+	size_t construct() { return construct(Columns()...); }
+
+	/**
+	 * \brief Destroys a row and frees its slot
+	 * \throws std::invalid_argument if the slot is not in the pool
+	 * \throws std::logic_error if the slot is not in use
+	 *
+	 * Complexity is O(1)
+	 */
+	void destroy(size_t index)
+	{
+		if (index >= numSlots)
+			throw std::invalid_argument("The provided slot is not in the pool");
+
+		if (!PoolBits::test(occupied, index))
+			throw std::logic_error("Double destroy detected");
+
+		destroyColumns(index, SoaDetail::Column<0>());
+		freeSlot(index);
+	}
+
+	/**
+	 * \brief Destroys every row in the pool
+	 *
+	 * Complexity is O(high-water mark)
+	 */
+	void clear()
+	{
+		for (size_t i = PoolBits::find(occupied, 0, highWater, true); i < highWater;
+		     i = PoolBits::find(occupied, i + 1, highWater, true)) {
+			destroyColumns(i, SoaDetail::Column<0>());
+			PoolBits::clear(occupied, i);
+		}
+
+		freeCount = 0;
+		highWater = 0;
+		numAllocated = 0;
+	}
+
+	/// Returns column _I_ of a row. The row must be in use.
+	template <size_t I>
+	ColumnType<I>& get(size_t index)
+	{
+		assert(live(index));
+		return std::get<I>(columns)[index];
+	}
+
+	/// \copydoc get
+	template <size_t I>
+	const ColumnType<I>& get(size_t index) const
+	{
+		assert(live(index));
+		return std::get<I>(columns)[index];
+	}
+
+	/// Returns a proxy for a row. The row must be in use.
+	Row row(size_t index)
+	{
+		assert(live(index));
+		return Row(*this, index);
+	}
+
+	/// Returns true if a slot holds a row
+	bool live(size_t index) const { return index < numSlots && PoolBits::test(occupied, index); }
+
+	/**
+	 * \brief Calls _fn_ on column _I_ of each row, in order of slot
+	 *
+	 * This is the way to sweep over one field. Nothing but that field's column
+	 * and the occupancy bitmap is touched. Empty stretches are skipped 64 slots at a time,
+	 * and full stretches are run through 64 slots at a time without checking each one,
+	 * which leaves the compiler free to vectorize _fn_.
+	 *
+	 * Complexity is O(high-water mark / 64 + number of rows)
+	 */
+	template <size_t I, typename Fn>
+	void forEach(Fn&& fn)
+	{
+		ColumnType<I>* column = std::get<I>(columns);
+		forEachLive([&](size_t i) { fn(column[i]); });
+	}
+
+	/// \copydoc forEach
+	template <size_t I, typename Fn>
+	void forEach(Fn&& fn) const
+	{
+		const ColumnType<I>* column = std::get<I>(columns);
+		forEachLive([&](size_t i) { fn(column[i]); });
+	}
+
+	/**
+	 * \brief Returns the start of column _I_
+	 *
+	 * Slots in [0, highWaterMark()) for which live() is true hold a value.
+	 * The rest hold nothing, and must not be read.
+	 * If the pool is known to be dense (say, nothing has been destroyed since
+	 * it was cleared), this can be treated as an array of highWaterMark() values.
+	 */
+	template <size_t I>
+	ColumnType<I>* column() { return std::get<I>(columns); }
+
+	/// \copydoc column
+	template <size_t I>
+	const ColumnType<I>* column() const { return std::get<I>(columns); }
+
+	/// Returns one past the highest slot used since the pool was constructed or cleared
+	size_t highWaterMark() const { return highWater; }
+
+	/// Returns the number of rows in the pool. Complexity is O(1)
+	size_t size() const { return numAllocated; }
+
+	/// Returns the maximum number of rows the pool can hold. Complexity is O(1)
+	size_t max_size() const { return numSlots; }
+
+	/// Returns true if the pool has no rows. Complexity is O(1)
+	bool empty() const { return numAllocated == 0; }
+
+	/// Returns true if the pool is full. Complexity is O(1)
+	bool full() const { return numAllocated == numSlots; }
+
+	iterator begin() { return iterator(*this, PoolBits::find(occupied, 0, highWater, true)); }
+
+	iterator end() { return iterator(*this, highWater); }
+
+	/// The copy constructor is deleted (see Pool)
+	SoaPool(const SoaPool&) = delete;
+
+	/// The assignment operator is deleted (see Pool)
+	const SoaPool& operator=(const SoaPool&) = delete;
+
+	/// A proxy for a row in the pool, which gets at each of its fields
+	class Row {
+
+	public:
+
+		/// Returns column _I_ of the row
+		template <size_t I>
+		ColumnType<I>& get() const { return pool->template get<I>(index); }
+
+		/// Returns the row's slot
+		size_t slot() const { return index; }
+
+	private:
+
+		friend class SoaPool;
+
+		Row(SoaPool& p, size_t i) : pool(&p), index(i) { }
+
+		SoaPool* pool;
+		size_t index;
+	};
+
+	/**
+	 * \brief A forward iterator over the rows in the pool, which yields Row proxies
+	 * \warning This iterator is invalidated if the pool is modified
+	 */
+	class Iterator {
+
+	public:
+
+		typedef std::forward_iterator_tag iterator_category;
+		typedef Row value_type;
+		typedef ptrdiff_t difference_type;
+		typedef Row reference;
+		typedef void pointer;
+
+		Iterator() : pool(nullptr), index(0) { }
+
+		Row operator*() const { return Row(*pool, index); }
+
+		bool operator==(const Iterator& o) const
+		{
+			assert(pool == o.pool);
+			return index == o.index;
+		}
+
+		bool operator!=(const Iterator& o) const { return !(*this == o); }
+
+		/// Pre-increment
+		Iterator& operator++()
+		{
+			index = PoolBits::find(pool->occupied, index + 1, pool->highWater, true);
+			return *this;
+		}
+
+		/// Post-increment
+		Iterator operator++(int)
+		{
+			Iterator ret(*this);
+			operator++();
+			return ret;
+		}
+
+	private:
+
+		friend class SoaPool;
+
+		Iterator(SoaPool& p, size_t i) : pool(&p), index(i) { }
+
+		SoaPool* pool; ///< The pool we are iterating over
+		size_t index; ///< The slot we are at
+	};
+
+private:
+
+	/// The alignment of the start of each column
+	static const size_t cacheLineSize = 64;
+
+	/// Calls _fn_ with the index of each slot holding a row, a word of the bitmap at a time
+	template <typename Fn>
+	void forEachLive(Fn&& fn) const
+	{
+		const size_t words = PoolBits::wordsFor(highWater);
+		for (size_t w = 0; w < words; ++w) {
+			const size_t base = w * PoolBits::wordBits;
+			uint64_t bits = occupied[w];
+			if (bits == ~uint64_t(0)) {
+				for (size_t i = base; i < base + PoolBits::wordBits; ++i)
+					fn(i);
+			}
+			else {
+				for (; bits != 0; bits &= bits - 1)
+					fn(base + __builtin_ctzll(bits));
+			}
+		}
+	}
+
+	/// Takes a free slot, preferring recently freed ones to untouched ones
+	size_t allocateSlot()
+	{
+		size_t index;
+		if (freeCount != 0)
+			index = freeSlots[--freeCount];
+		else if (highWater < numSlots)
+			index = highWater++;
+		else
+			throw std::bad_alloc();
+
+		PoolBits::set(occupied, index);
+		++numAllocated;
+		return index;
+	}
+
+	/// Returns a slot to the free stack
+	void freeSlot(size_t index)
+	{
+		PoolBits::clear(occupied, index);
+		freeSlots[freeCount++] = index;
+		--numAllocated;
+	}
+
+	/// Allocates the storage for column _I_ and the ones after it
+	template <size_t I>
+	bool allocateColumns(SoaDetail::Column<I>)
+	{
+		void* column;
+		const size_t bytes = numSlots * sizeof(ColumnType<I>);
+		size_t alignment = cacheLineSize;
+		if (alignof(ColumnType<I>) > alignment)
+			alignment = alignof(ColumnType<I>);
+
+		if (posix_memalign(&column, alignment, bytes == 0 ? 1 : bytes) != 0)
+			return false;
+
+		std::get<I>(columns) = static_cast<ColumnType<I>*>(column);
+		return allocateColumns(SoaDetail::Column<I + 1>());
+	}
+
+	bool allocateColumns(SoaDetail::Column<columnCount>) { return true; }
+
+	/// Frees the storage for column _I_ and the ones after it
+	template <size_t I>
+	void freeColumns(SoaDetail::Column<I>)
+	{
+		free(std::get<I>(columns));
+		freeColumns(SoaDetail::Column<I + 1>());
+	}
+
+	void freeColumns(SoaDetail::Column<columnCount>) { }
+
+	/// Constructs column _I_ and the ones after it of a row, undoing them all if one throws
+	template <size_t I>
+	void constructColumns(size_t index, SoaDetail::Column<I>, const std::tuple<const Columns&...>& values)
+	{
+		typedef ColumnType<I> C;
+		C* field = std::get<I>(columns) + index;
+		::new (field) C(std::get<I>(values));
+
+		try {
+			constructColumns(index, SoaDetail::Column<I + 1>(), values);
+		}
+		catch (...) {
+			field->~C();
+			throw;
+		}
+	}
+
+	void constructColumns(size_t, SoaDetail::Column<columnCount>, const std::tuple<const Columns&...>&) { }
+
+	/// Destroys column _I_ and the ones after it of a row
+	template <size_t I>
+	void destroyColumns(size_t index, SoaDetail::Column<I>)
+	{
+		typedef ColumnType<I> C;
+		if (!std::is_trivially_destructible<C>::value)
+			(std::get<I>(columns) + index)->~C();
+
+		destroyColumns(index, SoaDetail::Column<I + 1>());
+	}
+
+	void destroyColumns(size_t, SoaDetail::Column<columnCount>) { }
+
+	std::tuple<Columns*...> columns; ///< The storage for each column
+	uint64_t* occupied; ///< A bitmap with a set bit for each slot holding a row
+	size_t* freeSlots; ///< A stack of freed slots below the high-water mark
+	size_t freeCount; ///< The number of slots on that stack
+	size_t highWater; ///< Slots at or past this index have never been used
+	size_t numSlots; ///< The number of rows the pool can hold
+	size_t numAllocated; ///< The number of rows in the pool
+};
+
+template <typename... Columns>
+const size_t SoaPool<Columns...>::columnCount;
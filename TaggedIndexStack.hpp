@@ -0,0 +1,102 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+/**
+ * \brief A lock-free (Treiber) stack of 32-bit indices into some array
+ *
+ * The stack doesn't own any storage for its links. Instead, each element's "next" index
+ * lives wherever the user wants it to, and push and pop are handed a function that maps
+ * an index to its link.
+ *
+ * The classic problem with lock-free stacks is ABA:
+ * thread 1 reads the head A and its next pointer B, then gets preempted.
+ * Meanwhile thread 2 pops A, pops B, and pushes A back.
+ * Thread 1 wakes up, sees that the head is still A, and happily swings it to B,
+ * which is no longer in the stack.
+ * To prevent this, the head is a 64-bit word holding both the index at the top of the stack
+ * and a tag that is bumped on every successful push and pop,
+ * so a head that has been changed and changed back will no longer compare equal.
+ * A 32-bit tag would have to wrap all the way around while a thread is stalled
+ * between its read and its compare-and-swap for ABA to bite.
+ *
+ * Links are read and written as atomics, since a thread reading the link of the top element
+ * might be racing with another thread that just popped it.
+ * The value it reads in that case is garbage, but the compare-and-swap will fail and discard it.
+ * For the same reason, links should not share memory with anything that is written
+ * non-atomically once an element is popped (such as the object in a pool slot).
+ */
+class TaggedIndexStack {
+
+public:
+
+	/// The index used to represent "nothing", e.g. the end of the stack
+	static const uint32_t none = 0xFFFFFFFF;
+
+	/// Constructs an empty stack
+	TaggedIndexStack() : head(pack(none, 0)) { }
+
+	/**
+	 * \brief Pushes an index onto the stack
+	 * \param index The index to push, which must not already be in the stack
+	 * \param linkOf A function that takes an index and returns a reference to
+	 *               its link (a `std::atomic<uint32_t>`)
+	 */
+	template <typename LinkOf>
+	void push(uint32_t index, LinkOf linkOf)
+	{
+		uint64_t old = head.load(std::memory_order_relaxed);
+		do {
+			linkOf(index).store(indexOf(old), std::memory_order_relaxed);
+		} while (!head.compare_exchange_weak(old, pack(index, tagOf(old) + 1),
+		                                     std::memory_order_release, std::memory_order_relaxed));
+	}
+
+	/**
+	 * \brief Pops an index off the stack
+	 * \param linkOf See push()
+	 * \returns The popped index, or TaggedIndexStack::none if the stack was empty
+	 */
+	template <typename LinkOf>
+	uint32_t pop(LinkOf linkOf)
+	{
+		uint64_t old = head.load(std::memory_order_acquire);
+		for (;;) {
+			const uint32_t top = indexOf(old);
+			if (top == none)
+				return none;
+
+			const uint32_t next = linkOf(top).load(std::memory_order_relaxed);
+			if (head.compare_exchange_weak(old, pack(next, tagOf(old) + 1),
+			                               std::memory_order_acquire, std::memory_order_acquire))
+				return top;
+		}
+	}
+
+	/// Returns true if the stack was empty at the time of the call
+	bool empty() const { return indexOf(head.load(std::memory_order_acquire)) == none; }
+
+	/// Returns the index at the top of the stack at the time of the call, or none
+	uint32_t top() const { return indexOf(head.load(std::memory_order_acquire)); }
+
+	/**
+	 * \brief Empties the stack
+	 * \warning This is not safe to call while other threads are using the stack.
+	 */
+	void reset() { head.store(pack(none, 0), std::memory_order_relaxed); }
+
+	TaggedIndexStack(const TaggedIndexStack&) = delete;
+
+	TaggedIndexStack& operator=(const TaggedIndexStack&) = delete;
+
+private:
+
+	static uint64_t pack(uint32_t index, uint32_t tag) { return (uint64_t)tag << 32 | index; }
+
+	static uint32_t indexOf(uint64_t word) { return (uint32_t)word; }
+
+	static uint32_t tagOf(uint64_t word) { return (uint32_t)(word >> 32); }
+
+	std::atomic<uint64_t> head; ///< The index at the top of the stack (low half) and its tag (high half)
+};
@@ -0,0 +1,273 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+/**
+ * \brief A fixed set of worker threads that split loops between them by work stealing
+ *
+ * forEachChunk(n, fn) calls fn(0) through fn(n - 1), spread across the workers
+ * and the calling thread, and returns once every call has finished.
+ *
+ * Each thread starts out with an equal, contiguous share of the chunks, which it works
+ * through front to back. A thread that runs out steals the back half of another
+ * thread's remaining share. So when some chunks are much more expensive than others
+ * (a dense stretch of a pool, say), the threads that got the cheap ones end up
+ * helping with the rest instead of sitting idle.
+ *
+ * The workers sleep on a condition variable between loops, so an idle executor
+ * costs nothing but its threads' stacks.
+ *
+ * \warning forEachChunk may be called from several threads, but the calls take turns.
+ *          Calling it from inside a chunk deadlocks.
+ */
+class WorkStealingExecutor {
+
+public:
+
+	/**
+	 * \brief Starts the worker threads
+	 * \param threads The number of threads to split work between, including the caller of
+	 *                forEachChunk, so one less than this is started. Zero means one per core.
+	 */
+	explicit WorkStealingExecutor(size_t threads = 0) :
+		workers(),
+		queues(),
+		submitLock(),
+		lock(),
+		wake(),
+		done(),
+		invoke(nullptr),
+		job(nullptr),
+		jobNumber(0),
+		busy(0),
+		cancelled(false),
+		error(),
+		stopping(false)
+	{
+		if (threads == 0)
+			threads = std::thread::hardware_concurrency();
+		if (threads == 0)
+			threads = 1;
+
+		for (size_t i = 0; i < threads; ++i)
+			queues.emplace_back(new Queue);
+
+		try {
+			for (size_t i = 1; i < threads; ++i)
+				workers.emplace_back(&WorkStealingExecutor::workerLoop, this, i);
+		}
+		catch (...) {
+			stop();
+			throw;
+		}
+	}
+
+	/// Destructor. Waits for the worker threads to finish up and exit.
+	~WorkStealingExecutor() { stop(); }
+
+	/// Returns the number of threads work is split between, including the caller
+	size_t threadCount() const { return queues.size(); }
+
+	/**
+	 * \brief Calls _fn_ with each index in [0, _chunks_), spread across our threads
+	 * \param chunks The number of chunks to split the work into
+	 * \param fn Called once per chunk with its index, from any of our threads at once
+	 * \throws Whatever _fn_ throws. The first exception is rethrown here once every thread
+	 *         has stopped; chunks that hadn't been started by then are skipped.
+	 *
+	 * Blocks until every chunk is done.
+	 */
+	template <typename Fn>
+	void forEachChunk(size_t chunks, Fn&& fn)
+	{
+		typedef typename std::remove_reference<Fn>::type Functor;
+
+		if (chunks == 0)
+			return;
+
+		std::lock_guard<std::mutex> submitGuard(submitLock);
+
+		// Deal out an equal share to each thread.
+		const size_t n = queues.size();
+		for (size_t i = 0; i < n; ++i) {
+			std::lock_guard<std::mutex> guard(queues[i]->lock);
+			queues[i]->begin = chunks * i / n;
+			queues[i]->end = chunks * (i + 1) / n;
+		}
+
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			invoke = &invokeFunctor<Functor>;
+			job = const_cast<void*>(static_cast<const void*>(&fn));
+			cancelled = false;
+			error = nullptr;
+			busy = workers.size();
+			++jobNumber;
+		}
+		wake.notify_all();
+
+		// Pitch in, then wait for everyone else to finish theirs.
+		work(0);
+
+		std::unique_lock<std::mutex> guard(lock);
+		done.wait(guard, [this] { return busy == 0; });
+		invoke = nullptr;
+		job = nullptr;
+
+		if (error) {
+			std::exception_ptr toThrow = error;
+			error = nullptr;
+			std::rethrow_exception(toThrow);
+		}
+	}
+
+	/// The copy constructor is deleted (see Pool)
+	WorkStealingExecutor(const WorkStealingExecutor&) = delete;
+
+	/// The assignment operator is deleted (see Pool)
+	WorkStealingExecutor& operator=(const WorkStealingExecutor&) = delete;
+
+private:
+
+	/**
+	 * \brief The chunks a thread has yet to run, [begin, end)
+	 *
+	 * The owner takes chunks off the front, and thieves take them off the back.
+	 * The padding keeps each thread's queue off its neighbors' cache lines.
+	 */
+	struct Queue {
+		std::mutex lock;
+		size_t begin;
+		size_t end;
+		char padding[64];
+
+		Queue() : lock(), begin(0), end(0), padding() { }
+	};
+
+	/// Calls a functor of type Fn through a type-erased pointer
+	template <typename Fn>
+	static void invokeFunctor(void* fn, size_t chunk) { (*static_cast<Fn*>(fn))(chunk); }
+
+	/// What each worker thread runs until the executor is destroyed
+	void workerLoop(size_t self)
+	{
+		size_t lastJob = 0;
+		for (;;) {
+			{
+				std::unique_lock<std::mutex> guard(lock);
+				wake.wait(guard, [&] { return stopping || jobNumber != lastJob; });
+				if (stopping)
+					return;
+				lastJob = jobNumber;
+			}
+
+			work(self);
+
+			std::lock_guard<std::mutex> guard(lock);
+			if (--busy == 0)
+				done.notify_all();
+		}
+	}
+
+	/// Runs chunks, first our own and then stolen ones, until there are none left anywhere
+	void work(size_t self)
+	{
+		size_t chunk;
+		while (takeOwn(self, chunk) || steal(self, chunk)) {
+			if (cancelled)
+				continue; // Drain the queues without running anything.
+
+			try {
+				invoke(job, chunk);
+			}
+			catch (...) {
+				std::lock_guard<std::mutex> guard(lock);
+				if (!error)
+					error = std::current_exception();
+				cancelled = true;
+			}
+		}
+	}
+
+	/// Takes the next chunk off the front of our own queue
+	bool takeOwn(size_t self, size_t& chunk)
+	{
+		Queue& q = *queues[self];
+		std::lock_guard<std::mutex> guard(q.lock);
+		if (q.begin == q.end)
+			return false;
+
+		chunk = q.begin++;
+		return true;
+	}
+
+	/**
+	 * \brief Steals the back half of another thread's queue
+	 * \returns false if every queue is empty
+	 *
+	 * The first stolen chunk is handed back to run, and the rest go in our own (empty) queue,
+	 * where other thieves can in turn steal from them.
+	 */
+	bool steal(size_t self, size_t& chunk)
+	{
+		const size_t n = queues.size();
+		for (size_t i = 1; i < n; ++i) {
+			Queue& victim = *queues[(self + i) % n];
+			size_t first, last;
+			{
+				std::lock_guard<std::mutex> guard(victim.lock);
+				const size_t left = victim.end - victim.begin;
+				if (left == 0)
+					continue;
+
+				last = victim.end;
+				victim.end -= (left + 1) / 2;
+				first = victim.end;
+			}
+
+			chunk = first;
+			Queue& mine = *queues[self];
+			std::lock_guard<std::mutex> guard(mine.lock);
+			mine.begin = first + 1;
+			mine.end = last;
+			return true;
+		}
+		return false;
+	}
+
+	/// Tells the workers to exit and waits for them to do so
+	void stop()
+	{
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			stopping = true;
+		}
+		wake.notify_all();
+
+		for (std::thread& t : workers)
+			t.join();
+		workers.clear();
+	}
+
+	std::vector<std::thread> workers; ///< Our threads (the caller of forEachChunk is thread 0)
+	std::vector<std::unique_ptr<Queue>> queues; ///< Each thread's remaining chunks
+	std::mutex submitLock; ///< Makes concurrent calls to forEachChunk take turns
+	std::mutex lock; ///< Guards everything below
+	std::condition_variable wake; ///< Signalled when there is a new job or we are stopping
+	std::condition_variable done; ///< Signalled when the last worker finishes a job
+	void (*invoke)(void*, size_t); ///< Calls the current job's functor
+	void* job; ///< The current job's functor
+	size_t jobNumber; ///< Incremented for each job, so workers can tell a new one from the last
+	size_t busy; ///< The number of workers yet to finish the current job
+	std::atomic<bool> cancelled; ///< Set when a chunk throws, so the rest are skipped
+	std::exception_ptr error; ///< The first exception thrown by the current job
+	bool stopping; ///< Set when the workers should exit
+};
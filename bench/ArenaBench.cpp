@@ -0,0 +1,94 @@
+#include "ArenaBench.hpp"
+
+#include <vector>
+
+#include "Arena.hpp"
+#include "Bench.hpp"
+#include "Pool.hpp"
+
+using namespace std;
+using namespace Benchmarking;
+
+namespace {
+
+/// A small temporary, like a parsed header or a message fragment
+struct Temporary {
+	int a, b;
+	double c;
+
+	Temporary(int a, int b) : a(a), b(b), c(a * 0.5) { }
+};
+
+/// The number of requests each run handles
+const size_t requests = 1 << 16;
+
+/// The number of temporaries each request makes
+const size_t perRequest = 64;
+
+/// Times making a request's worth of temporaries and throwing them all away, many times over
+void requestScoped()
+{
+	vector<Temporary*> live;
+	live.reserve(perRequest);
+
+	const double heapSeconds = bestOf(3, [&] {
+		for (size_t r = 0; r < requests; ++r) {
+			for (size_t i = 0; i < perRequest; ++i)
+				live.push_back(new Temporary((int)r, (int)i));
+			doNotOptimize(live.back()->c);
+			for (Temporary* t : live)
+				delete t;
+			live.clear();
+		}
+	});
+
+	Pool<Temporary> pool(perRequest);
+	const double poolSeconds = bestOf(3, [&] {
+		for (size_t r = 0; r < requests; ++r) {
+			for (size_t i = 0; i < perRequest; ++i)
+				live.push_back(pool.construct((int)r, (int)i));
+			doNotOptimize(live.back()->c);
+			for (Temporary* t : live)
+				pool.destroy(t);
+			live.clear();
+		}
+	});
+
+	Arena arena;
+	const double arenaSeconds = bestOf(3, [&] {
+		for (size_t r = 0; r < requests; ++r) {
+			Temporary* last = nullptr;
+			for (size_t i = 0; i < perRequest; ++i)
+				last = arena.construct<Temporary>((int)r, (int)i);
+			doNotOptimize(last->c);
+			arena.reset();
+		}
+	});
+
+	FrameArena frames;
+	const double frameSeconds = bestOf(3, [&] {
+		for (size_t r = 0; r < requests; ++r) {
+			Temporary* last = nullptr;
+			for (size_t i = 0; i < perRequest; ++i)
+				last = frames.construct<Temporary>((int)r, (int)i);
+			doNotOptimize(last->c);
+			frames.nextFrame();
+		}
+	});
+
+	const double total = double(requests * perRequest);
+	printf("%zu requests of %zu temporaries each:\n", requests, perRequest);
+	printf("%12s %10s %10s\n", "", "ms", "Mops/s");
+	printf("%12s %10.2f %10.1f\n", "new/delete", heapSeconds * 1e3, total / heapSeconds / 1e6);
+	printf("%12s %10.2f %10.1f\n", "Pool", poolSeconds * 1e3, total / poolSeconds / 1e6);
+	printf("%12s %10.2f %10.1f\n", "Arena", arenaSeconds * 1e3, total / arenaSeconds / 1e6);
+	printf("%12s %10.2f %10.1f\n", "FrameArena", frameSeconds * 1e3, total / frameSeconds / 1e6);
+}
+
+} // end namespace anonymous
+
+void Benchmarking::runArenaBenchmarks()
+{
+	beginSuite("Arena");
+	requestScoped();
+}
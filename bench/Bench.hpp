@@ -0,0 +1,47 @@
+#ifndef __MKB_BENCH_HPP__
+#define __MKB_BENCH_HPP__
+
+#include <chrono>
+#include <cstdio>
+
+namespace Benchmarking {
+
+/// Just prints a "starting benchmark suite Foo"
+inline void beginSuite(const char* suiteName)
+{
+	printf("\nStarting benchmark suite %s\n", suiteName);
+}
+
+/// Runs a function and returns how long it took, in seconds
+template <typename F>
+inline double timeSeconds(F f)
+{
+	const auto start = std::chrono::steady_clock::now();
+	f();
+	const auto end = std::chrono::steady_clock::now();
+	return std::chrono::duration<double>(end - start).count();
+}
+
+/// Runs a function a few times and returns the fastest run, in seconds
+template <typename F>
+inline double bestOf(int runs, F f)
+{
+	double best = timeSeconds(f);
+	for (int i = 1; i < runs; ++i) {
+		const double t = timeSeconds(f);
+		if (t < best)
+			best = t;
+	}
+	return best;
+}
+
+/// Keeps the optimizer from throwing away a value we computed but never used
+template <typename T>
+inline void doNotOptimize(const T& value)
+{
+	asm volatile("" : : "r,m"(value) : "memory");
+}
+
+} // end namespace Benchmarking
+
+#endif
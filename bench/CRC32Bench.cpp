@@ -0,0 +1,98 @@
+#include "CRC32Bench.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#include "Bench.hpp"
+#include "CRC32Generator.hpp"
+#include "WorkStealingExecutor.hpp"
+
+using namespace std;
+using namespace Benchmarking;
+
+namespace {
+
+/// The amount of data checksummed per run
+const size_t bufferSize = 64 << 20;
+
+typedef uint32_t (CRC32Generator::*Kernel)(const void*, size_t) const;
+
+/// Times one kernel over the buffer and prints its throughput
+void timeKernel(const char* name, const CRC32Generator& crc, Kernel kernel,
+                const vector<uint8_t>& buffer)
+{
+	uint32_t result = 0;
+	const double seconds = bestOf(3, [&] {
+		result = (crc.*kernel)(buffer.data(), buffer.size());
+		doNotOptimize(result);
+	});
+	printf("%12s %10.2f %10.2f %10.8x\n", name, seconds * 1e3,
+	       buffer.size() / seconds / (1 << 30), result);
+}
+
+/// Returns a buffer of junk to checksum
+vector<uint8_t> makeBuffer()
+{
+	vector<uint8_t> buffer(bufferSize);
+	for (size_t i = 0; i < buffer.size(); ++i)
+		buffer[i] = (uint8_t)(i * 2654435761u >> 24);
+	return buffer;
+}
+
+/// Compares the throughput of each kernel on a large buffer
+void kernels()
+{
+	const vector<uint8_t> buffer = makeBuffer();
+	const CRC32Generator crc;
+	printf("CRC-32 of %zu MiB:\n", bufferSize >> 20);
+	printf("%12s %10s %10s %10s\n", "", "ms", "GiB/s", "CRC");
+	timeKernel("bytewise", crc, &CRC32Generator::CRC32GenerateBytewise, buffer);
+	timeKernel("slicing-8", crc, &CRC32Generator::CRC32GenerateSlicingBy8, buffer);
+	timeKernel("slicing-16", crc, &CRC32Generator::CRC32GenerateSlicingBy16, buffer);
+	timeKernel("folding", crc, &CRC32Generator::CRC32GenerateFolding, buffer);
+}
+
+/// Compares the throughput of CRC-32C with and without the crc32 instruction
+void castagnoli()
+{
+	const vector<uint8_t> buffer = makeBuffer();
+	const CRC32Generator crc(CRC32Generator::CastagnoliPolynomial);
+	printf("CRC-32C of %zu MiB:\n", bufferSize >> 20);
+	printf("%12s %10s %10s %10s\n", "", "ms", "GiB/s", "CRC");
+	timeKernel("slicing-16", crc, &CRC32Generator::CRC32GenerateSlicingBy16, buffer);
+	timeKernel("folding", crc, &CRC32Generator::CRC32GenerateFolding, buffer);
+	timeKernel("instruction", crc, &CRC32Generator::CRC32GenerateInstruction, buffer);
+}
+
+/// Times CRC32GenerateParallel on more and more threads, up to one per core (or at least four)
+void parallel()
+{
+	const vector<uint8_t> buffer = makeBuffer();
+	const CRC32Generator crc;
+	const size_t cores = thread::hardware_concurrency();
+	printf("CRC-32 of %zu MiB on %zu cores:\n", bufferSize >> 20, cores);
+	printf("%12s %10s %10s %10s\n", "threads", "ms", "GiB/s", "CRC");
+
+	for (size_t threads = 1; threads <= max<size_t>(cores, 4); threads *= 2) {
+		WorkStealingExecutor executor(threads);
+		uint32_t result = 0;
+		const double seconds = bestOf(3, [&] {
+			result = crc.CRC32GenerateParallel(buffer.data(), buffer.size(), executor);
+			doNotOptimize(result);
+		});
+		printf("%12zu %10.2f %10.2f %10.8x\n", threads, seconds * 1e3,
+		       buffer.size() / seconds / (1 << 30), result);
+	}
+}
+
+} // end namespace anonymous
+
+void Benchmarking::runCRC32Benchmarks()
+{
+	beginSuite("CRC32Generator");
+	kernels();
+	castagnoli();
+	parallel();
+}
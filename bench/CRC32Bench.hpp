@@ -0,0 +1,7 @@
+#pragma once
+
+namespace Benchmarking {
+
+void runCRC32Benchmarks();
+
+} // end namespace Benchmarking
@@ -0,0 +1,107 @@
+#include "ConcurrentPoolBench.hpp"
+
+#include <algorithm>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "Bench.hpp"
+#include "ConcurrentPool.hpp"
+#include "Pool.hpp"
+
+using namespace std;
+using namespace Benchmarking;
+
+namespace {
+
+/// A payload about the size of a typical small game object or message
+struct Payload {
+	Payload(int a) : a(a), b(), c(), d() { }
+
+	int a;
+	double b, c, d;
+};
+
+/// Each thread repeatedly builds up a batch of this many objects, then tears it down
+const size_t batchSize = 64;
+
+/// The number of objects each thread constructs (and destroys) per run
+const size_t perThread = 1 << 20;
+
+/// Runs _work_ on _threads_ threads at once and returns how long it took
+template <typename F>
+double runThreads(unsigned threads, F work)
+{
+	return bestOf(3, [&] {
+		vector<thread> pool;
+		for (unsigned t = 0; t < threads; ++t)
+			pool.emplace_back(work);
+		for (thread& t : pool)
+			t.join();
+	});
+}
+
+/// A Pool wrapped in a mutex, which is what we're trying to beat
+double mutexPool(unsigned threads)
+{
+	Pool<Payload> aPool(threads * batchSize);
+	mutex lock;
+
+	return runThreads(threads, [&] {
+		Payload* batch[batchSize];
+		for (size_t done = 0; done < perThread; done += batchSize) {
+			for (size_t i = 0; i < batchSize; ++i) {
+				lock_guard<mutex> guard(lock);
+				batch[i] = aPool.construct((int)i);
+			}
+			for (size_t i = 0; i < batchSize; ++i) {
+				lock_guard<mutex> guard(lock);
+				aPool.destroy(batch[i]);
+			}
+		}
+	});
+}
+
+/// A ConcurrentPool with a cache per thread
+double magazinePool(unsigned threads)
+{
+	typedef ConcurrentPool<Payload> PayloadPool;
+	PayloadPool aPool(threads * (batchSize + 3 * PayloadPool::magazineSize));
+
+	return runThreads(threads, [&] {
+		PayloadPool::Cache cache(aPool);
+		Payload* batch[batchSize];
+		for (size_t done = 0; done < perThread; done += batchSize) {
+			for (size_t i = 0; i < batchSize; ++i)
+				batch[i] = cache.construct((int)i);
+			for (size_t i = 0; i < batchSize; ++i)
+				cache.destroy(batch[i]);
+		}
+	});
+}
+
+} // end namespace anonymous
+
+void Benchmarking::runConcurrentPoolBenchmarks()
+{
+	beginSuite("ConcurrentPool");
+
+	const unsigned maxThreads = max(thread::hardware_concurrency(), 1u);
+
+	vector<unsigned> threadCounts;
+	for (unsigned t = 1; t < maxThreads; t *= 2)
+		threadCounts.push_back(t);
+	threadCounts.push_back(maxThreads);
+
+	printf("Each thread constructs and destroys %zu objects in batches of %zu\n",
+	       perThread, batchSize);
+	printf("%8s %18s %18s %8s\n", "threads", "mutex Mops/s", "magazine Mops/s", "speedup");
+
+	for (unsigned threads : threadCounts) {
+		// Each object is one construct and one destroy
+		const double ops = 2.0 * perThread * threads / 1e6;
+		const double mutexRate = ops / mutexPool(threads);
+		const double magazineRate = ops / magazinePool(threads);
+		printf("%8u %18.1f %18.1f %7.1fx\n", threads, mutexRate, magazineRate, magazineRate / mutexRate);
+	}
+}
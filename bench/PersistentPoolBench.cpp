@@ -0,0 +1,115 @@
+#include "PersistentPoolBench.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "Bench.hpp"
+#include "PersistentPool.hpp"
+#include "Pool.hpp"
+
+using namespace std;
+using namespace Benchmarking;
+
+namespace {
+
+/// A record, like one we might load from a database
+struct Record {
+	uint32_t id;
+	uint32_t owner;
+	double balance;
+	char name[16];
+};
+
+/// The number of records in the benchmark
+const size_t recordCount = 1 << 20;
+
+/// Fills in a record from a line of text, as if it came out of a database
+const char* parseRecord(const char* line, Record& r)
+{
+	char* end;
+	r.id = (uint32_t)strtoul(line, &end, 10);
+	r.owner = (uint32_t)strtoul(end + 1, &end, 10);
+	r.balance = strtod(end + 1, &end);
+	snprintf(r.name, sizeof(r.name), "record %u", r.id);
+	return end + 1;
+}
+
+/// Compares reopening a pool from its file against rebuilding it from a text dump
+void openVersusRebuild()
+{
+	// Stand in for the database with a dump of every record.
+	string dump;
+	dump.reserve(recordCount * 24);
+	char line[64];
+	for (size_t i = 0; i < recordCount; ++i) {
+		snprintf(line, sizeof(line), "%zu,%zu,%.2f\n", i, i % 977, i * 0.25);
+		dump += line;
+	}
+
+	double checksum = 0;
+	const double rebuildSeconds = bestOf(3, [&] {
+		Pool<Record> pool(recordCount);
+		const char* cursor = dump.c_str();
+		for (size_t i = 0; i < recordCount; ++i) {
+			Record* r = pool.construct();
+			cursor = parseRecord(cursor, *r);
+		}
+		double sum = 0;
+		for (const Record& r : pool)
+			sum += r.balance;
+		checksum = sum;
+		pool.clear();
+	});
+
+	const string path = "/tmp/mkb_bench_" + to_string(getpid()) + ".pool";
+	unlink(path.c_str());
+	const double createSeconds = timeSeconds([&] {
+		PersistentPool<Record> pool(path, recordCount);
+		const char* cursor = dump.c_str();
+		for (size_t i = 0; i < recordCount; ++i) {
+			Record* r = pool.construct();
+			cursor = parseRecord(cursor, *r);
+		}
+	});
+
+	// Throw the file out of the page cache so that opening it has to hit the disk.
+	const auto evict = [&] {
+		const int fd = open(path.c_str(), O_RDONLY);
+		posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+		close(fd);
+	};
+
+	double reopened = 0;
+	const auto reopen = [&] {
+		PersistentPool<Record> pool(path, recordCount);
+		double sum = 0;
+		pool.forEach([&](const Record& r) { sum += r.balance; });
+		reopened = sum;
+	};
+
+	evict();
+	const double coldSeconds = timeSeconds(reopen);
+	const double warmSeconds = bestOf(3, reopen);
+
+	printf("%zu records of %zu bytes, then a pass over all of them:\n", recordCount, sizeof(Record));
+	printf("%28s %10.2f ms\n", "Rebuilding from a dump", rebuildSeconds * 1e3);
+	printf("%28s %10.2f ms\n", "Building the file", createSeconds * 1e3);
+	printf("%28s %10.2f ms\n", "Reopening (cold cache)", coldSeconds * 1e3);
+	printf("%28s %10.2f ms\n", "Reopening (warm cache)", warmSeconds * 1e3);
+	if (reopened != checksum)
+		printf("The reopened pool doesn't match! (%f vs %f)\n", reopened, checksum);
+
+	unlink(path.c_str());
+}
+
+} // end namespace anonymous
+
+void Benchmarking::runPersistentPoolBenchmarks()
+{
+	beginSuite("PersistentPool");
+	openVersusRebuild();
+}
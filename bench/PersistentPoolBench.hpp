@@ -0,0 +1,7 @@
+#pragma once
+
+namespace Benchmarking {
+
+void runPersistentPoolBenchmarks();
+
+} // end namespace Benchmarking
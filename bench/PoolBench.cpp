@@ -0,0 +1,174 @@
+#include "PoolBench.hpp"
+
+#include <random>
+#include <vector>
+
+#include "Bench.hpp"
+#include "ParallelForEach.hpp"
+#include "Pool.hpp"
+
+using namespace std;
+using namespace Benchmarking;
+
+namespace {
+
+/// A payload about the size of a typical small game object or message
+struct Payload {
+	int a;
+	double b, c, d;
+};
+
+/// The number of slots in the fragmentation benchmark's pool
+const size_t poolSize = 1 << 16;
+
+/// The number of phases the fragmentation benchmark reports on
+const int phases = 8;
+
+/// The number of allocations or deallocations in each phase
+const size_t opsPerPhase = 1 << 18;
+
+/// The largest block the fragmentation benchmark asks for
+const size_t maxBlock = 32;
+
+/// Interleaves random-size allocations and frees, reporting how the pool holds up over time
+void fragmentation()
+{
+	Pool<Payload> aPool(poolSize);
+	vector<pair<Payload*, size_t>> blocks;
+	minstd_rand rng(42);
+	size_t failures = 0;
+
+	printf("Random blocks of 1 to %zu slots in a pool of %zu, %zu operations per phase\n",
+	       maxBlock, poolSize, opsPerPhase);
+	printf("%6s %10s %10s %12s %10s\n", "phase", "Mops/s", "occupancy", "largest run", "failures");
+
+	for (int phase = 0; phase < phases; ++phase) {
+		const double seconds = timeSeconds([&] {
+			for (size_t op = 0; op < opsPerPhase; ++op) {
+				// Aim for about 3/4 full, so that the pool stays under pressure.
+				const bool grow = blocks.empty() || aPool.size() < poolSize * 3 / 4
+					? rng() % 4 != 0
+					: rng() % 4 == 0;
+
+				if (grow) {
+					// Favor small blocks, like most containers do.
+					const size_t num = 1 + (rng() % maxBlock) * (rng() % maxBlock) / maxBlock;
+					try {
+						blocks.emplace_back(aPool.allocate(num), num);
+					}
+					catch (const std::bad_alloc&) {
+						++failures;
+					}
+				}
+				else {
+					const size_t which = rng() % blocks.size();
+					aPool.deallocate(blocks[which].first, blocks[which].second);
+					blocks[which] = blocks.back();
+					blocks.pop_back();
+				}
+			}
+		});
+
+		printf("%6d %10.2f %9.1f%% %12zu %10zu\n", phase, opsPerPhase / seconds / 1e6,
+		       100.0 * aPool.size() / poolSize, aPool.largestFreeRun(), failures);
+	}
+
+	for (const auto& b : blocks)
+		aPool.deallocate(b.first, b.second);
+}
+
+/// Times constructing a big, mostly-empty pool and using a sliver of it
+void construction()
+{
+	const size_t hugeSize = size_t(1) << 24;
+	const double seconds = bestOf(3, [&] {
+		Pool<Payload> aPool(hugeSize);
+		for (int i = 0; i < 1000; ++i)
+			doNotOptimize(aPool.construct());
+		aPool.clear();
+	});
+
+	printf("Constructing a pool of %zu slots and using 1000 of them: %.3f ms\n",
+	       hugeSize, seconds * 1e3);
+}
+
+/// Times iterating over a sparse pool before and after compacting it
+void compaction()
+{
+	const size_t sparseSize = 1 << 20;
+	Pool<Payload> aPool(sparseSize);
+	vector<Payload*> objects;
+	for (size_t i = 0; i < sparseSize; ++i)
+		objects.push_back(aPool.construct());
+
+	// Leave about 10% of the objects, scattered across the buffer.
+	minstd_rand rng(7);
+	for (Payload* p : objects) {
+		if (rng() % 10 != 0)
+			aPool.destroy(p);
+	}
+
+	const auto sweep = [&] {
+		for (Payload& p : aPool)
+			p.b += p.c;
+	};
+
+	const double before = bestOf(5, sweep);
+	size_t moved = 0;
+	const double compacting = timeSeconds([&] {
+		moved = aPool.compact([](const Pool<Payload>::Relocation&) { }, true);
+	});
+	const double after = bestOf(5, sweep);
+
+	printf("Iterating over %zu of %zu slots: %.2f ms sparse, %.2f ms compacted "
+	       "(moving %zu objects took %.2f ms)\n",
+	       aPool.size(), sparseSize, before * 1e3, after * 1e3, moved, compacting * 1e3);
+
+	aPool.clear();
+}
+
+/// Times a per-frame update pass over a pool whose objects are bunched up at one end
+void parallelUpdate()
+{
+	const size_t updateSize = 1 << 20;
+	Pool<Payload> aPool(updateSize);
+	vector<Payload*> objects;
+	for (size_t i = 0; i < updateSize; ++i)
+		objects.push_back(aPool.construct());
+
+	// Leave the first quarter dense and the rest sparse.
+	for (size_t i = updateSize / 4; i < updateSize; ++i) {
+		if (i % 16 != 0)
+			aPool.destroy(objects[i]);
+	}
+
+	const auto update = [](Payload& p) {
+		p.b += p.c * 0.5;
+		p.d = p.b * p.c;
+		++p.a;
+	};
+
+	const double serial = bestOf(5, [&] {
+		for (Payload& p : aPool)
+			update(p);
+	});
+
+	WorkStealingExecutor executor;
+	const double parallel = bestOf(5, [&] { parallelForEach(executor, aPool, update); });
+
+	printf("Updating %zu objects: %.2f ms serially, %.2f ms on %zu threads\n",
+	       aPool.size(), serial * 1e3, parallel * 1e3, executor.threadCount());
+
+	aPool.clear();
+}
+
+} // end namespace anonymous
+
+void Benchmarking::runPoolBenchmarks()
+{
+	beginSuite("Pool");
+	construction();
+	fragmentation();
+	compaction();
+	parallelUpdate();
+}
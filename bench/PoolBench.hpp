@@ -0,0 +1,7 @@
+#pragma once
+
+namespace Benchmarking {
+
+void runPoolBenchmarks();
+
+} // end namespace Benchmarking
@@ -0,0 +1,105 @@
+#include "SmallObjectAllocatorBench.hpp"
+
+#include <cstdlib>
+#include <list>
+#include <map>
+#include <random>
+#include <vector>
+
+#include "Bench.hpp"
+#include "SmallObjectAllocator.hpp"
+
+using namespace std;
+using namespace Benchmarking;
+
+namespace {
+
+/// The number of blocks live at once in the churn benchmark
+const size_t liveBlocks = 1 << 14;
+
+/// The number of allocate/free pairs in the churn benchmark
+const size_t churnOps = 1 << 22;
+
+/// The number of nodes in the container benchmarks
+const int nodes = 1 << 18;
+
+/// Generates request sizes skewed toward small ones, like most programs' allocations
+vector<size_t> requestSizes()
+{
+	minstd_rand rng(42);
+	vector<size_t> sizes(churnOps);
+	for (size_t& s : sizes)
+		s = 8 + (rng() % 16) * (rng() % 16) * 4; // 8 to 908 bytes, mostly small
+	return sizes;
+}
+
+/// Keeps a working set of blocks of random sizes, replacing one at random with each op
+template <typename Alloc, typename Free>
+double churn(const vector<size_t>& sizes, Alloc alloc, Free release)
+{
+	return bestOf(3, [&] {
+		vector<pair<void*, size_t>> live(liveBlocks);
+		for (size_t i = 0; i < liveBlocks; ++i)
+			live[i] = make_pair(alloc(sizes[i]), sizes[i]);
+
+		for (size_t i = liveBlocks; i < churnOps; ++i) {
+			// The sizes are random, so use them to pick a victim too.
+			pair<void*, size_t>& victim = live[(i * 2654435761u) % liveBlocks];
+			release(victim.first, victim.second);
+			victim = make_pair(alloc(sizes[i]), sizes[i]);
+		}
+
+		for (const auto& b : live)
+			release(b.first, b.second);
+	});
+}
+
+/// Fills and drains a std::map and a std::list
+template <typename MapType, typename ListType>
+double containers(const MapType& protoMap, const ListType& protoList)
+{
+	return bestOf(3, [&] {
+		MapType m(protoMap);
+		ListType l(protoList);
+		for (int i = 0; i < nodes; ++i) {
+			m.emplace((i * 2654435761u) % nodes, i);
+			l.push_back(i);
+		}
+		doNotOptimize(m.size() + l.size());
+
+		for (int i = 0; i < nodes; i += 2)
+			m.erase((i * 2654435761u) % nodes);
+		l.remove_if([](int i) { return i % 3 == 0; });
+		doNotOptimize(m.size() + l.size());
+	});
+}
+
+} // end namespace anonymous
+
+void Benchmarking::runSmallObjectAllocatorBenchmarks()
+{
+	beginSuite("SmallObjectAllocator");
+
+	const vector<size_t> sizes = requestSizes();
+	SmallObjectAllocator soa;
+
+	printf("Random-size churn: %zu allocate/free pairs, %zu blocks live\n", churnOps, liveBlocks);
+	const double mallocTime = churn(sizes,
+		[](size_t bytes) { return malloc(bytes); },
+		[](void* p, size_t) { free(p); });
+	const double soaTime = churn(sizes,
+		[&](size_t bytes) { return soa.allocate(bytes); },
+		[&](void* p, size_t bytes) { soa.deallocate(p, bytes); });
+	printf("%20s %10.3f s\n%20s %10.3f s (%.2fx)\n",
+	       "malloc", mallocTime, "SmallObjectAllocator", soaTime, mallocTime / soaTime);
+
+	printf("std::map and std::list with %d nodes\n", nodes);
+	typedef SmallObjectStlAllocator<pair<const int, int>> MapAlloc;
+	typedef SmallObjectStlAllocator<int> ListAlloc;
+	const double stdTime = containers(map<int, int>(), list<int>());
+	const double adaptedTime = containers(
+		map<int, int, less<int>, MapAlloc>(less<int>(), MapAlloc(soa)),
+		list<int, ListAlloc>(ListAlloc(soa)));
+	printf("%20s %10.3f s\n%20s %10.3f s (%.2fx)\n",
+	       "std::allocator", stdTime, "SmallObjectAllocator", adaptedTime, stdTime / adaptedTime);
+}
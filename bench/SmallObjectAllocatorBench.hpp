@@ -0,0 +1,7 @@
+#pragma once
+
+namespace Benchmarking {
+
+void runSmallObjectAllocatorBenchmarks();
+
+} // end namespace Benchmarking
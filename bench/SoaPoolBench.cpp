@@ -0,0 +1,83 @@
+#include "SoaPoolBench.hpp"
+
+#include "Bench.hpp"
+#include "Pool.hpp"
+#include "SoaPool.hpp"
+
+using namespace std;
+using namespace Benchmarking;
+
+namespace {
+
+/// A typical particle, 64 bytes in all
+struct Particle {
+	float x, y, z;
+	float vx, vy, vz;
+	float mass;
+	float age;
+	int id;
+	int flags;
+	float color[6];
+};
+
+/// A particle's color, which is always used as a whole
+struct Color {
+	float channels[6];
+};
+
+/// The same fields, one column each (the color is left as one 24-byte column)
+typedef SoaPool<float, float, float, float, float, float, float, float, int, int, Color>
+	ParticleColumns;
+
+/// The number of particles in each pool
+const size_t particleCount = 1 << 20;
+
+/// Times aging every particle, which only touches one field
+void singleFieldSweep()
+{
+	Pool<Particle> aos(particleCount);
+	ParticleColumns soa(particleCount);
+	for (size_t i = 0; i < particleCount; ++i) {
+		aos.construct();
+		soa.construct();
+	}
+
+	const float dt = 1.0f / 60;
+
+	const double aosSeconds = bestOf(5, [&] {
+		for (Particle& p : aos)
+			p.age += dt;
+	});
+
+	const double soaSeconds = bestOf(5, [&] {
+		soa.forEach<7>([=](float& age) { age += dt; });
+	});
+
+	// Nothing has been destroyed, so the column can be swept as a plain array.
+	const double arraySeconds = bestOf(5, [&] {
+		float* ages = soa.column<7>();
+		const size_t n = soa.highWaterMark();
+		for (size_t i = 0; i < n; ++i)
+			ages[i] += dt;
+	});
+
+	printf("Sweeping one field of %zu %zu-byte particles:\n", particleCount, sizeof(Particle));
+	printf("%10s %10s %10s\n", "", "ms", "Mitems/s");
+	printf("%10s %10.2f %10.1f\n", "Pool", aosSeconds * 1e3, particleCount / aosSeconds / 1e6);
+	printf("%10s %10.2f %10.1f\n", "SoaPool", soaSeconds * 1e3, particleCount / soaSeconds / 1e6);
+	printf("%10s %10.2f %10.1f\n", "column", arraySeconds * 1e3, particleCount / arraySeconds / 1e6);
+
+	doNotOptimize(aos.begin()->age);
+	doNotOptimize(soa.get<7>(0));
+
+	aos.clear();
+	soa.clear();
+}
+
+} // end namespace anonymous
+
+void Benchmarking::runSoaPoolBenchmarks()
+{
+	beginSuite("SoaPool");
+	singleFieldSweep();
+}
@@ -0,0 +1,7 @@
+#pragma once
+
+namespace Benchmarking {
+
+void runSoaPoolBenchmarks();
+
+} // end namespace Benchmarking
@@ -0,0 +1,25 @@
+#include <cstdio>
+
+#include "Bench.hpp"
+#include "ArenaBench.hpp"
+#include "CRC32Bench.hpp"
+#include "PoolBench.hpp"
+#include "PersistentPoolBench.hpp"
+#include "ConcurrentPoolBench.hpp"
+#include "SmallObjectAllocatorBench.hpp"
+#include "SoaPoolBench.hpp"
+
+int main()
+{
+	using namespace Benchmarking;
+
+	printf("Running benchmarks...\n");
+	runPoolBenchmarks();
+	runConcurrentPoolBenchmarks();
+	runSmallObjectAllocatorBenchmarks();
+	runSoaPoolBenchmarks();
+	runArenaBenchmarks();
+	runPersistentPoolBenchmarks();
+	runCRC32Benchmarks();
+	return 0;
+}
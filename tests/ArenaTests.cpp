@@ -0,0 +1,184 @@
+#include "ArenaTests.hpp"
+
+#include <cstdint>
+#include <list>
+#include <map>
+#include <stdexcept>
+#include <vector>
+
+#include "Test.hpp"
+#include "Arena.hpp"
+
+using namespace std;
+using namespace Testing;
+
+namespace {
+
+/// Records the order in which instances are destroyed
+class Tracked {
+public:
+
+	Tracked(int id) : id(id)
+	{
+		if (id < 0)
+			throw std::runtime_error("Negative tracked ID");
+	}
+
+	~Tracked() { destroyed.push_back(id); }
+
+	int id;
+
+	static vector<int> destroyed;
+};
+
+vector<int> Tracked::destroyed;
+
+struct alignas(64) Wide {
+	char bytes[64];
+};
+
+/// Test basic allocation, alignment, and growth
+void allocation()
+{
+	Arena arena(1024);
+	assertThrown<invalid_argument>([] { Arena bad(0); });
+
+	char* a = static_cast<char*>(arena.allocate(10, 1));
+	char* b = static_cast<char*>(arena.allocate(10, 1));
+	assert(b == a + 10);
+	assert(arena.used() == 20);
+
+	Wide* w = arena.construct<Wide>();
+	assert(reinterpret_cast<uintptr_t>(w) % 64 == 0);
+	assertThrown<invalid_argument>([&] { arena.allocate(8, 3); });
+
+	// Filling the first block should chain on another.
+	for (int i = 0; i < 300; ++i)
+		assert(*arena.construct<int>(i) == i);
+	assert(arena.capacity() > 1024);
+
+	// Allocations bigger than a block get one to themselves.
+	double* big = arena.allocateArray<double>(10000);
+	big[9999] = 1.0;
+	assert(arena.capacity() >= 1024 + 80000);
+
+	assertThrown<bad_alloc>([&] { arena.allocateArray<double>(size_t(-1) / 4); });
+}
+
+/// Test rewinding to markers and resetting
+void rewinding()
+{
+	Arena arena(256);
+	arena.construct<int>(1);
+	const Arena::Marker m = arena.mark();
+	const size_t usedAtMark = arena.used();
+
+	void* first = arena.allocate(100);
+	for (int i = 0; i < 20; ++i)
+		arena.allocate(100);
+	const size_t grown = arena.capacity();
+
+	// Rewinding should reuse the same memory without growing.
+	arena.rewind(m);
+	assert(arena.used() == usedAtMark);
+	assert(arena.allocate(100) == first);
+	for (int i = 0; i < 20; ++i)
+		arena.allocate(100);
+	assert(arena.capacity() == grown);
+
+	arena.reset();
+	assert(arena.used() == 0);
+	arena.shrink();
+	assert(arena.capacity() == 256);
+}
+
+/// Test that tracked objects are destroyed, newest first, when they are rewound past
+void destructors()
+{
+	Tracked::destroyed.clear();
+	{
+		Arena arena;
+		arena.construct<Tracked>(1);
+		const Arena::Marker m = arena.mark();
+		arena.construct<Tracked>(2);
+		arena.construct<Tracked>(3);
+		arena.constructUntracked<Tracked>(99);
+
+		arena.rewind(m);
+		assert(Tracked::destroyed == vector<int>({3, 2}));
+
+		// A throwing constructor leaves nothing behind.
+		const size_t used = arena.used();
+		assertThrown<runtime_error>([&] { arena.construct<Tracked>(-1); });
+		assert(arena.used() == used);
+
+		arena.construct<Tracked>(4);
+	}
+	assert(Tracked::destroyed == vector<int>({3, 2, 4, 1}));
+}
+
+/// Test using the arena with standard library containers
+void forSTL()
+{
+	Arena arena(4096);
+	{
+		vector<int, ArenaAllocator<int>> vec{ArenaAllocator<int>(arena)};
+		for (int i = 0; i < 1000; ++i)
+			vec.push_back(i);
+		assert(vec[999] == 999);
+
+		list<int, ArenaAllocator<int>> lst{ArenaAllocator<int>(arena)};
+		lst.push_back(1);
+		lst.push_back(2);
+		assert(lst.back() == 2);
+
+		typedef map<int, int, less<int>, ArenaAllocator<pair<const int, int>>> ArenaMap;
+		ArenaMap m{less<int>(), ArenaAllocator<pair<const int, int>>(arena)};
+		m[1] = 2;
+		assert(m.at(1) == 2);
+
+		assert(ArenaAllocator<int>(arena) == ArenaAllocator<double>(arena));
+	}
+	arena.reset();
+}
+
+/// Test double-buffered frame arenas
+void frames()
+{
+	FrameArena frames(1024);
+	int* last = frames.construct<int>(1);
+	frames.nextFrame();
+	assert(frames.frameNumber() == 1);
+
+	// Last frame's allocations stay intact for a frame.
+	int* now = frames.construct<int>(2);
+	assert(*last == 1);
+	assert(&frames.previous() != &frames.current());
+
+	frames.nextFrame();
+	// The arena from two frames ago is reused from the start.
+	assert(frames.construct<int>(3) == last);
+	assert(*now == 2);
+
+	for (int frame = 0; frame < 10; ++frame) {
+		for (int i = 0; i < 1000; ++i)
+			frames.allocate(64);
+		frames.nextFrame();
+	}
+	const size_t settled = frames.current().capacity() + frames.previous().capacity();
+	for (int i = 0; i < 1000; ++i)
+		frames.allocate(64);
+	assert(frames.current().capacity() + frames.previous().capacity() == settled);
+}
+
+} // end anonymous namespace
+
+void Testing::runArenaTests()
+{
+	beginUnit("Arena");
+	test("Allocation", &allocation);
+	test("Rewinding", &rewinding);
+	test("Destructors", &destructors);
+	test("As allocator for STL", &forSTL);
+	test("Frames", &frames);
+}
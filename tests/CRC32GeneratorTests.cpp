@@ -0,0 +1,215 @@
+#include "CRC32GeneratorTests.hpp"
+
+#include <cstdint>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include <sys/uio.h>
+
+#include "Test.hpp"
+#include "CRC32Generator.hpp"
+#include "WorkStealingExecutor.hpp"
+
+using namespace std;
+using namespace Testing;
+
+namespace {
+
+/// The polynomial of CRC-32C, as an example of a custom one
+const uint32_t castagnoli = CRC32Generator::CastagnoliPolynomial;
+
+/// The standard check input for CRC catalogs
+const char check[] = "123456789";
+
+/// Returns some bytes that are the same every run
+vector<uint8_t> randomBytes(size_t count)
+{
+	mt19937 rng(42);
+	vector<uint8_t> bytes(count);
+	for (auto& b : bytes)
+		b = (uint8_t)rng();
+	return bytes;
+}
+
+/// Checks every kernel against the known check values
+void knownValues()
+{
+	const CRC32Generator ieee;
+	assert(ieee.CRC32GenerateBytewise(check, strlen(check)) == 0xCBF43926);
+	assert(ieee.CRC32GenerateSlicingBy8(check, strlen(check)) == 0xCBF43926);
+	assert(ieee.CRC32GenerateSlicingBy16(check, strlen(check)) == 0xCBF43926);
+	assert(ieee.CRC32GenerateFolding(check, strlen(check)) == 0xCBF43926);
+	assert(ieee.CRC32Generate(check, strlen(check)) == 0xCBF43926);
+
+	const CRC32Generator c(castagnoli);
+	assert(c.CRC32GenerateBytewise(check, strlen(check)) == 0xE3069283);
+	assert(c.CRC32GenerateSlicingBy8(check, strlen(check)) == 0xE3069283);
+	assert(c.CRC32GenerateSlicingBy16(check, strlen(check)) == 0xE3069283);
+	assert(c.CRC32GenerateFolding(check, strlen(check)) == 0xE3069283);
+	assert(c.CRC32GenerateInstruction(check, strlen(check)) == 0xE3069283);
+	assert(c.CRC32Generate(check, strlen(check)) == 0xE3069283);
+
+	// The CRC of nothing is zero, thanks to the inversions on the way in and out.
+	assert(ieee.CRC32Generate(check, 0) == 0);
+}
+
+/// Checks that the slicing kernels match the bytewise one at every length and alignment
+void kernelsAgree()
+{
+	const vector<uint8_t> bytes = randomBytes(1024);
+	const uint32_t polynomials[] = { CRC32Generator::IEEEPolynomial, castagnoli, 0x814141AB };
+
+	for (uint32_t polynomial : polynomials) {
+		const CRC32Generator crc(polynomial);
+		for (size_t offset = 0; offset < 16; ++offset) {
+			for (size_t length = 0; length + offset <= 300; ++length) {
+				const uint8_t* data = bytes.data() + offset;
+				const uint32_t expected = crc.CRC32GenerateBytewise(data, length);
+				assert(crc.CRC32GenerateSlicingBy8(data, length) == expected);
+				assert(crc.CRC32GenerateSlicingBy16(data, length) == expected);
+			}
+		}
+
+		assert(crc.CRC32GenerateSlicingBy8(bytes.data(), bytes.size())
+		       == crc.CRC32GenerateBytewise(bytes.data(), bytes.size()));
+		assert(crc.CRC32GenerateSlicingBy16(bytes.data(), bytes.size())
+		       == crc.CRC32GenerateBytewise(bytes.data(), bytes.size()));
+	}
+}
+
+/// Checks that folding matches the tables, whichever instructions this CPU has to fold with
+void folding()
+{
+	const vector<uint8_t> bytes = randomBytes(8192);
+	const uint32_t polynomials[] = { CRC32Generator::IEEEPolynomial, castagnoli, 0x814141AB };
+
+	for (uint32_t polynomial : polynomials) {
+		const CRC32Generator crc(polynomial);
+		// Cover the fallback, both kernels, and every leftover of a lane and of a step.
+		for (size_t offset = 0; offset < 4; ++offset) {
+			for (size_t length = 0; length + offset <= bytes.size(); length += length < 1200 ? 1 : 61) {
+				const uint8_t* data = bytes.data() + offset;
+				assert(crc.CRC32GenerateFolding(data, length) == crc.CRC32GenerateSlicingBy16(data, length));
+			}
+		}
+	}
+}
+
+/// Checks that CRC-32C from the crc32 instruction (or its fallback) matches the tables
+void instruction()
+{
+	const vector<uint8_t> bytes = randomBytes(100000);
+	const CRC32Generator crc(castagnoli);
+
+	// Cover every alignment, the single stream, and runs of both short and long streams.
+	for (size_t offset = 0; offset < 8; ++offset) {
+		for (size_t length = 0; length + offset <= bytes.size(); length += length < 1000 ? 1 : 997) {
+			const uint8_t* data = bytes.data() + offset;
+			const uint32_t expected = crc.CRC32GenerateSlicingBy16(data, length);
+			assert(crc.CRC32GenerateInstruction(data, length) == expected);
+			assert(crc.CRC32Generate(data, length) == expected);
+		}
+	}
+
+	// Other polynomials have to fall back.
+	const CRC32Generator ieee;
+	assert(ieee.CRC32GenerateInstruction(bytes.data(), bytes.size())
+	       == ieee.CRC32GenerateSlicingBy16(bytes.data(), bytes.size()));
+}
+
+/// Checks that checksumming in pieces matches checksumming all at once
+void incremental()
+{
+	const vector<uint8_t> bytes = randomBytes(50000);
+	mt19937 rng(7);
+	const uint32_t polynomials[] = { CRC32Generator::IEEEPolynomial, castagnoli };
+
+	for (uint32_t polynomial : polynomials) {
+		const CRC32Generator crc(polynomial);
+		const uint32_t whole = crc.CRC32Generate(bytes.data(), bytes.size());
+
+		assert(crc.CRC32Finalize(crc.CRC32Begin()) == crc.CRC32Generate(nullptr, 0));
+		assert(crc.CRC32Finalize(crc.CRC32Update(crc.CRC32Begin(), nullptr, 0)) == 0);
+		assert(crc.CRC32Finalize(crc.CRC32UpdateSpans(crc.CRC32Begin(),
+		                                              static_cast<const iovec*>(nullptr), 0)) == 0);
+
+		for (int trial = 0; trial < 20; ++trial) {
+			// Cut the data into pieces of random lengths, some of them empty,
+			// some short enough for the tables and some long enough to fold.
+			vector<CRC32Generator::Span> spans;
+			vector<iovec> iovecs;
+			CRC32Generator::State state = crc.CRC32Begin();
+			for (size_t at = 0; at < bytes.size();) {
+				const size_t maxPiece = trial % 2 == 0 ? 64 : 5000;
+				const size_t piece = min<size_t>(rng() % maxPiece, bytes.size() - at);
+				state = crc.CRC32Update(state, bytes.data() + at, piece);
+
+				CRC32Generator::Span span = { bytes.data() + at, piece };
+				spans.push_back(span);
+				iovec v = { const_cast<uint8_t*>(bytes.data()) + at, piece };
+				iovecs.push_back(v);
+				at += piece;
+			}
+			assert(crc.CRC32Finalize(state) == whole);
+			assert(crc.CRC32Finalize(crc.CRC32UpdateSpans(crc.CRC32Begin(), spans.data(), spans.size()))
+			       == whole);
+			assert(crc.CRC32Finalize(crc.CRC32UpdateSpans(crc.CRC32Begin(), iovecs.data(), iovecs.size()))
+			       == whole);
+		}
+	}
+}
+
+/// Checks that combining the checksums of two pieces gives the checksum of both
+void combining()
+{
+	const vector<uint8_t> bytes = randomBytes(20000);
+	mt19937 rng(11);
+	const uint32_t polynomials[] = { CRC32Generator::IEEEPolynomial, castagnoli, 0x814141AB };
+
+	for (uint32_t polynomial : polynomials) {
+		const CRC32Generator crc(polynomial);
+		for (int trial = 0; trial < 200; ++trial) {
+			const size_t length = rng() % bytes.size();
+			const size_t split = trial < 2 ? trial * length : rng() % (length + 1);
+			const uint32_t a = crc.CRC32Generate(bytes.data(), split);
+			const uint32_t b = crc.CRC32Generate(bytes.data() + split, length - split);
+			assert(crc.CRC32Combine(a, b, length - split) == crc.CRC32Generate(bytes.data(), length));
+		}
+	}
+}
+
+/// Checks that splitting checksums across threads gives the same result
+void parallel()
+{
+	// Long enough to be split into uneven chunks
+	const vector<uint8_t> bytes = randomBytes(3 * 1000 * 1000 + 7);
+	const uint32_t polynomials[] = { CRC32Generator::IEEEPolynomial, castagnoli };
+
+	for (uint32_t polynomial : polynomials) {
+		const CRC32Generator crc(polynomial);
+		const uint32_t whole = crc.CRC32Generate(bytes.data(), bytes.size());
+		for (size_t threads = 1; threads <= 4; ++threads) {
+			WorkStealingExecutor executor(threads);
+			assert(crc.CRC32GenerateParallel(bytes.data(), bytes.size(), executor) == whole);
+			assert(crc.CRC32GenerateParallel(bytes.data(), 1000, executor)
+			       == crc.CRC32Generate(bytes.data(), 1000));
+		}
+		assert(crc.CRC32GenerateParallel(bytes.data(), bytes.size(), size_t(3)) == whole);
+		assert(crc.CRC32GenerateParallel(bytes.data(), bytes.size(), size_t(0)) == whole);
+	}
+}
+
+} // end anonymous namespace
+
+void Testing::runCRC32GeneratorTests()
+{
+	beginUnit("CRC32Generator");
+	test("Known values", &knownValues);
+	test("Kernels agree", &kernelsAgree);
+	test("Folding", &folding);
+	test("CRC-32C instruction", &instruction);
+	test("Incremental", &incremental);
+	test("Combining", &combining);
+	test("Parallel", &parallel);
+}
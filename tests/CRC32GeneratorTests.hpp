@@ -0,0 +1,7 @@
+#pragma once
+
+namespace Testing {
+
+void runCRC32GeneratorTests();
+
+} // end namespace Testing
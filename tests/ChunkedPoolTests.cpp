@@ -0,0 +1,128 @@
+#include "ChunkedPoolTests.hpp"
+
+#include <algorithm>
+#include <vector>
+
+#include "Test.hpp"
+#include "ChunkedPool.hpp"
+
+using namespace std;
+using namespace Testing;
+
+namespace {
+
+/// A dumb payload with which to test our ChunkedPool
+class Payload {
+public:
+
+	Payload() : a(0), b(0) { }
+
+	Payload(int a, int b) : a(a), b(b) { }
+
+	int a, b;
+};
+
+/// Test that the pool grows instead of running out of room
+void growth()
+{
+	ChunkedPool<Payload> aPool(4);
+	vector<Payload*> pointers;
+
+	assert(aPool.chunkCount() == 0);
+
+	for (int i = 0; i < 10; ++i) {
+		pointers.emplace_back(aPool.construct(i, 42 + i));
+		assert(aPool.size() == (size_t)i + 1);
+	}
+
+	assert(aPool.chunkCount() == 3);
+	assert(aPool.capacity() == 12);
+
+	// Growing shouldn't have moved anything
+	for (size_t i = 0; i < pointers.size(); ++i) {
+		assert(pointers[i]->a == (int)i);
+		assert(pointers[i]->b == 42 + (int)i);
+		assert(aPool.owns(pointers[i]));
+	}
+
+	Payload notOurs;
+	assert(!aPool.owns(&notOurs));
+	assertThrown<std::invalid_argument>([&] { aPool.destroy(&notOurs); });
+
+	for (Payload* p : pointers)
+		aPool.destroy(p);
+
+	assert(aPool.empty());
+	// By default, empty chunks are kept around
+	assert(aPool.chunkCount() == 3);
+	aPool.shrinkToFit();
+	assert(aPool.chunkCount() == 0);
+}
+
+/// Test that empty chunks past the limit are freed
+void release()
+{
+	ChunkedPool<Payload> aPool(2, 1);
+	vector<Payload*> pointers;
+
+	for (int i = 0; i < 8; ++i)
+		pointers.emplace_back(aPool.construct(i, 0));
+
+	assert(aPool.chunkCount() == 4);
+
+	for (Payload* p : pointers)
+		aPool.destroy(p);
+
+	// We should have hung on to one chunk
+	assert(aPool.chunkCount() == 1);
+
+	// ...which should get reused
+	Payload* p = aPool.construct();
+	assert(aPool.chunkCount() == 1);
+	aPool.destroy(p);
+}
+
+/// Test iteration across chunks, including empty ones
+void iteration()
+{
+	ChunkedPool<Payload> aPool(3);
+	vector<Payload*> pointers;
+
+	for (int i = 0; i < 9; ++i)
+		pointers.emplace_back(aPool.construct(i, 0));
+
+	// Empty out one of the chunks entirely and poke holes in the others
+	for (size_t i : {0, 3, 4, 5, 8})
+		aPool.destroy(pointers[i]);
+
+	vector<int> seen;
+	for (const Payload& p : aPool)
+		seen.push_back(p.a);
+
+	// Chunks are visited by address, which isn't necessarily creation order,
+	// so just check that everything live is visited exactly once.
+	assert(seen.size() == 4);
+	for (int n : {1, 2, 6, 7})
+		assert(count(seen.begin(), seen.end(), n) == 1);
+
+	assert(aPool.begin() + 4 == aPool.end());
+	assert(aPool.cbegin() + 2 != aPool.cend());
+
+	for (size_t i : {1, 2, 6, 7})
+		aPool.destroy(pointers[i]);
+
+	assert(aPool.begin() == aPool.end());
+
+	// Default-constructed iterators don't belong to any pool, but should still compare equal
+	assert(ChunkedPool<Payload>::iterator() == ChunkedPool<Payload>::iterator());
+}
+
+} // end namespace anonymous
+
+void Testing::runChunkedPoolTests()
+{
+	beginUnit("ChunkedPool");
+	test("Growth", &growth);
+	test("Release", &release);
+	test("Iteration", &iteration);
+}
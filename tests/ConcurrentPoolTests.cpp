@@ -0,0 +1,174 @@
+#include "ConcurrentPoolTests.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "Test.hpp"
+#include "ConcurrentPool.hpp"
+
+using namespace std;
+using namespace Testing;
+
+namespace {
+
+/// A dumb payload with which to test our ConcurrentPool
+class Payload {
+public:
+
+	Payload() : a(0), b(0) { }
+
+	Payload(int a, int b) : a(a), b(b) { }
+
+	int a, b;
+};
+
+typedef ConcurrentPool<Payload> PayloadPool;
+
+/// A payload that wants a cache line to itself
+struct alignas(64) CacheLine {
+	int a;
+};
+
+/// Test construction and destruction from a single cache
+void construction()
+{
+	PayloadPool aPool(100);
+
+	{
+		PayloadPool::Cache cache(aPool);
+		vector<Payload*> pointers;
+
+		for (int i = 0; i < 100; ++i)
+			pointers.emplace_back(cache.construct(i, 42 + i));
+
+		// We should be out of room.
+		assertThrown<std::bad_alloc>([&] { cache.construct(); });
+		assert(cache.tryConstruct() == nullptr);
+
+		// Everything should be distinct and intact
+		vector<Payload*> sorted(pointers);
+		sort(sorted.begin(), sorted.end());
+		assert(unique(sorted.begin(), sorted.end()) == sorted.end());
+
+		for (size_t i = 0; i < pointers.size(); ++i) {
+			assert(pointers[i]->a == (int)i);
+			assert(pointers[i]->b == 42 + (int)i);
+		}
+
+		for (Payload* p : pointers)
+			cache.destroy(p);
+	}
+
+	// Once the cache is gone, everything should be back in the depot.
+	assert(aPool.freeSlots() == aPool.max_size());
+}
+
+/// Test that objects can be destroyed by a different cache than the one that made them,
+/// and that slots make it from one cache to the other through the depot.
+void crossCache()
+{
+	PayloadPool aPool(PayloadPool::magazineSize * 4);
+	PayloadPool::Cache producer(aPool);
+	PayloadPool::Cache consumer(aPool);
+
+	for (int round = 0; round < 10; ++round) {
+		vector<Payload*> pointers;
+		// Use up the entire pool from the producer. This only works if
+		// slots freed by the consumer make it back to the producer.
+		for (size_t i = 0; i < PayloadPool::magazineSize * 2; ++i)
+			pointers.emplace_back(producer.construct(round, (int)i));
+
+		for (Payload* p : pointers) {
+			assert(p->a == round);
+			consumer.destroy(p);
+		}
+
+		consumer.flush();
+	}
+
+	producer.flush();
+	assert(aPool.freeSlots() == aPool.max_size());
+}
+
+/// Test handing objects between threads
+void threaded()
+{
+	const int threadCount = 4;
+	const int perThread = 5000;
+	PayloadPool aPool(threadCount * PayloadPool::magazineSize * 4);
+	atomic<int> bad(0);
+
+	// Each thread constructs objects and hands half of them to its neighbor to destroy.
+	vector<vector<Payload*>> handoff(threadCount);
+	vector<thread> threads;
+	for (int t = 0; t < threadCount; ++t) {
+		threads.emplace_back([&, t] {
+			PayloadPool::Cache cache(aPool);
+			vector<Payload*> mine;
+			for (int i = 0; i < perThread; ++i) {
+				mine.emplace_back(cache.construct(t, i));
+				if (mine.size() == 16) {
+					for (Payload* p : mine) {
+						if (p->a != t)
+							++bad;
+						cache.destroy(p);
+					}
+					mine.clear();
+				}
+			}
+
+			for (Payload* p : mine)
+				cache.destroy(p);
+
+			for (int i = 0; i < 8; ++i)
+				handoff[t].emplace_back(cache.construct(t, i));
+		});
+	}
+
+	for (thread& t : threads)
+		t.join();
+
+	threads.clear();
+	for (int t = 0; t < threadCount; ++t) {
+		threads.emplace_back([&, t] {
+			PayloadPool::Cache cache(aPool);
+			for (Payload* p : handoff[(t + 1) % threadCount])
+				cache.destroy(p);
+		});
+	}
+
+	for (thread& t : threads)
+		t.join();
+
+	assert(bad == 0);
+	assert(aPool.freeSlots() == aPool.max_size());
+}
+
+/// Test that slots for over-aligned types are aligned
+void overAligned()
+{
+	ConcurrentPool<CacheLine> aPool(10);
+	ConcurrentPool<CacheLine>::Cache cache(aPool);
+	vector<CacheLine*> pointers;
+
+	for (int i = 0; i < 10; ++i) {
+		pointers.emplace_back(cache.construct());
+		assert((uintptr_t)pointers.back() % alignof(CacheLine) == 0);
+	}
+
+	for (CacheLine* p : pointers)
+		cache.destroy(p);
+}
+
+} // end namespace anonymous
+
+void Testing::runConcurrentPoolTests()
+{
+	beginUnit("ConcurrentPool");
+	test("Construction", &construction);
+	test("Cross-cache destruction", &crossCache);
+	test("Over-aligned types", &overAligned);
+	test("Threaded", &threaded);
+}
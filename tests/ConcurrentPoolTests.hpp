@@ -0,0 +1,7 @@
+#pragma once
+
+namespace Testing {
+
+void runConcurrentPoolTests();
+
+} // end namespace Testing
@@ -0,0 +1,177 @@
+#include "LockFreePoolTests.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "Test.hpp"
+#include "LockFreePool.hpp"
+
+using namespace std;
+using namespace Testing;
+
+namespace {
+
+/// A payload that remembers who constructed it
+class Payload {
+public:
+
+	Payload() : owner(-1), serial(0) { }
+
+	Payload(int owner, int serial) : owner(owner), serial(serial) { }
+
+	int owner, serial;
+};
+
+/// A payload that wants a cache line to itself
+struct alignas(64) CacheLine {
+	int a;
+};
+
+/// Test construction and destruction from a single thread
+void construction()
+{
+	LockFreePool<Payload> aPool(5);
+	vector<Payload*> pointers;
+
+	for (int i = 0; i < 5; ++i) {
+		pointers.emplace_back(aPool.construct(i, 42 + i));
+		assert(aPool.size() == (size_t)i + 1);
+	}
+
+	assertThrown<std::bad_alloc>([&] { aPool.construct(); });
+	assert(aPool.tryConstruct() == nullptr);
+
+	for (int i = 0; i < 5; ++i) {
+		assert(pointers[i]->owner == i);
+		assert(pointers[i]->serial == 42 + i);
+	}
+
+	// Freed slots should be reused, most recent first.
+	aPool.destroy(pointers[1]);
+	aPool.destroy(pointers[3]);
+	assert(aPool.construct() == pointers[3]);
+	assert(aPool.construct() == pointers[1]);
+
+	Payload notOurs;
+	assertThrown<std::invalid_argument>([&] { aPool.destroy(&notOurs); });
+
+	for (Payload* p : pointers)
+		aPool.destroy(p);
+
+	assert(aPool.empty());
+}
+
+/// Hammer the pool from many threads at once, checking that no slot is ever
+/// handed out to two owners at the same time.
+void stress()
+{
+	const int threadCount = 8;
+	const int rounds = 20000;
+	// Keep the pool small so that slots are constantly recycled between threads
+	// and the pool regularly runs dry.
+	LockFreePool<Payload> aPool(threadCount * 4);
+
+	// One flag per slot: set while someone holds it.
+	unique_ptr<atomic<bool>[]> held(new atomic<bool>[aPool.max_size()]);
+	for (size_t i = 0; i < aPool.max_size(); ++i)
+		held[i] = false;
+
+	// The first slot, so we can work out each object's index
+	Payload* base = aPool.construct();
+	aPool.destroy(base);
+
+	atomic<int> doubleHandouts(0);
+	atomic<int> corrupted(0);
+	atomic<int> exhausted(0);
+
+	vector<thread> threads;
+	for (int t = 0; t < threadCount; ++t) {
+		threads.emplace_back([&, t] {
+			minstd_rand rng(t);
+			vector<Payload*> mine;
+
+			for (int r = 0; r < rounds; ++r) {
+				// Randomly grab or release a few objects at a time.
+				if (mine.empty() || (mine.size() < 8 && rng() % 2 == 0)) {
+					Payload* p = aPool.tryConstruct(t, r);
+					if (p == nullptr) {
+						++exhausted;
+						continue;
+					}
+
+					if (held[p - base].exchange(true))
+						++doubleHandouts;
+					mine.push_back(p);
+				}
+				else {
+					const size_t which = rng() % mine.size();
+					Payload* p = mine[which];
+					mine[which] = mine.back();
+					mine.pop_back();
+
+					// Nobody else should have scribbled on our object.
+					if (p->owner != t)
+						++corrupted;
+
+					held[p - base] = false;
+					aPool.destroy(p);
+				}
+			}
+
+			for (Payload* p : mine) {
+				if (p->owner != t)
+					++corrupted;
+				held[p - base] = false;
+				aPool.destroy(p);
+			}
+		});
+	}
+
+	for (thread& t : threads)
+		t.join();
+
+	assert(doubleHandouts == 0);
+	assert(corrupted == 0);
+	assert(aPool.empty());
+
+	// After all that, every slot should be available exactly once.
+	vector<Payload*> all;
+	for (size_t i = 0; i < aPool.max_size(); ++i)
+		all.push_back(aPool.construct());
+	assert(aPool.tryConstruct() == nullptr);
+
+	sort(all.begin(), all.end());
+	assert(unique(all.begin(), all.end()) == all.end());
+
+	for (Payload* p : all)
+		aPool.destroy(p);
+}
+
+/// Test that slots for over-aligned types are aligned
+void overAligned()
+{
+	LockFreePool<CacheLine> aPool(10);
+	vector<CacheLine*> pointers;
+
+	for (int i = 0; i < 10; ++i) {
+		pointers.emplace_back(aPool.construct());
+		assert((uintptr_t)pointers.back() % alignof(CacheLine) == 0);
+	}
+
+	for (CacheLine* p : pointers)
+		aPool.destroy(p);
+}
+
+} // end namespace anonymous
+
+void Testing::runLockFreePoolTests()
+{
+	beginUnit("LockFreePool");
+	test("Construction", &construction);
+	test("Over-aligned types", &overAligned);
+	test("Stress", &stress);
+}
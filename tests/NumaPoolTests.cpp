@@ -0,0 +1,137 @@
+#include "NumaPoolTests.hpp"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "Test.hpp"
+#include "NumaPool.hpp"
+
+using namespace std;
+using namespace Testing;
+
+namespace {
+
+/// A payload that remembers who constructed it
+class Payload {
+public:
+
+	Payload() : owner(-1), serial(0) { }
+
+	Payload(int owner, int serial) : owner(owner), serial(serial) { }
+
+	int owner, serial;
+};
+
+/// Test parsing the CPU lists found in sysfs
+void cpuLists()
+{
+	assert(Numa::parseCpuList("0") == vector<int>({0}));
+	assert(Numa::parseCpuList("0-3\n") == vector<int>({0, 1, 2, 3}));
+	assert(Numa::parseCpuList("0-1,8,10-11") == vector<int>({0, 1, 8, 10, 11}));
+	assert(Numa::parseCpuList("").empty());
+	assert(Numa::parseCpuList("3-1").empty());
+	assert(Numa::parseCpuList("a-b").empty());
+	assert(Numa::parseCpuList("1;2").empty());
+}
+
+/// Test that we find at least one node, and that every CPU belongs to one
+void topology()
+{
+	const Numa::Topology t = Numa::discoverTopology();
+	assert(t.nodeCount() >= 1);
+	assert(t.nodeIds.size() == t.nodeCount());
+	assert(t.currentNode() < t.nodeCount());
+
+	for (size_t node = 0; node < t.nodeCount(); ++node) {
+		assert(!t.cpusOfNode[node].empty());
+		for (int cpu : t.cpusOfNode[node])
+			assert(t.nodeOfCpu[cpu] == (int)node);
+	}
+}
+
+/// Test construction and destruction from a single thread
+void construction()
+{
+	NumaPool<Payload> aPool(4);
+	assert(aPool.nodeCount() >= 1);
+	assert(aPool.max_size() == 4 * aPool.nodeCount());
+
+	// Fill every partition, local one first.
+	vector<Payload*> pointers;
+	for (size_t i = 0; i < aPool.max_size(); ++i) {
+		pointers.push_back(aPool.construct(0, (int)i));
+		assert(aPool.owns(pointers.back()));
+		assert(aPool.nodeOf(pointers.back()) < aPool.nodeCount());
+	}
+	assert(aPool.size() == aPool.max_size());
+	assertThrown<std::bad_alloc>([&] { aPool.construct(); });
+
+	// Objects should start out on the constructing thread's node if there's room.
+	// (Threads can migrate between the two calls, so only check this on one node.)
+	if (aPool.nodeCount() == 1)
+		assert(aPool.nodeOf(pointers[0]) == aPool.localNode());
+
+	for (size_t i = 0; i < pointers.size(); ++i)
+		assert(pointers[i]->serial == (int)i);
+
+	Payload notOurs;
+	assertThrown<std::invalid_argument>([&] { aPool.destroy(&notOurs); });
+	assert(!aPool.owns(&notOurs));
+
+	for (Payload* p : pointers)
+		aPool.destroy(p);
+	assert(aPool.empty());
+}
+
+/// Construct from some threads and destroy from others
+void threaded()
+{
+	const int threadCount = 4;
+	const int perThread = 1000;
+	NumaPool<Payload> aPool(threadCount * perThread);
+
+	vector<vector<Payload*>> made(threadCount);
+	vector<thread> threads;
+	for (int t = 0; t < threadCount; ++t) {
+		threads.emplace_back([&, t] {
+			for (int i = 0; i < perThread; ++i)
+				made[t].push_back(aPool.construct(t, i));
+		});
+	}
+	for (thread& t : threads)
+		t.join();
+	threads.clear();
+
+	assert(aPool.size() == (size_t)threadCount * perThread);
+
+	// Each thread destroys another thread's objects.
+	atomic<int> corrupted(0);
+	for (int t = 0; t < threadCount; ++t) {
+		threads.emplace_back([&, t] {
+			const int victim = (t + 1) % threadCount;
+			for (int i = 0; i < perThread; ++i) {
+				Payload* p = made[victim][i];
+				if (p->owner != victim || p->serial != i)
+					++corrupted;
+				aPool.destroy(p);
+			}
+		});
+	}
+	for (thread& t : threads)
+		t.join();
+
+	assert(corrupted == 0);
+	assert(aPool.empty());
+}
+
+} // end namespace anonymous
+
+void Testing::runNumaPoolTests()
+{
+	beginUnit("NumaPool");
+	test("CPU lists", &cpuLists);
+	test("Topology", &topology);
+	test("Construction", &construction);
+	test("Threaded", &threaded);
+}
@@ -0,0 +1,102 @@
+#include "ParallelForEachTests.hpp"
+
+#include <atomic>
+#include <stdexcept>
+#include <vector>
+
+#include "Test.hpp"
+#include "ParallelForEach.hpp"
+
+using namespace std;
+using namespace Testing;
+
+namespace {
+
+/// Test that every chunk is run exactly once, however the threads split them up
+void chunks()
+{
+	for (size_t threads = 1; threads <= 4; ++threads) {
+		WorkStealingExecutor executor(threads);
+		assert(executor.threadCount() == threads);
+
+		for (size_t n : {0, 1, 3, 100, 1000}) {
+			vector<atomic<int>> runs(n);
+			for (auto& r : runs)
+				r = 0;
+
+			executor.forEachChunk(n, [&](size_t c) { ++runs[c]; });
+
+			for (auto& r : runs)
+				assert(r == 1);
+		}
+	}
+}
+
+/// Test that a chunk throwing stops the job and rethrows in the caller
+void exceptions()
+{
+	WorkStealingExecutor executor(3);
+	atomic<int> runs(0);
+
+	assertThrown<runtime_error>([&] {
+		executor.forEachChunk(1000, [&](size_t c) {
+			++runs;
+			if (c == 10)
+				throw runtime_error("Chunk 10 failed");
+		});
+	});
+
+	// The executor is still usable afterwards.
+	runs = 0;
+	executor.forEachChunk(50, [&](size_t) { ++runs; });
+	assert(runs == 50);
+}
+
+/// Test that every live object is visited exactly once, and nothing else
+void visitsEachObject()
+{
+	Pool<int> aPool(10000);
+	vector<int*> ints;
+	for (int i = 0; i < 5000; ++i)
+		ints.push_back(aPool.construct(0));
+
+	// Poke holes in the pool, leaving one dense stretch and sparse ones around it.
+	for (size_t i = 0; i < ints.size(); ++i) {
+		if ((i < 1000 || i > 3000) && i % 7 != 0) {
+			aPool.destroy(ints[i]);
+			ints[i] = nullptr;
+		}
+	}
+
+	WorkStealingExecutor executor(4);
+	for (size_t grain : {0, 1, 64, 1000, 100000})
+		parallelForEach(executor, aPool, [](int& i) { ++i; }, grain);
+
+	for (int* i : ints) {
+		if (i != nullptr)
+			assert(*i == 5);
+	}
+
+	const Pool<int>& constPool = aPool;
+	atomic<size_t> count(0);
+	parallelForEach(executor, constPool, [&](const int&) { ++count; });
+	assert(count == aPool.size());
+
+	for (int* i : ints) {
+		if (i != nullptr)
+			aPool.destroy(i);
+	}
+
+	// An empty pool has nothing to visit.
+	parallelForEach(executor, aPool, [](int&) { assert(false); });
+}
+
+} // end anonymous namespace
+
+void Testing::runParallelForEachTests()
+{
+	beginUnit("ParallelForEach");
+	test("Chunks", &chunks);
+	test("Exceptions", &exceptions);
+	test("Visits each object", &visitsEachObject);
+}
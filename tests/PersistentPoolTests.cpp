@@ -0,0 +1,220 @@
+#include "PersistentPoolTests.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "Test.hpp"
+#include "PersistentPool.hpp"
+
+using namespace std;
+using namespace Exceptions;
+using namespace Testing;
+
+namespace {
+
+/// A record, like one we might load from a database
+struct Record {
+	uint32_t id;
+	float balance;
+	char name[16];
+
+	Record() = default;
+
+	Record(uint32_t id, float balance) : id(id), balance(balance), name() { }
+};
+
+/// Something else entirely, to check that files are tied to their types
+struct Other {
+	double a, b, c;
+};
+
+/// Returns a path for a scratch file, and removes anything already there
+string scratchPath(const char* name)
+{
+	const string path = string("/tmp/mkb_") + name + "_" + to_string(getpid()) + ".pool";
+	unlink(path.c_str());
+	return path;
+}
+
+/// Test that objects survive closing and reopening the pool
+void reopening()
+{
+	const string path = scratchPath("reopen");
+	vector<size_t> kept;
+	{
+		PersistentPool<Record> pool(path, 1000);
+		assert(pool.created() && !pool.recovered());
+		assert(pool.empty() && pool.max_size() == 1000);
+
+		vector<Record*> records;
+		for (uint32_t i = 0; i < 100; ++i)
+			records.push_back(pool.construct(i, i * 1.5f));
+
+		for (uint32_t i = 0; i < 100; ++i) {
+			if (i % 4 == 0)
+				pool.destroy(records[i]);
+			else
+				kept.push_back(pool.indexOf(records[i]));
+		}
+		assertThrown<logic_error>([&] { pool.destroy(records[0]); });
+		assertThrown<invalid_argument>([&] { pool.destroy(records[1] + 1000); });
+	}
+	{
+		// The size given for an existing pool is ignored.
+		PersistentPool<Record> pool(path, 5);
+		assert(!pool.created() && !pool.recovered());
+		assert(pool.size() == kept.size() && pool.max_size() == 1000);
+
+		for (size_t index : kept) {
+			const Record* r = pool.at(index);
+			assert(r != nullptr && r->balance == r->id * 1.5f);
+		}
+		assert(pool.at(0) == nullptr);
+		assert(pool.at(5000) == nullptr);
+
+		// The free list carried over too, most recently freed first.
+		assert(pool.indexOf(pool.construct(1000, 0.0f)) == 96);
+
+		size_t count = 0;
+		pool.forEach([&](Record&) { ++count; });
+		assert(count == pool.size());
+		pool.sync();
+	}
+
+	unlink(path.c_str());
+}
+
+/// Test that a pool whose process died is rebuilt from its bitmap
+void recovery()
+{
+	const string path = scratchPath("recover");
+	{
+		PersistentPool<Record> pool(path, 100);
+		for (uint32_t i = 0; i < 10; ++i)
+			pool.construct(i, 0.0f);
+	}
+
+	// Crash a child process part way through using the pool.
+	const pid_t child = fork();
+	assert(child >= 0);
+	if (child == 0) {
+		PersistentPool<Record> pool(path, 100);
+		pool.destroy(pool.at(3));
+		pool.destroy(pool.at(5));
+		pool.construct(10, 0.0f);
+		pool.construct(11, 0.0f);
+		pool.construct(12, 0.0f);
+		_exit(0); // No destructor, so the header stays dirty.
+	}
+	int status;
+	waitpid(child, &status, 0);
+	assert(WIFEXITED(status));
+
+	{
+		PersistentPool<Record> pool(path, 100);
+		assert(pool.recovered());
+		assert(pool.size() == 11);
+
+		uint32_t idSum = 0;
+		pool.forEach([&](const Record& r) { idSum += r.id; });
+		assert(idSum == 45 - 3 - 5 + 10 + 11 + 12);
+
+		// The rebuilt free list should be usable, and the next open clean.
+		while (!pool.full())
+			pool.construct(0, 0.0f);
+	}
+	{
+		PersistentPool<Record> pool(path, 100);
+		assert(!pool.recovered());
+		assert(pool.full());
+	}
+
+	unlink(path.c_str());
+}
+
+/// Test that a damaged free list in a cleanly closed pool is rebuilt instead of followed
+void damagedFreeList()
+{
+	const string path = scratchPath("damaged");
+	{
+		PersistentPool<Record> pool(path, 10);
+		for (uint32_t i = 0; i < 3; ++i)
+			pool.construct(i, 0.0f);
+		pool.destroy(pool.at(1));
+	}
+	{
+		PersistentPool<Record> pool(path, 10);
+		assert(!pool.recovered());
+
+		// Scribble over the link in the free slot, as a bad disk block might.
+		char* first = reinterpret_cast<char*>(pool.at(0));
+		const size_t slotSize = reinterpret_cast<char*>(pool.at(2)) - first;
+		const uint64_t garbage = uint64_t(1) << 40;
+		memcpy(first + slotSize / 2, &garbage, sizeof(garbage));
+
+		while (!pool.full())
+			pool.construct(7, 0.0f);
+		assert(pool.recovered());
+		assert(pool.size() == 10);
+		assert(pool.at(1)->id == 7);
+	}
+	unlink(path.c_str());
+}
+
+/// Test that files which don't hold a pool of the right type are refused
+void refusal()
+{
+	const string path = scratchPath("refuse");
+	{
+		PersistentPool<Record> pool(path, 10);
+	}
+	assertThrown<FileException>([&] { PersistentPool<Other> wrong(path, 10); });
+
+	FILE* f = fopen(path.c_str(), "w");
+	fputs("This is not a pool, just some text that is long enough to pass for a header. "
+	      "It goes on for a little while, to be sure.", f);
+	fclose(f);
+	assertThrown<FileException>([&] { PersistentPool<Record> notAPool(path, 10); });
+
+	assertThrown<FileException>([] { PersistentPool<Record> nowhere("/nonexistent/dir/pool", 10); });
+
+	unlink(path.c_str());
+}
+
+/// Test that a header whose offsets wrap around when added to is refused, not followed
+void wrappedOffsets()
+{
+	const string path = scratchPath("wrapped");
+	{
+		PersistentPool<Record> pool(path, 10);
+	}
+
+	// The bitmap's offset lives 40 bytes in, after the magic, version, checksum,
+	// object size and alignment, and slot count.
+	FILE* f = fopen(path.c_str(), "r+b");
+	const uint64_t wrapping = ~uint64_t(0) - 7;
+	fseek(f, 40, SEEK_SET);
+	fwrite(&wrapping, sizeof(wrapping), 1, f);
+	fclose(f);
+	assertThrown<FileException>([&] { PersistentPool<Record> corrupt(path, 10); });
+
+	unlink(path.c_str());
+}
+
+} // end anonymous namespace
+
+void Testing::runPersistentPoolTests()
+{
+	beginUnit("PersistentPool");
+	test("Reopening", &reopening);
+	test("Recovery", &recovery);
+	test("Damaged free list", &damagedFreeList);
+	test("Refusal", &refusal);
+	test("Wrapped offsets", &wrappedOffsets);
+}
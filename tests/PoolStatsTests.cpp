@@ -0,0 +1,129 @@
+#include "PoolStatsTests.hpp"
+
+#include <cstring>
+#include <vector>
+
+// Pools only keep their counters when this is defined.
+// Since that changes Pool's layout, this file only puts its own types in pools,
+// so that it never instantiates the same Pool as another file.
+#define MKB_POOL_STATS
+#include "Test.hpp"
+#include "Pool.hpp"
+
+using namespace std;
+using namespace Testing;
+
+namespace {
+
+struct Tracked {
+	int value;
+
+	Tracked() : value(0) { }
+};
+
+struct Other {
+	double value;
+
+	Other() : value(0) { }
+};
+
+/// Returns the registry entry with the given name, or null if there isn't one
+const PoolRegistry::Entry* findEntry(const vector<PoolRegistry::Entry>& entries, const char* name)
+{
+	for (const PoolRegistry::Entry& e : entries) {
+		if (strcmp(e.name, name) == 0)
+			return &e;
+	}
+	return nullptr;
+}
+
+/// Test that the counters follow allocations, deallocations, and failures
+void counters()
+{
+	Pool<Tracked> pool(8);
+
+	PoolStats s = pool.stats();
+	assert(s.capacity == 8);
+	assert(s.slotSize >= sizeof(Tracked));
+	assert(s.size == 0);
+	assert(s.peakSize == 0);
+	assert(s.largestFreeRun == 8);
+
+	vector<Tracked*> ts;
+	for (int i = 0; i < 5; ++i)
+		ts.push_back(pool.construct());
+
+	pool.destroy(ts[1]);
+	pool.destroy(ts[3]);
+
+	s = pool.stats();
+	assert(s.size == 3);
+	assert(s.peakSize == 5);
+	assert(s.allocations == 5);
+	assert(s.deallocations == 2);
+	assert(s.largestFreeRun == 3);
+
+	// Blocks count each of their slots.
+	Tracked* block = pool.allocate(3);
+	s = pool.stats();
+	assert(s.allocations == 8);
+	assert(s.blockAllocations == 1);
+	assert(s.peakSize == 6);
+
+	assertThrown<bad_alloc>([&] { pool.allocate(3); });
+	assert(pool.tryConstruct() != nullptr);
+	assert(pool.tryConstruct() != nullptr);
+	assert(pool.tryConstruct() == nullptr);
+	assertThrown<bad_alloc>([&] { pool.construct(); });
+
+	s = pool.stats();
+	assert(s.size == 8);
+	assert(s.peakSize == 8);
+	assert(s.failedAllocations == 3);
+	assert(s.largestFreeRun == 0);
+
+	pool.deallocate(block, 3);
+	pool.clear();
+	s = pool.stats();
+	assert(s.size == 0);
+	assert(s.peakSize == 8);
+	assert(s.allocations == s.deallocations);
+}
+
+/// Test that live pools, and only live pools, show up in the registry
+void registry()
+{
+	const size_t before = PoolRegistry::snapshot().size();
+	{
+		Pool<Tracked> a(4);
+		Pool<Other> b(16);
+		a.setName("stats test a");
+		b.setName("stats test b");
+		a.construct();
+
+		const vector<PoolRegistry::Entry> entries = PoolRegistry::snapshot();
+		assert(entries.size() == before + 2);
+
+		const PoolRegistry::Entry* ea = findEntry(entries, "stats test a");
+		const PoolRegistry::Entry* eb = findEntry(entries, "stats test b");
+		assert(ea != nullptr && eb != nullptr);
+		assert(ea->stats.capacity == 4 && ea->stats.size == 1);
+		assert(eb->stats.capacity == 16 && eb->stats.size == 0);
+
+		a.clear();
+
+		// Pools we don't name go by the name of their type.
+		Pool<Other> c(2);
+		assert(findEntry(PoolRegistry::snapshot(), typeid(Other).name()) != nullptr);
+	}
+	assert(PoolRegistry::snapshot().size() == before);
+}
+
+} // end anonymous namespace
+
+void Testing::runPoolStatsTests()
+{
+	beginUnit("Pool statistics");
+	test("Counters", &counters);
+	test("Registry", &registry);
+}
@@ -0,0 +1,7 @@
+#pragma once
+
+namespace Testing {
+
+void runPoolStatsTests();
+
+} // end namespace Testing
@@ -1,7 +1,14 @@
 #include "PoolTests.hpp"
 
+#include <algorithm>
+#include <cstdio>
+#include <iterator>
+#include <random>
+#include <stdexcept>
 #include <vector>
 
+#include <unistd.h>
+
 #include "Test.hpp"
 #include "Pool.hpp"
 
@@ -24,6 +31,13 @@ public:
 	int a, b;
 };
 
+/// A payload that can't get the memory it needs
+class Hungry {
+public:
+
+	Hungry() { throw std::bad_alloc(); }
+};
+
 /// Test construction and destruction of the Pool
 void instantiation()
 {
@@ -59,10 +73,18 @@ void construction()
 		aPool.destroy(pointers[i]);
 }
 
+/// Test that tryConstruct also gives null back when the object's own constructor runs out of memory
+void hungryConstruction()
+{
+	Pool<Hungry> aPool(1);
+	assert(aPool.tryConstruct() == nullptr);
+	assert(aPool.size() == 0); // Its slot should have been given back
+}
+
 /// Test the out-of-order destruction of objects from the Pool,
 /// which should give us better covereage of Pool::destroy
 /// than the construction test.
-void destroy()
+void destruction()
 {
 	Pool<Payload> aPool(5);
 	vector<Payload*> pointers;
@@ -93,6 +115,178 @@ void destroy()
 	assert(aPool.size() == 0);
 }
 
+/// Test that the single-slot path hands back the most recently freed slot
+/// and keeps the pool iterable as objects are churned
+void churn()
+{
+	Pool<Payload> aPool(8);
+	vector<Payload*> pointers;
+
+	for (size_t i = 0; i < aPool.max_size(); ++i)
+		pointers.emplace_back(aPool.construct(i, 0));
+
+	// Free some from the middle, in no particular order
+	aPool.destroy(pointers[5]);
+	aPool.destroy(pointers[3]);
+	aPool.destroy(pointers[6]);
+	aPool.destroy(pointers[1]);
+	assert(aPool.size() == 4);
+
+	// The free list is a stack, so we should get the freed slots back LIFO
+	pointers[1] = aPool.construct(10, 1);
+	assert(pointers[1] == &*aPool.begin() + 1);
+	pointers[6] = aPool.construct(11, 1);
+	assert(pointers[6] == &*aPool.begin() + 6);
+
+	// Iteration is still in address order
+	int expected[] = {0, 10, 2, 4, 11, 7};
+	size_t seen = 0;
+	for (const Payload& p : aPool) {
+		assert(seen < 6);
+		assert(p.a == expected[seen]);
+		++seen;
+	}
+	assert(seen == 6);
+
+	// Double frees should be caught
+	aPool.destroy(pointers[0]);
+	assertThrown<std::logic_error>([&] { aPool.deallocate(pointers[0], 1); });
+	assertThrown<std::logic_error>([&] { aPool.deallocate(pointers[1] + 1, 2); });
+	assert(aPool.size() == 5);
+
+	for (Payload* p : {pointers[1], pointers[2], pointers[4], pointers[6], pointers[7]})
+		aPool.destroy(p);
+	assert(aPool.empty());
+}
+
+/// Test that iteration over a sparse pool skips free slots properly,
+/// including across whole words of the occupancy bitmap
+void sparseIteration()
+{
+	Pool<Payload> aPool(1000);
+	vector<Payload*> pointers;
+
+	for (size_t i = 0; i < aPool.max_size(); ++i)
+		pointers.emplace_back(aPool.construct(i, 0));
+
+	// Keep every 150th object
+	for (size_t i = 0; i < pointers.size(); ++i) {
+		if (i % 150 != 0)
+			aPool.destroy(pointers[i]);
+	}
+	assert(aPool.size() == 7);
+
+	int n = 0;
+	for (auto it = aPool.cbegin(); it != aPool.cend(); ++it, n += 150)
+		assert(it->a == n);
+	assert(n == 1050);
+
+	assert(aPool.begin()->a == 0);
+	assert((aPool.begin() + 3)->a == 450);
+	assert(aPool.begin() + 7 == aPool.end());
+	assert(aPool.begin() + 100 == aPool.end());
+
+	for (size_t i = 0; i < pointers.size(); i += 150)
+		aPool.destroy(pointers[i]);
+
+	assert(aPool.begin() == aPool.end());
+}
+
+/// Test that handles resolve while their objects live and go stale once they die,
+/// even after their slots are reused
+void handles()
+{
+	typedef Pool<Payload>::Handle Handle;
+
+	Pool<Payload> aPool(4);
+
+	Handle h1 = aPool.constructHandle(1, 2);
+	Handle h2 = aPool.constructHandle(3, 4);
+	assert(h1 != h2);
+	assert(aPool.resolve(h1)->a == 1);
+	assert(aPool.resolve(h2)->b == 4);
+	assert(aPool.handleOf(aPool.resolve(h1)) == h1);
+
+	// Null handles don't resolve to anything
+	assert(Handle().isNull());
+	assert(aPool.resolve(Handle()) == nullptr);
+
+	// Destroy h1's object and reuse its slot
+	Payload* old = aPool.resolve(h1);
+	aPool.destroy(h1);
+	assert(aPool.resolve(h1) == nullptr);
+	Handle h3 = aPool.constructHandle(5, 6);
+	assert(aPool.resolve(h3) == old);
+	assert(h3.index == h1.index);
+	// The old handle should stay dead
+	assert(aPool.resolve(h1) == nullptr);
+	assertThrown<std::logic_error>([&] { aPool.destroy(h1); });
+
+	// Destroying through a pointer invalidates handles too
+	aPool.destroy(aPool.resolve(h2));
+	assert(aPool.resolve(h2) == nullptr);
+
+	// We can only get handles to live objects
+	Payload notOurs;
+	assertThrown<std::invalid_argument>([&] { aPool.handleOf(&notOurs); });
+	assertThrown<std::invalid_argument>([&] { aPool.handleOf(old + 1); });
+
+	aPool.destroy(h3);
+	assert(aPool.empty());
+}
+
+/// Test the smart pointers returned by constructUnique and constructShared
+void smartPointers()
+{
+	Pool<Payload> aPool(4);
+
+	// These should be no bigger than a couple of pointers
+	static_assert(sizeof(Pool<Payload>::unique_ptr) == 2 * sizeof(void*), "unique_ptr is too big");
+	static_assert(sizeof(Pool<Payload>::shared_ptr) == 2 * sizeof(void*), "shared_ptr is too big");
+
+	{
+		Pool<Payload>::unique_ptr u = aPool.constructUnique(1, 2);
+		assert(u->a == 1);
+		assert(aPool.size() == 1);
+
+		Pool<Payload>::unique_ptr moved(std::move(u));
+		assert(aPool.size() == 1);
+	}
+	assert(aPool.empty());
+
+	{
+		Pool<Payload>::shared_ptr s1 = aPool.constructShared(3, 4);
+		assert(s1.use_count() == 1);
+		assert(s1->a == 3);
+		assert((*s1).b == 4);
+
+		{
+			Pool<Payload>::shared_ptr s2 = s1;
+			assert(s1.use_count() == 2);
+			assert(s2 == s1);
+
+			Pool<Payload>::shared_ptr s3 = aPool.constructShared(5, 6);
+			assert(aPool.size() == 2);
+			s3 = s2;
+			// s3's old object should be gone
+			assert(aPool.size() == 1);
+			assert(s1.use_count() == 3);
+
+			Pool<Payload>::shared_ptr s4(std::move(s3));
+			assert(!s3);
+			assert(s1.use_count() == 3);
+		}
+
+		assert(s1.use_count() == 1);
+		assert(aPool.size() == 1);
+
+		s1.reset();
+		assert(!s1);
+		assert(s1.use_count() == 0);
+		assert(aPool.empty());
+	}
+}
+
 /// Test out Pool::allocate and Pool::deallocate
 void allocate()
 {
@@ -149,6 +343,399 @@ void allocate()
 	aPool.deallocate(another, 2);
 }
 
+/// Test multi-slot allocation in a fragmented pool against a simple model of it
+void fragmentedAllocate()
+{
+	const size_t poolSize = 512;
+	Pool<Payload> aPool(poolSize);
+
+	// Grab the whole pool once to find where it starts.
+	Payload* const base = aPool.allocate(poolSize);
+	aPool.deallocate(base, poolSize);
+
+	vector<bool> used(poolSize, false);
+	vector<pair<Payload*, size_t>> blocks;
+	minstd_rand rng(1);
+
+	for (int round = 0; round < 20000; ++round) {
+		if (blocks.empty() || rng() % 3 != 0) {
+			const size_t num = 1 + rng() % 16;
+			Payload* p;
+			try {
+				p = aPool.allocate(num);
+			}
+			catch (const std::bad_alloc&) {
+				// Make sure there really was no room.
+				assert(aPool.largestFreeRun() < num);
+				continue;
+			}
+
+			// No slot should be handed out twice.
+			for (size_t i = p - base; i < p - base + num; ++i) {
+				assert(!used[i]);
+				used[i] = true;
+			}
+			blocks.emplace_back(p, num);
+		}
+		else {
+			const size_t which = rng() % blocks.size();
+			const auto b = blocks[which];
+			blocks[which] = blocks.back();
+			blocks.pop_back();
+
+			for (size_t i = b.first - base; i < b.first - base + b.second; ++i)
+				used[i] = false;
+			aPool.deallocate(b.first, b.second);
+		}
+		assert(aPool.size() == (size_t)count(used.begin(), used.end(), true));
+	}
+
+	for (const auto& b : blocks)
+		aPool.deallocate(b.first, b.second);
+
+	// Everything should coalesce back into one run.
+	assert(aPool.empty());
+	assert(aPool.largestFreeRun() == poolSize);
+	assert(aPool.allocate(poolSize) == base);
+	aPool.deallocate(base, poolSize);
+}
+
+/// Test that allocating and deallocating zero objects leaves the pool alone
+void zeroLength()
+{
+	{
+		// A zero-length allocation shouldn't eat the run it would best fit.
+		Pool<long> aPool(16);
+		long* a = aPool.allocate(3);
+		long* b = aPool.allocate(3);
+		aPool.deallocate(a, 3);
+		aPool.deallocate(aPool.allocate(0), 0);
+		assert(aPool.size() == 3);
+
+		vector<long*> singles;
+		for (int i = 0; i < 13; ++i)
+			singles.push_back(aPool.construct(i));
+		assert(aPool.full());
+
+		for (long* l : singles)
+			aPool.destroy(l);
+		aPool.deallocate(b, 3);
+	}
+	{
+		// Nor should a zero-length deallocation add an empty run or split a real one.
+		Pool<long> aPool(8);
+		long* x = aPool.allocate(4);
+		aPool.deallocate(x + 1, 0);
+		long* one = aPool.construct(1);
+		assert(*one == 1);
+		assert(aPool.size() == 5);
+
+		aPool.deallocate(x, 4);
+		aPool.destroy(one);
+		assert(aPool.largestFreeRun() == 8);
+	}
+}
+
+/// A payload that needs more alignment than malloc promises
+struct alignas(64) Wide {
+	Wide(float f) : lanes() { lanes[0] = f; }
+
+	float lanes[16];
+};
+
+/// Test slot alignment and huge page backing
+void alignment()
+{
+	// Over-aligned types should be aligned without asking.
+	Pool<Wide> widePool(10);
+	vector<Wide*> wides;
+	widePool.constructN(10, back_inserter(wides), 1.0f);
+	for (Wide* w : wides)
+		assert((uintptr_t)w % alignof(Wide) == 0);
+	widePool.destroyAll(wides);
+
+	// Asking for more alignment should pad each slot out to it.
+	typedef Pool<Payload, 64> PaddedPool;
+	PaddedPool padded(10);
+	Payload* first = padded.construct(1, 2);
+	Payload* second = padded.construct(3, 4);
+	assert((uintptr_t)first % 64 == 0 && (uintptr_t)second % 64 == 0);
+	assert((char*)second - (char*)first == 64);
+
+	// Everything else should work as usual.
+	int sum = 0;
+	for (const Payload& p : padded)
+		sum += p.a;
+	assert(sum == 4);
+	const PaddedPool::Handle h = padded.handleOf(second);
+	assert(padded.resolve(h) == second);
+	padded.destroy(first);
+	padded.destroy(h);
+
+	vector<Payload, PaddedPool::allocator> vec(5, padded.getAllocator());
+	assert((uintptr_t)vec.data() % 64 == 0);
+	assert(padded.size() == 5);
+	vec.clear();
+	vec.shrink_to_fit();
+
+	// Huge pages are only a hint, so this should work whether or not the system has them.
+	Pool<Payload> huge(1 << 20, PoolBacking::hugePages);
+	Payload* p = huge.construct(5, 6);
+	assert(p->a == 5);
+	assert(huge.owns(p));
+	huge.destroy(p);
+}
+
+/// Returns the resident set size of the process, in bytes
+size_t residentBytes()
+{
+	FILE* statm = fopen("/proc/self/statm", "r");
+	if (statm == nullptr)
+		return 0;
+
+	size_t total = 0, resident = 0;
+	if (fscanf(statm, "%zu %zu", &total, &resident) != 2)
+		resident = 0;
+	fclose(statm);
+	return resident * sysconf(_SC_PAGESIZE);
+}
+
+/// Test that a huge pool costs nothing until it is used
+void lazyInitialization()
+{
+	const size_t before = residentBytes();
+
+	// 2^26 slots of 8 bytes is half a gigabyte.
+	Pool<Payload> huge(size_t(1) << 26);
+	assert(huge.remaining() == huge.max_size());
+
+	// Untouched slots should be handed out in order.
+	Payload* first = huge.construct(1, 1);
+	Payload* second = huge.construct(2, 2);
+	Payload* third = huge.construct(3, 3);
+	assert(second == first + 1 && third == second + 1);
+
+	// Freed slots come back first, most recent first.
+	huge.destroy(second);
+	huge.destroy(first);
+	assert(huge.construct(4, 4) == first);
+	assert(huge.construct(5, 5) == second);
+	assert(huge.construct(6, 6) == third + 1);
+
+	// Iteration is still in address order.
+	int expected[] = {4, 5, 3, 6};
+	int i = 0;
+	for (const Payload& p : huge)
+		assert(p.a == expected[i++]);
+	assert(i == 4);
+
+	// Only the pages we used (and a bit of bookkeeping) should have been paged in.
+	if (before != 0)
+		assert(residentBytes() - before < (size_t(16) << 20));
+
+	huge.clear();
+}
+
+/// Counts live instances, and throws on construction when asked to
+class Counted {
+public:
+
+	Counted(int v) : value(v)
+	{
+		if (v < 0)
+			throw std::runtime_error("Negative counted value");
+		++live;
+	}
+
+	Counted(const Counted& o) : value(o.value) { ++live; }
+
+	Counted& operator=(const Counted&) = default;
+
+	~Counted() { --live; }
+
+	int value;
+
+	static int live;
+};
+
+int Counted::live = 0;
+
+/// Test constructing and destroying objects in batches
+void bulk()
+{
+	Pool<Counted> aPool(10);
+
+	vector<Counted*> batch;
+	aPool.constructN(6, back_inserter(batch), 42);
+	assert(batch.size() == 6);
+	assert(aPool.size() == 6);
+	assert(Counted::live == 6);
+	for (Counted* c : batch)
+		assert(c->value == 42 && aPool.owns(c));
+
+	// Asking for more than the pool has room for should do nothing at all.
+	vector<Counted*> tooMany;
+	assertThrown<std::bad_alloc>([&] { aPool.constructN(5, back_inserter(tooMany), 1); });
+	assert(tooMany.empty());
+	assert(aPool.size() == 6);
+
+	// A constructor throwing should free its own slot and leave the rest alone.
+	assertThrown<std::runtime_error>([&] { aPool.constructN(2, back_inserter(tooMany), -1); });
+	assert(tooMany.empty());
+	assert(aPool.size() == 6);
+	assert(aPool.remaining() == 4);
+
+	// Destroying a batch should make all of its slots available again.
+	const Pool<Counted>::Handle h = aPool.handleOf(batch[0]);
+	aPool.destroyAll(batch.begin(), batch.begin() + 3);
+	assert(aPool.size() == 3);
+	assert(Counted::live == 3);
+	assert(aPool.resolve(h) == nullptr);
+
+	// A double destroy in the batch should be caught.
+	assertThrown<std::logic_error>([&] { aPool.destroyAll(batch.begin(), batch.begin() + 1); });
+
+	batch.erase(batch.begin(), batch.begin() + 3);
+	aPool.destroyAll(batch);
+	assert(aPool.empty());
+	assert(Counted::live == 0);
+}
+
+/// Test destroying everything in a pool at once
+void clear()
+{
+	Pool<Counted> aPool(100);
+	vector<Counted*> pointers;
+	vector<Pool<Counted>::Handle> handles;
+
+	// Leave a sparse set of live objects
+	for (int i = 0; i < 100; ++i)
+		pointers.push_back(aPool.construct(i));
+	for (int i = 0; i < 100; i += 3)
+		aPool.destroy(pointers[i]);
+	for (int i = 1; i < 100; i += 3)
+		handles.push_back(aPool.handleOf(pointers[i]));
+
+	aPool.clear();
+	assert(aPool.empty());
+	assert(Counted::live == 0);
+	assert(aPool.begin() == aPool.end());
+	for (const auto& h : handles)
+		assert(aPool.resolve(h) == nullptr);
+
+	// The pool should be as good as new.
+	vector<Counted*> refill;
+	aPool.constructN(100, back_inserter(refill), 7);
+	assert(aPool.full());
+	aPool.clear();
+	assert(aPool.remaining() == 100);
+
+	// Trivially destructible types skip the destructor pass.
+	Pool<Payload> plain(10);
+	plain.construct(1, 2);
+	plain.construct(3, 4);
+	plain.clear();
+	assert(plain.empty());
+}
+
+/// Test squeezing a sparse pool's objects to the front
+void compact()
+{
+	typedef Pool<Counted>::Relocation Relocation;
+
+	Pool<Counted> aPool(1000);
+	vector<Counted*> pointers;
+	for (int i = 0; i < 1000; ++i)
+		pointers.push_back(aPool.construct(i));
+
+	// Leave every tenth object, and keep handles to some of them.
+	for (int i = 0; i < 1000; ++i) {
+		if (i % 10 != 0) {
+			aPool.destroy(pointers[i]);
+			pointers[i] = nullptr;
+		}
+	}
+	pointers.erase(remove(pointers.begin(), pointers.end(), nullptr), pointers.end());
+	const Pool<Counted>::Handle first = aPool.handleOf(pointers.front());
+	const Pool<Counted>::Handle last = aPool.handleOf(pointers.back());
+
+	// Fix up our pointers as objects move.
+	size_t calls = 0;
+	Pool<Counted>::Handle lastMoved;
+	const size_t moved = aPool.compact([&](const Relocation& r) {
+		++calls;
+		assert(r.to < r.from);
+		assert(aPool.resolve(r.oldHandle) == nullptr);
+		assert(aPool.resolve(r.newHandle) == r.to);
+		if (r.oldHandle == last)
+			lastMoved = r.newHandle;
+		*find(pointers.begin(), pointers.end(), r.from) = r.to;
+	}, true);
+
+	assert(moved == calls);
+	assert(moved == 90); // The ten objects already in the first 100 slots stay put.
+	assert(aPool.size() == 100);
+	assert(Counted::live == 100);
+
+	// The objects are now in the first 100 slots, in no particular order.
+	assert(aPool.highWaterMark() == 100);
+	int sum = 0;
+	for (Counted* c : pointers) {
+		assert(aPool.handleOf(c).index < 100);
+		sum += c->value;
+	}
+	assert(sum == 49500);
+	assert(distance(aPool.begin(), aPool.end()) == 100);
+
+	assert(aPool.resolve(first) == pointers.front());
+	assert(aPool.resolve(last) == nullptr);
+	assert(aPool.resolve(lastMoved)->value == 990);
+
+	// New objects go right after the compacted ones, and blocks can use the rest.
+	Counted* next = aPool.construct(1);
+	assert(aPool.handleOf(next).index == 100);
+	Counted* block = aPool.allocate(899);
+	assert(aPool.full());
+
+	// Raw blocks can't be moved.
+	assertThrown<std::logic_error>([&] { aPool.compact([](const Relocation&) { }); });
+	aPool.deallocate(block, 899);
+
+	// Compacting an already-compact pool does nothing.
+	assert(aPool.compact([](const Relocation&) { assert(false); }) == 0);
+
+	aPool.destroy(next);
+	aPool.destroyAll(pointers);
+	assert(Counted::live == 0);
+
+	// Neither can objects owned by shared pointers.
+	Pool<Payload> plain(10);
+	plain.construct(1, 1);
+	{
+		Pool<Payload>::shared_ptr shared = plain.constructShared(2, 2);
+		assertThrown<std::logic_error>([&] { plain.compact([](const Pool<Payload>::Relocation&) { }); });
+	}
+	plain.clear();
+
+	// A callback throwing partway through should leave the pool in working order.
+	vector<Payload*> payloads;
+	for (int i = 0; i < 10; ++i)
+		payloads.push_back(plain.construct(i, i));
+	for (int i = 0; i < 10; i += 2)
+		plain.destroy(payloads[i]);
+	int relocations = 0;
+	assertThrown<std::runtime_error>([&] {
+		plain.compact([&](const Pool<Payload>::Relocation&) {
+			if (++relocations == 2)
+				throw std::runtime_error("Relocation failed");
+		});
+	});
+	assert(plain.size() == 5);
+	while (!plain.full())
+		plain.construct(0, 0);
+	plain.clear();
+}
+
 /// Test using a pool and its allocator with a standard library container
 void forSTL()
 {
@@ -157,6 +744,14 @@ void forSTL()
 	vector<Payload, PoolAllocator<Payload>> vec2(10, aPool.getAllocator());
 	// We should be out of memory in the pool now
 	assertThrown<std::bad_alloc>([&] { vector<Payload, PoolAllocator<Payload>> vec3(1, aPool.getAllocator()); });
+
+	// Allocators are equal only if they share a pool, and the pool follows the container.
+	Pool<Payload> otherPool(20);
+	assert(vec1.get_allocator() == vec2.get_allocator());
+	assert(vec1.get_allocator() != otherPool.getAllocator());
+	vector<Payload, PoolAllocator<Payload>> vec4(otherPool.getAllocator());
+	vec4 = move(vec1);
+	assert(vec4.get_allocator() == aPool.getAllocator());
 }
 
 void iteration()
@@ -217,8 +812,20 @@ void Testing::runPoolTests()
 	beginUnit("Pool");
 	test("Instantiation", &instantiation);
 	test("Construction", &construction);
-	test("Destruction", &destroy);
+	test("Hungry construction", &hungryConstruction);
+	test("Destruction", &destruction);
+	test("Single-slot churn", &churn);
+	test("Sparse iteration", &sparseIteration);
+	test("Handles", &handles);
+	test("Smart pointers", &smartPointers);
 	test("Allocate", &allocate);
+	test("Fragmented allocate", &fragmentedAllocate);
+	test("Zero-length blocks", &zeroLength);
+	test("Bulk construction", &bulk);
+	test("Clear", &clear);
+	test("Compaction", &compact);
+	test("Alignment", &alignment);
+	test("Lazy initialization", &lazyInitialization);
 	test("As allocator for STL", &forSTL);
 	test("Iteration", &iteration);
 }
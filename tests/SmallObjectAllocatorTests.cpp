@@ -0,0 +1,299 @@
+#include "SmallObjectAllocatorTests.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <list>
+#include <map>
+#include <new>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "Test.hpp"
+#include "SmallObjectAllocator.hpp"
+
+using namespace std;
+using namespace Testing;
+
+namespace {
+
+/// Test the mapping from request sizes to size classes
+void sizeClasses()
+{
+	typedef SmallObjectAllocator SOA;
+
+	assert(SOA::classOf(0) == 0);
+	assert(SOA::classOf(1) == 0);
+	assert(SOA::classOf(8) == 0);
+	assert(SOA::classOf(9) == 1);
+	assert(SOA::classOf(128) == 15);
+	assert(SOA::classOf(129) == 16);
+	assert(SOA::classOf(144) == 16);
+	assert(SOA::classOf(145) == 17);
+	assert(SOA::classOf(SOA::maxSize) == SOA::classCount - 1);
+	assert(SOA::classSize(SOA::classCount - 1) == SOA::maxSize);
+
+	// Every request should land in the smallest class that fits it.
+	for (size_t bytes = 1; bytes <= SOA::maxSize; ++bytes) {
+		const size_t c = SOA::classOf(bytes);
+		assert(SOA::classSize(c) >= bytes);
+		assert(c == 0 || SOA::classSize(c - 1) < bytes);
+	}
+}
+
+/// Test allocating and freeing from a single thread
+void allocation()
+{
+	SmallObjectAllocator soa;
+
+	// Allocations of every size should be distinct, writable,
+	// and aligned to at least what their size requires.
+	vector<pair<char*, size_t>> blocks;
+	for (size_t bytes = 1; bytes <= SmallObjectAllocator::maxSize; bytes += 7) {
+		char* p = static_cast<char*>(soa.allocate(bytes));
+		assert(soa.owns(p));
+		const size_t slotSize = SmallObjectAllocator::classSize(SmallObjectAllocator::classOf(bytes));
+		const size_t alignment = min<size_t>(slotSize & -slotSize, alignof(max_align_t));
+		assert((uintptr_t)p % alignment == 0);
+		memset(p, (int)bytes, bytes);
+		blocks.emplace_back(p, bytes);
+	}
+
+	for (const auto& b : blocks) {
+		for (size_t i = 0; i < b.second; ++i)
+			assert(b.first[i] == (char)b.second);
+	}
+
+	// Freed slots should be reused, most recent first,
+	// whether or not we tell deallocate the size.
+	void* a = soa.allocate(24);
+	void* b = soa.allocate(24);
+	soa.deallocate(a, 24);
+	soa.deallocate(b);
+	assert(soa.allocate(20) == b);
+	assert(soa.allocate(17) == a);
+	soa.deallocate(a);
+	soa.deallocate(b);
+
+	for (const auto& bl : blocks)
+		soa.deallocate(bl.first, bl.second);
+}
+
+/// Test that requests we can't serve from slabs go to malloc
+void fallback()
+{
+	// Big requests
+	SmallObjectAllocator soa;
+	void* big = soa.allocate(SmallObjectAllocator::maxSize + 1);
+	assert(!soa.owns(big));
+	soa.deallocate(big);
+	big = soa.allocate(SmallObjectAllocator::maxSize * 10);
+	soa.deallocate(big, SmallObjectAllocator::maxSize * 10);
+
+	// Running out of address space
+	SmallObjectAllocator tiny(SmallObjectAllocator::slabSize);
+	const size_t perSlab = SmallObjectAllocator::slabSize / 64;
+	vector<void*> blocks;
+	for (size_t i = 0; i < perSlab; ++i) {
+		blocks.push_back(tiny.allocate(64));
+		assert(tiny.owns(blocks.back()));
+	}
+	assert(tiny.slabsUsed() == 1);
+
+	void* overflow = tiny.allocate(64);
+	assert(!tiny.owns(overflow));
+	void* otherClass = tiny.allocate(8);
+	assert(!tiny.owns(otherClass));
+	tiny.deallocate(overflow, 64);
+	tiny.deallocate(otherClass);
+
+	for (void* p : blocks)
+		tiny.deallocate(p, 64);
+
+	assertThrown<std::invalid_argument>([] { SmallObjectAllocator(SmallObjectAllocator::slabSize - 1); });
+}
+
+/// Test requests for more alignment than their size implies
+void alignment()
+{
+	SmallObjectAllocator soa;
+
+	for (size_t align = 1; align <= 4096; align *= 2) {
+		for (size_t bytes : {1, 24, 100, 1000, 5000}) {
+			void* p = soa.allocate(bytes, align);
+			assert((uintptr_t)p % align == 0);
+			memset(p, 0, bytes);
+			soa.deallocate(p, bytes, align);
+		}
+	}
+
+	// Nothing still needs its alignment
+	for (size_t align = 1; align <= 4096; align *= 2) {
+		void* p = soa.allocate(0, align);
+		assert((uintptr_t)p % align == 0);
+		soa.deallocate(p, 0, align);
+	}
+
+	// Falling back once the slabs run out shouldn't lose the alignment
+	SmallObjectAllocator tiny(SmallObjectAllocator::slabSize);
+	const size_t perSlab = SmallObjectAllocator::slabSize / 128;
+	vector<void*> blocks;
+	for (size_t i = 0; i < perSlab; ++i)
+		blocks.push_back(tiny.allocate(128));
+	assert(tiny.slabsUsed() == 1);
+
+	void* overflow = tiny.allocate(64, 128);
+	assert(!tiny.owns(overflow));
+	assert((uintptr_t)overflow % 128 == 0);
+	tiny.deallocate(overflow, 64, 128);
+
+	for (void* p : blocks)
+		tiny.deallocate(p, 128);
+}
+
+/// Test putting node-based containers on a SmallObjectAllocator
+void stlContainers()
+{
+	SmallObjectAllocator soa;
+
+	typedef SmallObjectStlAllocator<pair<const int, string>> MapAlloc;
+	map<int, string, less<int>, MapAlloc> m{less<int>(), MapAlloc(soa)};
+	unordered_map<int, int, hash<int>, equal_to<int>, SmallObjectStlAllocator<pair<const int, int>>>
+		u(16, hash<int>(), equal_to<int>(), soa);
+	list<int, SmallObjectStlAllocator<int>> l{SmallObjectStlAllocator<int>(soa)};
+
+	for (int i = 0; i < 1000; ++i) {
+		m.emplace(i, to_string(i));
+		u.emplace(i, i * 2);
+		l.push_back(i);
+	}
+	assert(soa.slabsUsed() > 0);
+	assert(soa.owns(&*m.begin()));
+	assert(soa.owns(&*u.begin()));
+	assert(soa.owns(&*l.begin()));
+
+	for (int i = 0; i < 1000; i += 2) {
+		m.erase(i);
+		u.erase(i);
+	}
+	l.remove_if([](int i) { return i % 2 == 0; });
+	assert(m.size() == 500 && u.size() == 500 && l.size() == 500);
+	assert(m.at(501) == "501" && u.at(501) == 1002);
+
+	// Allocators rebound from the same SmallObjectAllocator should be interchangeable.
+	SmallObjectStlAllocator<int> a(soa);
+	SmallObjectStlAllocator<double> b(a);
+	assert(a == b);
+	assert(a != SmallObjectStlAllocator<int>());
+
+	// Copies and moves should carry the allocator along.
+	auto copy = m;
+	assert(copy.get_allocator() == m.get_allocator());
+	list<int, SmallObjectStlAllocator<int>> other;
+	other = move(l);
+	assert(other.get_allocator() == SmallObjectStlAllocator<int>(soa));
+}
+
+#if __cplusplus >= 201703L
+/// Test the std::pmr adapter
+void memoryResource()
+{
+	SmallObjectAllocator soa;
+	SmallObjectResource resource(soa);
+
+	std::pmr::map<int, int> m(&resource);
+	for (int i = 0; i < 100; ++i)
+		m.emplace(i, i);
+	assert(soa.owns(&*m.begin()));
+
+	assert(resource.is_equal(SmallObjectResource(soa)));
+	assert(!resource.is_equal(*std::pmr::new_delete_resource()));
+}
+#endif
+
+/// Allocate and free from several threads at once, checking nobody's memory
+/// gets handed to anyone else.
+void threaded()
+{
+	const int threadCount = 4;
+	const int rounds = 20000;
+	SmallObjectAllocator soa;
+
+	vector<thread> threads;
+	vector<int> errors(threadCount, 0);
+	for (int t = 0; t < threadCount; ++t) {
+		threads.emplace_back([&, t] {
+			vector<pair<unsigned char*, size_t>> mine;
+			for (int r = 0; r < rounds; ++r) {
+				if (mine.size() < 32 && (r / 16) % 2 == 0) {
+					// All threads share a few size classes so they contend.
+					const size_t bytes = 8 + (r % 5) * 24;
+					unsigned char* p = static_cast<unsigned char*>(soa.allocate(bytes));
+					memset(p, t, bytes);
+					mine.emplace_back(p, bytes);
+				}
+				else if (!mine.empty()) {
+					const auto b = mine.back();
+					mine.pop_back();
+					for (size_t i = 0; i < b.second; ++i) {
+						if (b.first[i] != t)
+							++errors[t];
+					}
+					soa.deallocate(b.first, b.second);
+				}
+			}
+			for (const auto& b : mine)
+				soa.deallocate(b.first);
+		});
+	}
+
+	for (thread& t : threads)
+		t.join();
+
+	for (int e : errors)
+		assert(e == 0);
+}
+
+/// Counts calls to newHandler, which gives up after the second
+int handlerCalls = 0;
+
+void newHandler()
+{
+	if (++handlerCalls == 2)
+		std::set_new_handler(nullptr);
+}
+
+/**
+ * Test that a failing operator new calls the new handler and retries until there isn't one.
+ * This holds for the standard library's, and for SmallObjectNew.cpp's (see unit_tests_new).
+ */
+void newHandlerRetries()
+{
+	handlerCalls = 0;
+	std::set_new_handler(&newHandler);
+	assertThrown<std::bad_alloc>([] { ::operator delete(::operator new(size_t(1) << 62)); });
+	assert(handlerCalls == 2);
+
+	handlerCalls = 0;
+	std::set_new_handler(&newHandler);
+	assert(::operator new(size_t(1) << 62, std::nothrow) == nullptr);
+	assert(handlerCalls == 2);
+}
+
+} // end namespace anonymous
+
+void Testing::runSmallObjectAllocatorTests()
+{
+	beginUnit("SmallObjectAllocator");
+	test("Size classes", &sizeClasses);
+	test("Allocation", &allocation);
+	test("Fallback", &fallback);
+	test("Alignment", &alignment);
+	test("STL containers", &stlContainers);
+#if __cplusplus >= 201703L
+	test("Memory resource", &memoryResource);
+#endif
+	test("Threaded", &threaded);
+	test("New handler", &newHandlerRetries);
+}
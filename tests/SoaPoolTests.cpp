@@ -0,0 +1,144 @@
+#include "SoaPoolTests.hpp"
+
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "Test.hpp"
+#include "SoaPool.hpp"
+
+using namespace std;
+using namespace Testing;
+
+namespace {
+
+typedef SoaPool<float, int, string> Entities;
+
+/// Throws on copy when its value is negative, and counts live instances
+class Picky {
+public:
+
+	Picky(int v) : value(v) { ++live; }
+
+	Picky(const Picky& o) : value(o.value)
+	{
+		if (value < 0)
+			throw std::runtime_error("Negative picky value");
+		++live;
+	}
+
+	Picky& operator=(const Picky&) = default;
+
+	~Picky() { --live; }
+
+	int value;
+
+	static int live;
+};
+
+int Picky::live = 0;
+
+/// Test constructing, reading, and destroying rows
+void construction()
+{
+	Entities pool(10);
+	assert(pool.empty());
+	assert(Entities::columnCount == 3);
+
+	const size_t a = pool.construct(1.5f, 2, "two");
+	const size_t b = pool.construct();
+	assert(pool.size() == 2);
+	assert(pool.get<0>(a) == 1.5f && pool.get<1>(a) == 2 && pool.get<2>(a) == "two");
+	assert(pool.get<0>(b) == 0.0f && pool.get<1>(b) == 0 && pool.get<2>(b).empty());
+
+	pool.row(b).get<2>() = "set through a row";
+	assert(pool.get<2>(b) == "set through a row");
+	assert(pool.row(b).slot() == b);
+
+	// Each column is its own cache-aligned array.
+	assert(reinterpret_cast<uintptr_t>(pool.column<0>()) % 64 == 0);
+	assert(reinterpret_cast<uintptr_t>(pool.column<1>()) % 64 == 0);
+	assert(&pool.get<1>(b) == pool.column<1>() + b);
+
+	pool.destroy(a);
+	assert(!pool.live(a));
+	assertThrown<logic_error>([&] { pool.destroy(a); });
+	assertThrown<invalid_argument>([&] { pool.destroy(10); });
+
+	// Freed slots are reused first.
+	assert(pool.construct(3.0f, 3, "three") == a);
+
+	while (!pool.full())
+		pool.construct();
+	assertThrown<bad_alloc>([&] { pool.construct(); });
+
+	pool.clear();
+	assert(pool.empty());
+	assert(pool.highWaterMark() == 0);
+}
+
+/// Test visiting rows and single columns
+void iteration()
+{
+	Entities pool(1000);
+	vector<size_t> slots;
+	for (int i = 0; i < 1000; ++i)
+		slots.push_back(pool.construct(float(i), i, ""));
+
+	for (int i = 0; i < 1000; ++i) {
+		if (i % 3 != 0)
+			pool.destroy(slots[i]);
+	}
+
+	int sum = 0;
+	pool.forEach<1>([&](int& i) { sum += i; });
+	assert(sum == 166833); // 0 + 3 + ... + 999
+
+	pool.forEach<0>([](float& f) { f *= 2; });
+
+	int rows = 0;
+	for (Entities::Row r : pool) {
+		assert(r.slot() % 3 == 0);
+		assert(r.get<0>() == 2.0f * r.get<1>());
+		++rows;
+	}
+	assert(rows == 334);
+
+	const Entities& constPool = pool;
+	size_t count = 0;
+	constPool.forEach<2>([&](const string&) { ++count; });
+	assert(count == pool.size());
+
+	pool.clear();
+	assert(pool.begin() == pool.end());
+}
+
+/// Test that a throwing column leaves the pool unchanged
+void exceptionSafety()
+{
+	{
+		SoaPool<Picky, Picky> pool(4);
+		pool.construct(Picky(1), Picky(2));
+		assert(Picky::live == 2);
+
+		// The second column throws, so the first should be undone.
+		assertThrown<runtime_error>([&] { pool.construct(Picky(3), Picky(-1)); });
+		assert(Picky::live == 2);
+		assert(pool.size() == 1);
+
+		pool.clear();
+		assert(Picky::live == 0);
+	}
+	assert(Picky::live == 0);
+}
+
+} // end anonymous namespace
+
+void Testing::runSoaPoolTests()
+{
+	beginUnit("SoaPool");
+	test("Construction", &construction);
+	test("Iteration", &iteration);
+	test("Exception safety", &exceptionSafety);
+}
@@ -1,7 +1,18 @@
 #include <cstdio>
 
 #include "Test.hpp"
+#include "ArenaTests.hpp"
+#include "CRC32GeneratorTests.hpp"
 #include "PoolTests.hpp"
+#include "PoolStatsTests.hpp"
+#include "ChunkedPoolTests.hpp"
+#include "ConcurrentPoolTests.hpp"
+#include "LockFreePoolTests.hpp"
+#include "NumaPoolTests.hpp"
+#include "ParallelForEachTests.hpp"
+#include "PersistentPoolTests.hpp"
+#include "SmallObjectAllocatorTests.hpp"
+#include "SoaPoolTests.hpp"
 
 int main()
 {
@@ -9,5 +20,16 @@ int main()
 
 	printf("Running unit tests...\n");
 	runPoolTests();
+	runPoolStatsTests();
+	runChunkedPoolTests();
+	runConcurrentPoolTests();
+	runLockFreePoolTests();
+	runNumaPoolTests();
+	runParallelForEachTests();
+	runPersistentPoolTests();
+	runSmallObjectAllocatorTests();
+	runSoaPoolTests();
+	runArenaTests();
+	runCRC32GeneratorTests();
 	return 0;
 }